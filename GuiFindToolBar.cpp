@@ -21,6 +21,13 @@ GuiFindToolBar::GuiFindToolBar(GuiMainWindow *p) : QToolBar(p), mainWnd(p) {
 
   searchedText->installEventFilter(this);
 
+  matchCount = new QLabel(this);
+  addWidget(matchCount);
+
+  scan = new QtScrollbackScan(this);
+  connect(scan, &QtScrollbackScan::matchesFound, this, &GuiFindToolBar::scanMatchesFound);
+  connect(scan, &QtScrollbackScan::finished, this, &GuiFindToolBar::scanFinished);
+
   b = new QToolButton(this);
   b->setText("Up");
   connect(b, SIGNAL(clicked()), this, SLOT(on_findUp()));
@@ -104,16 +111,108 @@ void GuiMainWindow::contextMenuFindPrevious() {
 
 QString GuiFindToolBar::getSearchedText() { return searchedText->text(); }
 
-typedef struct compressed_scrollback_line {
-  size_t len;
-} compressed_scrollback_line;
+namespace {
+
+QString rowText(Terminal *term, int row) {
+  strbuf *buf = strbuf_new();
+  term_search_text(term, row, buf);
+  QString str = QString::fromLatin1(buf->s, buf->len);
+  strbuf_free(buf);
+  return str;
+}
+
+/*
+ * The number of rows, starting at 'row' and going in direction 'dir',
+ * that the scrollback index rules out.
+ */
+int rowsToSkip(Terminal *term, const QByteArray &key, int row, int dir) {
+  int sblen = sbstore_count(term->scrollback);
+  if (key.isEmpty() || row >= sblen) return 0;
+  int next = sbstore_find(term->scrollback, key.constData(), key.size(), row, dir);
+  if (dir > 0) return (next < 0 ? sblen : next) - row;
+  return row - next;
+}
+
+}  // namespace
+
+/*
+ * Pick up the text and options from the bar. Returns false if there
+ * is nothing (valid) to search for. A changed search also restarts
+ * the background count of matches.
+ */
+bool GuiFindToolBar::updatePattern(GuiTerminalWindow *gterm, bool *changed) {
+  *changed = false;
+  QtSearchPattern wanted(getSearchedText(),
+                         mainWnd->menuGetActionById(MENU_FIND_REGEX)->isChecked());
+  if (wanted.isEmpty() || !wanted.isValid()) {
+    scan->cancel();
+    scanned.clear();
+    scanTerm = nullptr;
+    pattern = QtSearchPattern();
+    matchCount->setText(wanted.isEmpty() ? QString() : "Invalid expression");
+    return false;
+  }
+  if (wanted.pattern() == pattern.pattern() && wanted.isRegex() == pattern.isRegex()) return true;
+
+  *changed = true;
+  pattern = wanted;
+  pageStartPosition = gterm->verticalScrollBar()->value();
+  currentSearchedText = getSearchedText();
+  matches = 0;
+  matchCount->setText("...");
+  scanned.clear();
+  scanTerm = gterm->term;
+  scanFirst = sbstore_lineseq(scanTerm->scrollback);
+  scanEnd = scanFirst + sbstore_count(scanTerm->scrollback);
+  scan->start(gterm->term, pattern);
+  return true;
+}
+
+/*
+ * The matches on 'row' of 'term', numbered as for term_search_text.
+ * Scrollback lines the scan has covered take its results; any other
+ * row - the screen, or lines scrolled off since the scan started - is
+ * matched there and then.
+ */
+void GuiFindToolBar::rowMatches(Terminal *term, int row,
+                                QList<QtSearchPattern::Match> &out) const {
+  if (term == scanTerm && row < sbstore_count(term->scrollback)) {
+    uint64_t seq = sbstore_lineseq(term->scrollback) + row;
+    if (seq >= scanFirst && seq < scanEnd) {
+      for (auto it = scanned.constFind(seq); it != scanned.cend() && it.key() == seq; ++it)
+        out.append({row, it->col, it->len});
+      return;
+    }
+  }
+  pattern.matchAll(rowText(term, row), row, out);
+}
+
+void GuiFindToolBar::scanMatchesFound(const QList<QtScrollbackScan::Match> &found) {
+  matches += found.size();
+  matchCount->setText(QString::number(matches) + " ...");
+
+  // keep the scrollback matches, and repaint if any of them is in view
+  GuiTerminalWindow *gterm = mainWnd->getCurrentTerminal();
+  bool visible = false;
+  uint64_t top = 0, bottom = 0;
+  if (gterm && gterm->term == scanTerm) {
+    top = sbstore_lineseq(scanTerm->scrollback) + gterm->verticalScrollBar()->value();
+    bottom = top + scanTerm->rows;
+  }
+  for (const QtScrollbackScan::Match &m : found) {
+    if (uint64_t(m.row) >= scanEnd - scanFirst) continue;  // a screen row
+    uint64_t seq = scanFirst + m.row;
+    scanned.insert(seq, m);
+    visible |= seq >= top && seq < bottom;
+  }
+  if (visible) gterm->viewport()->update();
+}
 
-extern "C" termline *decompressline_no_free(compressed_scrollback_line *line);
+void GuiFindToolBar::scanFinished() {
+  matchCount->setText(matches == 1 ? "1 match" : QString::number(matches) + " matches");
+}
 
 void GuiFindToolBar::on_findUp() {
-  termline *line;
-  tree234 *whichtree;
-  unsigned long tchar;
   findTextFlag = true;
   GuiTerminalWindow *gterm = mainWnd->getCurrentTerminal();
   Terminal *term;
@@ -127,70 +226,46 @@ void GuiFindToolBar::on_findUp() {
   term = gterm->term;
   scrollbar = gterm->verticalScrollBar();
 
-  if (getSearchedText() == "") {
-    findTextFlag = false;
-    gterm->viewport()->repaint();
-    return;
-  }
   tempCol = currentCol;
   tempRow = currentRow;
 
   currentCol -= currentSearchedText.length();
 
-  if (getSearchedText().compare(currentSearchedText, Qt::CaseInsensitive)) {
-    pageStartPosition = scrollbar->value();
-    currentSearchedText = getSearchedText();
-    if (currentCol < 0) currentCol = term->cols - 1;
-    whichtree = NULL;
-    qDebug() << "Total : " << scrollbar->maximum() + term->rows;
-    qDebug() << "Value : " << scrollbar->value();
+  bool newSearch;
+  if (!updatePattern(gterm, &newSearch)) {
+    findTextFlag = false;
+    currentCol = tempCol;
+    gterm->viewport()->repaint();
+    return;
   }
+  if (newSearch && currentCol < 0) currentCol = term->cols - 1;
+  QByteArray key = pattern.indexKey();
 
   if (currentRow < 0) currentRow = scrollbar->value() + term->rows - 1;
 
   while (1) {
-    str = "";
     if (currentRow < 0) {
       currentRow = scrollbar->maximum() + term->rows - 1;
     }
-    if (count234(term->scrollback) > currentRow) {
-      whichtree = term->scrollback;
-      // TODO FIXME this may be a wee bit optimistic
-      compressed_scrollback_line *cline =
-          (compressed_scrollback_line *)index234(whichtree, currentRow);
-      line = decompressline_no_free(cline);
-    } else {
-      whichtree = term->screen;
-      line = (termline *)index234(whichtree, currentRow - count234(term->scrollback));
-    }
-    for (int i = 0; line && i < line->size; i++) {
-      tchar = line->chars[i].chr;
-      switch (tchar & CSET_MASK) {
-        case CSET_ASCII:
-          tchar = term->ucsdata->unitab_line[tchar & 0xFF];
-          break;
-        case CSET_LINEDRW:
-          tchar = term->ucsdata->unitab_xterm[tchar & 0xFF];
-          break;
-        case CSET_SCOACS:
-          tchar = term->ucsdata->unitab_scoacs[tchar & 0xFF];
-          break;
-      }
-      str.append((char)tchar);
-    }
-    if (currentCol >= 0 &&
-        (currentCol = str.lastIndexOf(currentSearchedText, currentCol, Qt::CaseInsensitive)) >= 0) {
-      if (pageStartPosition != scrollbar->value())
-        gterm->setScrollBar(scrollbar->maximum() + term->rows, pageStartPosition, term->rows);
-      else if (currentRow < scrollbar->value() || currentRow > (scrollbar->value() + term->rows)) {
-        gterm->setScrollBar(scrollbar->maximum() + term->rows, currentRow, term->rows);
-        pageStartPosition = scrollbar->value();
+    int skip = rowsToSkip(term, key, currentRow, -1);
+    if (!skip) {
+      str = rowText(term, currentRow);
+      qsizetype len;
+      if (currentCol >= 0 && (currentCol = pattern.lastIndexIn(str, currentCol, &len)) >= 0) {
+        if (pageStartPosition != scrollbar->value())
+          gterm->setScrollBar(scrollbar->maximum() + term->rows, pageStartPosition, term->rows);
+        else if (currentRow < scrollbar->value() ||
+                 currentRow > (scrollbar->value() + term->rows)) {
+          gterm->setScrollBar(scrollbar->maximum() + term->rows, currentRow, term->rows);
+          pageStartPosition = scrollbar->value();
+        }
+        currentSearchedText = str.mid(currentCol, len);
+        tempStartPosition = pageStartPosition;
+        break;
       }
-      currentSearchedText = str.mid(currentCol, currentSearchedText.length());
-      tempStartPosition = pageStartPosition;
-      break;
+      skip = 1;
     }
-    tempStartPosition++;
+    tempStartPosition += skip;
     if (tempStartPosition > (scrollbar->maximum() + term->rows)) {
       findTextFlag = false;
       currentCol = tempCol;
@@ -198,7 +273,7 @@ void GuiFindToolBar::on_findUp() {
       gterm->viewport()->repaint();
       return;
     }
-    currentRow--;
+    currentRow -= skip;
     currentCol = gterm->term->cols - 1;
   }
 
@@ -206,9 +281,6 @@ void GuiFindToolBar::on_findUp() {
 }
 
 void GuiFindToolBar::on_findDown() {
-  termline *line;
-  tree234 *whichtree;
-  unsigned long tchar;
   GuiTerminalWindow *gterm = mainWnd->getCurrentTerminal();
   Terminal *term;
   QScrollBar *scrollbar;
@@ -222,71 +294,46 @@ void GuiFindToolBar::on_findDown() {
   scrollbar = gterm->verticalScrollBar();
 
   findTextFlag = true;
-  if (getSearchedText() == "") {
-    findTextFlag = false;
-    gterm->viewport()->repaint();
-    return;
-  }
   tempCol = currentCol;
   tempRow = currentRow;
   currentCol = currentCol + currentSearchedText.length();
 
-  if (getSearchedText().compare(currentSearchedText, Qt::CaseInsensitive)) {
-    pageStartPosition = scrollbar->value();
-    currentSearchedText = getSearchedText();
-    if (currentCol < 0) currentCol = 0;
-    whichtree = NULL;
+  bool newSearch;
+  if (!updatePattern(gterm, &newSearch)) {
+    findTextFlag = false;
+    currentCol = tempCol;
+    gterm->viewport()->repaint();
+    return;
   }
+  if (newSearch && currentCol < 0) currentCol = 0;
+  QByteArray key = pattern.indexKey();
 
   if (currentRow < 0) currentRow = scrollbar->value();
 
   while (1) {
-    str = "";
-
     if (currentRow >= scrollbar->maximum() + term->rows) {
       currentRow = 0;
     }
-    if (count234(term->scrollback) > currentRow) {
-      whichtree = term->scrollback;
-      // TODO FIXME this may be a wee bit optimistic
-      compressed_scrollback_line *cline =
-          (compressed_scrollback_line *)index234(whichtree, currentRow);
-      line = decompressline_no_free(cline);
-    } else {
-      whichtree = term->screen;
-      line = (termline *)index234(whichtree, abs(currentRow - count234(term->scrollback)));
-    }
-    for (int i = 0; line && i < line->size; i++) {
-      // qDebug() << line->chars[i].chr;
-      tchar = line->chars[i].chr;
-      switch (tchar & CSET_MASK) {
-        case CSET_ASCII:
-          tchar = term->ucsdata->unitab_line[tchar & 0xFF];
-          break;
-        case CSET_LINEDRW:
-          tchar = term->ucsdata->unitab_xterm[tchar & 0xFF];
-          break;
-        case CSET_SCOACS:
-          tchar = term->ucsdata->unitab_scoacs[tchar & 0xFF];
-          break;
-      }
-      str.append((char)tchar);
-    }
-    if (currentCol < term->cols &&
-        (currentCol = str.indexOf(currentSearchedText, currentCol, Qt::CaseInsensitive)) >= 0) {
-      if (pageStartPosition != scrollbar->value())
-        gterm->setScrollBar(scrollbar->maximum() + term->rows, pageStartPosition, term->rows);
-      else {
-        if (currentRow < scrollbar->value() || currentRow >= (scrollbar->value() + term->rows)) {
-          gterm->setScrollBar(scrollbar->maximum() + term->rows, currentRow, term->rows);
-          pageStartPosition = scrollbar->value();
+    int skip = rowsToSkip(term, key, currentRow, 1);
+    if (!skip) {
+      str = rowText(term, currentRow);
+      qsizetype len;
+      if (currentCol < term->cols && (currentCol = pattern.indexIn(str, currentCol, &len)) >= 0) {
+        if (pageStartPosition != scrollbar->value())
+          gterm->setScrollBar(scrollbar->maximum() + term->rows, pageStartPosition, term->rows);
+        else {
+          if (currentRow < scrollbar->value() || currentRow >= (scrollbar->value() + term->rows)) {
+            gterm->setScrollBar(scrollbar->maximum() + term->rows, currentRow, term->rows);
+            pageStartPosition = scrollbar->value();
+          }
         }
+        currentSearchedText = str.mid(currentCol, len);
+        tempStartPosition = pageStartPosition;
+        break;
       }
-      currentSearchedText = str.mid(currentCol, currentSearchedText.length());
-      tempStartPosition = pageStartPosition;
-      break;
+      skip = 1;
     }
-    tempStartPosition++;
+    tempStartPosition += skip;
     if (tempStartPosition > (scrollbar->maximum() + term->rows)) {
       findTextFlag = false;
       currentCol = tempCol;
@@ -294,7 +341,7 @@ void GuiFindToolBar::on_findDown() {
       gterm->viewport()->repaint();
       return;
     }
-    currentRow++;
+    currentRow += skip;
     currentCol = 0;
   }
   gterm->viewport()->repaint();
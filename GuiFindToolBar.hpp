@@ -7,16 +7,31 @@
 #ifndef GUIFINDTOOLBAR_H
 #define GUIFINDTOOLBAR_H
 
+#include <QLabel>
 #include <QLineEdit>
+#include <QMultiHash>
 #include <QToolBar>
 
+#include "QtScrollbackScan.hpp"
+
 class GuiMainWindow;
+class GuiTerminalWindow;
 
 class GuiFindToolBar : public QToolBar {
   Q_OBJECT
 
   GuiMainWindow *mainWnd = nullptr;
   QLineEdit *searchedText = nullptr;
+  QLabel *matchCount = nullptr;
+  QtScrollbackScan *scan = nullptr;
+  qsizetype matches = 0;
+  // the scan's matches so far, by scrollback line sequence number
+  // (see sbstore_lineseq), covering lines [scanFirst, scanEnd) of scanTerm
+  QMultiHash<uint64_t, QtScrollbackScan::Match> scanned;
+  Terminal *scanTerm = nullptr;
+  uint64_t scanFirst = 0, scanEnd = 0;
+
+  bool updatePattern(GuiTerminalWindow *gterm, bool *changed);
 
  public:
   bool findTextFlag = false;
@@ -24,14 +39,20 @@ class GuiFindToolBar : public QToolBar {
   int currentCol = -1;
   int pageStartPosition = 0;
   QString currentSearchedText;
+  QtSearchPattern pattern;
   explicit GuiFindToolBar(GuiMainWindow *p);
   QString getSearchedText();
   bool eventFilter(QObject *obj, QEvent *event) override;
+  void rowMatches(Terminal *term, int row, QList<QtSearchPattern::Match> &out) const;
 
  public slots:
   void on_findUp();
   void on_findDown();
   void on_findClose();
+
+ private slots:
+  void scanMatchesFound(const QList<QtScrollbackScan::Match> &found);
+  void scanFinished();
 };
 
 #endif  // GUIFINDTOOLBAR_H
@@ -16,17 +16,6 @@
 #include "client/windows/handler/exception_handler.h"
 #endif
 
-void callback_notify(void *frontend) {
-  QTimer::singleShot(0, qApp, [] { while (run_toplevel_callbacks()); });
-}
-
-// Connection sharing is not implemented yet
-extern "C" const bool share_can_be_downstream;
-extern "C" const bool share_can_be_upstream;
-
-const bool share_can_be_downstream = false;
-const bool share_can_be_upstream = false;
-
 int main(int argc, char *argv[]) {
   QDir dumps_dir(QDir::home().filePath("qutty/dumps"));
   if (!dumps_dir.exists()) {
@@ -22,6 +22,7 @@
 #include "GuiTabBar.hpp"
 #include "GuiTabWidget.hpp"
 #include "GuiTerminalWindow.hpp"
+#include "QtLogWriter.hpp"
 #include "serialize/QtMRUSessionList.hpp"
 
 extern "C" {
@@ -277,6 +278,12 @@ void GuiMainWindow::readWindowSettings() {
   qutty_config.mainwindow.flag = settings.value("WindowFlags", (int)windowFlags()).toInt();
   qutty_config.mainwindow.menubar_visible = settings.value("ShowMenuBar", false).toBool();
   qutty_config.mainwindow.titlebar_tabs = settings.value("ShowTabsInTitlebar", true).toBool();
+  qutty_config.mainwindow.render_worker = settings.value("RenderInWorkerThread", false).toBool();
+  qutty_config.mainwindow.scrollback_memory_lines =
+      settings.value("ScrollbackMemoryLines", 50000).toInt();
+  qutty_config.mainwindow.log_buffer_kb = settings.value("LogBufferKB", 1024).toInt();
+  qutty_config.mainwindow.log_overflow = QtLogWriter::overflowFromName(
+      settings.value("LogOverflow", QStringLiteral("spill")).toString());
   settings.endGroup();
 
   if (qutty_config.mainwindow.titlebar_tabs && qutty_config.mainwindow.menubar_visible)
@@ -309,6 +316,11 @@ void GuiMainWindow::writeWindowSettings() {
   settings.setValue("WindowFlags", (int)windowFlags());
   settings.setValue("ShowMenuBar", qutty_config.mainwindow.menubar_visible);
   settings.setValue("ShowTabsInTitlebar", qutty_config.mainwindow.titlebar_tabs);
+  settings.setValue("RenderInWorkerThread", qutty_config.mainwindow.render_worker);
+  settings.setValue("ScrollbackMemoryLines", qutty_config.mainwindow.scrollback_memory_lines);
+  settings.setValue("LogBufferKB", qutty_config.mainwindow.log_buffer_kb);
+  auto logOverflow = QtLogWriter::Overflow(qutty_config.mainwindow.log_overflow);
+  settings.setValue("LogOverflow", QtLogWriter::overflowName(logOverflow));
   if (!isMaximized()) {
     settings.setValue("Size", size());
     settings.setValue("Position", pos());
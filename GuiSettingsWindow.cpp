@@ -310,6 +310,9 @@ QString formatTTYMode(const QString &value);
   X("rb_sessionlog_askuser", logxfovr, LGXF_ASK)                               \
   X("chb_sessionlog_flush", logflush)                                          \
   X("chb_logheader", logheader)                                                \
+  X("le_sessionlog_rotate_size", logrotatesize)                                \
+  X("le_sessionlog_rotate_time", logrotatetime)                                \
+  X("chb_sessionlog_compress", logcompress)                                    \
   X("chb_sessionlog_omitpasswd", logomitpass)                                  \
   X("chb_sessionlog_omitdata", logomitdata)                                    \
   /* Terminal Emulation */                                                     \
@@ -11,13 +11,24 @@
 #include <QDebug>
 #include <QMessageBox>
 #include <QPainter>
+#include <QProgressDialog>
 #include <QScrollBar>
+#include <QThreadPool>
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUTTY_HAVE_SSE2
+#endif
 
 #include "GuiFindToolBar.hpp"
 #include "GuiMainWindow.hpp"
 #include "GuiMenu.hpp"
 #include "GuiSplitter.hpp"
 #include "GuiTabWidget.hpp"
+#include "QtFrameScheduler.hpp"
+#include "QtLogWriter.hpp"
+#include "QtScrollbackSpill.hpp"
 #include "QuTTY.hpp"
 #include "serialize/QtWebPluginMap.hpp"
 
@@ -44,11 +55,22 @@ GuiTerminalWindow::GuiTerminalWindow(QWidget *parent, GuiMainWindow *mainWindow,
   viewport()->setCursor(Qt::IBeamCursor);
   viewport()->setAttribute(Qt::WA_OpaquePaintEvent);
 
+  renderInWorker = qutty_config.mainwindow.render_worker;
+
+  floodIdle.setSingleShot(true);
+  floodIdle.setInterval(FLOOD_IDLE_MS);
+  connect(&floodIdle, &QTimer::timeout, this, &GuiTerminalWindow::endFlood);
+
+  pastePump.setInterval(PASTE_PUMP_MS);
+  connect(&pastePump, &QTimer::timeout, this, &GuiTerminalWindow::pumpPaste);
+
   // enable drag-drop
   setAcceptDrops(true);
 }
 
 GuiTerminalWindow::~GuiTerminalWindow() {
+  waitForRender();
+
   if (_tmuxMode == TMUX_MODE_GATEWAY && _tmuxGateway) {
     _tmuxGateway->initiateDetach();
     delete _tmuxGateway;
@@ -64,7 +86,13 @@ GuiTerminalWindow::~GuiTerminalWindow() {
     term_provide_backend(term, NULL);
     term_free(term);
     term = NULL;
+  } else if (term) {
+    // see initBenchTerminal()
+    term_free(term);
+    term = NULL;
   }
+  // closes the logs, once the writers have caught up
+  for (LogContext *logctx : logContexts) log_free(logctx);
 }
 
 int GuiTerminalWindow::initTerminal() {
@@ -80,7 +108,7 @@ int GuiTerminalWindow::initTerminal() {
   init_ucs(cfg, &ucsdata);
   setTermFont(cfg);
 
-  LogContext *logctx = log_init(default_logpolicy, cfg);
+  LogContext *logctx = newLogContext();
 
   const BackendVtable *vt = backend_vt_from_proto(conf_get_int(cfg, CONF_protocol));
   int port = conf_get_int(cfg, CONF_port);
@@ -102,10 +130,12 @@ int GuiTerminalWindow::initTerminal() {
   }
 
   term = term_init(cfg, &ucsdata, this);
-  logctx = log_init(default_logpolicy, cfg);
+  setupClipboards();
+  logctx = newLogContext();
   term_provide_logctx(term, logctx);
 
   term_size(term, termHeight(), termWidth(), conf_get_int(cfg, CONF_savelines));
+  attachScrollbackSpill();
 
   /*
    * Connect the terminal to the backend for resize purposes.
@@ -123,6 +153,57 @@ cu0:
   return -1;
 }
 
+/*
+ * Which clipboards a mouse selection goes to: always the terminal's
+ * own, and the system clipboard as well if "auto-copy" is on.
+ */
+void GuiTerminalWindow::setupClipboards() {
+  term->n_mouse_select_clipboards = 1;
+  if (conf_get_bool(cfg, CONF_mouseautocopy))
+    term->mouse_select_clipboards[term->n_mouse_select_clipboards++] = CLIP_SYSTEM;
+}
+
+/*
+ * Let scrollback beyond what is configured to stay in memory go to
+ * segment files on disk. Has to be done while the scrollback is empty.
+ */
+void GuiTerminalWindow::attachScrollbackSpill() {
+  int memlines = qutty_config.mainwindow.scrollback_memory_lines;
+  if (memlines > 0)
+    sbstore_set_spill(term->scrollback, new QtScrollbackSpill(cfgOwner.name()), memlines);
+}
+
+LogContext *GuiTerminalWindow::newLogContext() {
+  LogContext *logctx = log_init(default_logpolicy, cfg);
+  size_t highWater = size_t(std::max(qutty_config.mainwindow.log_buffer_kb, 4)) * 1024;
+  auto overflow = QtLogWriter::Overflow(qutty_config.mainwindow.log_overflow);
+  log_set_writer(logctx, QtLogWriter::create(highWater, overflow));
+  logContexts.push_back(logctx);
+  return logctx;
+}
+
+/*
+ * Set up a terminal with no backend behind it, sized to cols x rows,
+ * to be fed canned output through term_data(). Used by the render
+ * benchmark and the terminal tests.
+ */
+int GuiTerminalWindow::initBenchTerminal(int cols, int rows) {
+  static_cast<TermWin *>(this)->vt = &qttermwin_vt;
+  static_cast<Seat *>(this)->vt = &qtseat_vt;
+
+  memset(&ucsdata, 0, sizeof(struct unicode_data));
+  init_ucs(cfg, &ucsdata);
+  setTermFont(cfg);
+  // so that the viewport, and hence the terminal, is exactly cols x rows
+  setFrameShape(QFrame::NoFrame);
+  resize(cols * fontWidth, rows * fontHeight);
+
+  term = term_init(cfg, &ucsdata, this);
+  setupClipboards();
+  term_size(term, rows, cols, conf_get_int(cfg, CONF_savelines));
+  return 0;
+}
+
 static bool confUnequalInt(Conf *a, Conf *b, config_primary_key key) {
   return conf_get_int(a, key) != conf_get_int(b, key);
 }
@@ -158,6 +239,7 @@ int charset;
 static bool confFontChanged(Conf *a, Conf *b) {
   int resize_action = conf_get_int(a, CONF_resize_action);
   return confUnequalFont(a, b, CONF_font) || confUnequalStr(a, b, CONF_line_codepage) ||
+         confUnequalBool(a, b, CONF_cjk_ambig_wide) ||
          confUnequalInt(a, b, CONF_font_quality) || confUnequalInt(a, b, CONF_vtmode) ||
 #if 0
          confUnequalInt(a, b, CONF_bold_colour) ||
@@ -182,7 +264,14 @@ int GuiTerminalWindow::restartTerminal() {
     term_provide_backend(term, NULL);
     term_free(term);
     term = NULL;
+  } else if (term) {
+    term_free(term);
+    term = NULL;
   }
+  // close the old session's logs, and stop their writers, before the
+  // new session opens its own
+  for (LogContext *logctx : logContexts) log_free(logctx);
+  logContexts.clear();
   isSockDisconnected = false;
   return initTerminal();
 }
@@ -203,6 +292,7 @@ int GuiTerminalWindow::reconfigureTerminal(const PuttyConfig &new_cfg) {
 
   /* Pass new config data to the terminal */
   term_reconfig(term, cfg);
+  setupClipboards();
 
   /* Pass new config data to the back end */
   if (backend) backend_reconfig(backend, cfg);
@@ -234,7 +324,8 @@ TmuxWindowPane *GuiTerminalWindow::initTmuxClientTerminal(TmuxGateway *gateway,
   setTermFont(cfg);
 
   term = term_init(cfg, &ucsdata, this);
-  LogContext *logctx = log_init(default_logpolicy, cfg);
+  setupClipboards();
+  LogContext *logctx = newLogContext();
   term_provide_logctx(term, logctx);
   int cfg_width = conf_get_int(cfg, CONF_width);
   int cfg_height = conf_get_int(cfg, CONF_height);
@@ -245,6 +336,7 @@ TmuxWindowPane *GuiTerminalWindow::initTmuxClientTerminal(TmuxGateway *gateway,
     mainWindow->resize(cfg_width * fontWidth, cfg_height * fontHeight);
   }
   term_size(term, height, width, conf_get_int(cfg, CONF_savelines));
+  attachScrollbackSpill();
 
   _tmuxMode = TMUX_MODE_CLIENT;
   _tmuxGateway = gateway;
@@ -328,99 +420,157 @@ void GuiTerminalWindow::keyReleaseEvent(QKeyEvent *e) {
   noise_ultralight(NOISE_SOURCE_KEY, e->key());
 }
 
+/*
+ * Mark the find bar's matches over the rows in view, and the current
+ * match more strongly. Drawn with the active painter at the end of
+ * paintEvent, so the frame buffer itself never holds a highlight.
+ */
 void GuiTerminalWindow::highlightSearchedText() {
-  /* The highlighting should trigger a repaint, and should be handled then and there.
-   */
-  if (mainWindow->getCurrentTerminal() != this) return;
+  if (!mainWindow || mainWindow->getCurrentTerminal() != this) return;
   GuiFindToolBar *findToolBar = mainWindow->findToolBar;
-  assert(findToolBar);
-
-  const QString &text = findToolBar->currentSearchedText;
-  unsigned long attr = 0;
-  QString str = "";
-  for (int y = 0; y < term->rows; y++) {
-    str = QString::fromWCharArray(&term->dispstr[y * term->cols], term->cols);
-    int index = 0;
-    while ((index = str.indexOf(text, index, Qt::CaseInsensitive)) >= 0) {
-      attr |= (8 << ATTR_FGSHIFT | (3 << ATTR_BGSHIFT));
-      drawText(index, y, str.mid(index, text.length()), attr, 0, {});
-      index = index + (text.length());
-    }
-  }
-  str = QString::fromWCharArray(
-      &term->dispstr[(findToolBar->currentRow - verticalScrollBar()->value()) * term->cols],
-      term->cols);
-  if (str.indexOf(text, findToolBar->currentCol, Qt::CaseInsensitive) >= 0) {
-    int x = findToolBar->currentCol;
-    int y = findToolBar->currentRow - verticalScrollBar()->value();
-    drawText(x, y, findToolBar->currentSearchedText, ((5 << ATTR_FGSHIFT) | (7 << ATTR_BGSHIFT)), 0,
-             {});
-  }
+  if (!findToolBar || !findToolBar->findTextFlag) return;
+
+  int top = verticalScrollBar()->value();
+  QList<QtSearchPattern::Match> matches;
+  for (int y = 0; y < term->rows; y++) findToolBar->rowMatches(term, top + y, matches);
+  for (const QtSearchPattern::Match &m : matches)
+    painter.fillRect(m.col * fontWidth, (m.row - top) * fontHeight, m.len * fontWidth,
+                     fontHeight, QColor(255, 255, 0, 96));
+
+  int y = findToolBar->currentRow - top;
+  if (y >= 0 && y < term->rows && findToolBar->currentCol >= 0)
+    painter.fillRect(findToolBar->currentCol * fontWidth, y * fontHeight,
+                     findToolBar->currentSearchedText.length() * fontWidth, fontHeight,
+                     QColor(255, 128, 0, 160));
 }
 
 void GuiTerminalWindow::paintEvent(QPaintEvent *e) {
   assert(!painter.isActive());
-  if (term->window_update_pending) term_update(term);
+  framePending = false;
+  // while flooding, an expose shows the last progress frame
+  if (term->window_update_pending && !flooding) term_update(term);
   painter.begin(viewport());
-  painter.drawImage(QPoint(0, 0), frameBuffer);
+  // only blit what has actually changed since the last paint
+  qreal dpr = frameBuffer.devicePixelRatio();
+  for (const QRect &r : e->region())
+    painter.drawImage(r, frameBuffer,
+                      QRectF(r.x() * dpr, r.y() * dpr, r.width() * dpr, r.height() * dpr));
+  highlightSearchedText();
   painter.end();
 }
 
 bool GuiTerminalWindow::setupContext() {
-  assert(!painter.isActive());
-  painter.begin(&frameBuffer);
-  painter.setFont(_font);
+  assert(!recording);
+  recording = true;
+  renderStats.frames++;
+  frames.emplace_back();
   return true;
 }
 
-static QString decode(Terminal *term, const wchar_t *text, int len) {
+/*
+ * Copy the low byte of each wchar_t, i.e. strip the CSET_* bits from
+ * a run of single-byte characters.
+ */
+static void narrowLowBytes(char16_t *dst, const wchar_t *src, int len) {
+  int i = 0;
+#ifdef QUTTY_HAVE_SSE2
+  const __m128i lowByte = _mm_set1_epi16(0xFF);
+  if constexpr (sizeof(wchar_t) == 2) {
+    for (; i + 8 <= len; i += 8) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_and_si128(v, lowByte));
+    }
+  } else {
+    // masked values fit in 16 bits, so the signed saturating pack is exact
+    const __m128i lowByte32 = _mm_set1_epi32(0xFF);
+    for (; i + 8 <= len; i += 8) {
+      __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 4));
+      __m128i v = _mm_packs_epi32(_mm_and_si128(lo, lowByte32), _mm_and_si128(hi, lowByte32));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+  }
+#endif
+  for (; i < len; i++) dst[i] = char16_t(src[i] & 0xFF);
+}
+
+/*
+ * Convert a run of terminal characters to UTF-16. The result lives in
+ * a per-window scratch buffer and is only valid until the next call;
+ * once the buffer has grown to the width of a line, decoding does no
+ * heap allocation.
+ */
+QStringView GuiTerminalWindow::decode(const wchar_t *text, int len) {
   static QStringDecoder sd = QStringDecoder(QStringDecoder::System);
-  QString str = QString(QStringView(text, len));
-  QByteArray bytes;
-  if (str.isEmpty()) return str;
+  if (len <= 0) return {};
 
-  char16_t *start = nullptr;
+  decodeBuf.resize(len);
+  char16_t *str = reinterpret_cast<char16_t *>(decodeBuf.data());
   char16_t *end = nullptr;
   char16_t encoding = text[0] & CSET_MASK;
 
   switch (encoding) {
     case CSET_ASCII:
-      for (int i = 0; i < len; i++) str[i] = QChar(text[i] & 0xFF);
+      narrowLowBytes(str, text, len);
       break;
     case CSET_OEMCP:
-      for (int i = 0; i < len; i++) str[i] = QChar(term->ucsdata->unitab_oemcp[text[i] & 0xFF]);
+      for (int i = 0; i < len; i++) str[i] = term->ucsdata->unitab_oemcp[text[i] & 0xFF];
       break;
     case CSET_LINEDRW:
-      for (int i = 0; i < len; i++) str[i] = QChar(term->ucsdata->unitab_line[text[i] & 0xFF]);
+      for (int i = 0; i < len; i++) str[i] = term->ucsdata->unitab_line[text[i] & 0xFF];
       break;
     case CSET_SCOACS:
-      for (int i = 0; i < len; i++) str[i] = QChar(term->ucsdata->unitab_scoacs[text[i] & 0xFF]);
+      for (int i = 0; i < len; i++) str[i] = term->ucsdata->unitab_scoacs[text[i] & 0xFF];
       break;
     case CSET_ACP:
-      bytes.resize(len);
-      for (int i = 0; i < len; i++) bytes[i] = text[i] & 0xFF;
-      str.resize(sd.requiredSpace(len));
-      start = str.data_ptr().data();
-      end = sd.appendToBuffer(start, bytes);
-      str.resize(end - start);
+      decodeBytes.resize(len);
+      for (int i = 0; i < len; i++) decodeBytes[i] = text[i] & 0xFF;
+      decodeBuf.resize(sd.requiredSpace(len));
+      str = reinterpret_cast<char16_t *>(decodeBuf.data());
+      end = sd.appendToBuffer(str, decodeBytes);
+      return QStringView(str, end - str);
+    default:
+      if constexpr (sizeof(wchar_t) == sizeof(char16_t)) {
+        // already UTF-16
+        memcpy(str, text, len * sizeof(char16_t));
+      } else {
+        // UCS-4; characters outside the BMP need a surrogate pair
+        decodeBuf.resize(2 * len);
+        str = reinterpret_cast<char16_t *>(decodeBuf.data());
+        qsizetype n = 0;
+        for (int i = 0; i < len; i++) {
+          char32_t c = char32_t(text[i]);
+          if (QChar::requiresSurrogates(c)) {
+            str[n++] = QChar::highSurrogate(c);
+            str[n++] = QChar::lowSurrogate(c);
+          } else {
+            str[n++] = char16_t(c);
+          }
+        }
+        return QStringView(str, n);
+      }
       break;
   }
-  return str;
+  return QStringView(str, len);
 }
 
-void GuiTerminalWindow::setPenBrushFromAttrs(unsigned long attrs) {
+void GuiTerminalWindow::coloursFromAttrs(unsigned long attrs, truecolour tc, QRgb &fg,
+                                         QRgb &bg) const {
   if (attrs & (TATTR_ACTCURS | TATTR_PASCURS)) {
     attrs &= ~(ATTR_REVERSE | ATTR_BLINK | ATTR_COLOURS);
     if (bold_mode == BOLD_COLOURS) attrs &= ~ATTR_BOLD;
     /* cursor fg and bg. Note that cursor_bg is the color of the bulk of the cursor, while fg is the
      color of the I guess text drawn over the cursor? */
     attrs |= (OSC4_COLOUR_cursor_bg << ATTR_FGSHIFT) | (OSC4_COLOUR_cursor_fg << ATTR_BGSHIFT);
+    // the cursor is always drawn in its configured colours
+    tc.fg = tc.bg = optionalrgb_none;
   }
 
   int nfg = ((attrs & ATTR_FGMASK) >> ATTR_FGSHIFT);
   int nbg = ((attrs & ATTR_BGMASK) >> ATTR_BGSHIFT);
   if (attrs & ATTR_REVERSE) {
     std::swap(nfg, nbg);
+    std::swap(tc.fg, tc.bg);
   }
   if (bold_mode == BOLD_COLOURS && (attrs & ATTR_BOLD)) {
     if (nfg < 16)
@@ -435,101 +585,294 @@ void GuiTerminalWindow::setPenBrushFromAttrs(unsigned long attrs) {
       nbg |= 1;
   }
 
-  painter.setPen(QPen(colours[nfg], 0));
-  painter.setBrush(colours[nbg]);
+  fg = tc.fg.enabled ? qRgb(tc.fg.r, tc.fg.g, tc.fg.b) : colours[nfg].rgb();
+  bg = tc.bg.enabled ? qRgb(tc.bg.r, tc.bg.g, tc.bg.b) : colours[nbg].rgb();
+}
+
+uint8_t GuiTerminalWindow::glyphStyle(unsigned long attrs) const {
+  uint8_t style = 0;
+  if (bold_mode == BOLD_FONT && (attrs & ATTR_BOLD)) style |= QtGlyphAtlas::STYLE_BOLD;
+  if (attrs & ATTR_UNDER) style |= QtGlyphAtlas::STYLE_UNDERLINE;
+  return style;
+}
+
+/*
+ * Runs of single-cell, non-combining characters on normal-width lines
+ * map one QChar to one character cell, and can be drawn from the glyph
+ * atlas when they use palette colours. Everything else goes through
+ * QPainter::drawText.
+ */
+static bool canUseGlyphAtlas(QStringView str, int len, unsigned long attrs, int lineAttrs,
+                             truecolour tc) {
+  if (str.length() != len) return false;
+  // 24-bit colours would quickly flood the atlas with single-use glyphs
+  if (tc.fg.enabled || tc.bg.enabled) return false;
+  if ((lineAttrs & LATTR_MODE) != LATTR_NORM) return false;
+  if (attrs & (ATTR_WIDE | ATTR_NARROW | TATTR_COMBINING)) return false;
+  for (QChar c : str)
+    if (c.isSurrogate()) return false;
+  return true;
+}
+
+/*
+ * Between setupContext() and freeContext() nothing is painted right
+ * away: draw_text calls are recorded into a QtRenderFrame, merged with
+ * the previous run when they continue it with the same colours and
+ * style, and rendered in one go when the frame is complete.
+ */
+void GuiTerminalWindow::queueText(int x, int y, QStringView str, unsigned long attrs,
+                                  int lineAttrs, truecolour tc, bool atlas) {
+  assert(recording);
+  QtRenderFrame &frame = frames.back();
+  QRgb fg, bg;
+  coloursFromAttrs(attrs, tc, fg, bg);
+  uint8_t style = glyphStyle(attrs);
+
+  if (atlas && !frame.runs.empty()) {
+    QtRenderFrame::TextRun &last = frame.runs.back();
+    if (last.atlas && last.y == y && last.x + last.len == x && last.fg == fg && last.bg == bg &&
+        last.style == style && last.offset + last.len == frame.text.length()) {
+      frame.text.append(str);
+      last.len += str.length();
+      return;
+    }
+  }
+  // combining characters share their cell, and are left at their natural width
+  bool narrow = (attrs & ATTR_NARROW) && !(attrs & TATTR_COMBINING);
+  frame.runs.push_back({x, y, int(frame.text.length()), int(str.length()), fg, bg, style,
+                        bool(attrs & ATTR_WIDE), narrow, atlas});
+  frame.text.append(str);
 }
 
 void GuiTerminalWindow::drawText(int x, int y, const wchar_t *text, int len, unsigned long attrs,
                                  int lineAttrs, truecolour tc) {
-  drawText(x, y, decode(term, text, len), attrs, lineAttrs, tc);
+  renderStats.drawTextCalls++;
+  QStringView str = decode(text, len);
+  queueText(x, y, str, attrs, lineAttrs, tc, canUseGlyphAtlas(str, len, attrs, lineAttrs, tc));
 }
 void GuiTerminalWindow::drawText(int x, int y, const QString &str, unsigned long attrs,
                                  int lineAttrs, truecolour tc) {
   if (0) qDebug() << __FUNCTION__ << x << y << str << Qt::hex << attrs;
-  assert(painter.isActive());
-  assert(!tc.fg.enabled && !tc.bg.enabled);
-
-  setPenBrushFromAttrs(attrs);
-  painter.fillRect(x * fontWidth, y * fontHeight, fontWidth * str.length(), fontHeight,
-                   painter.brush());
-  painter.drawText(x * fontWidth, y * fontHeight + fontAscent, str);
+  queueText(x, y, str, attrs, lineAttrs, tc, false);
 }
 
 void GuiTerminalWindow::drawCursor(int x, int y, const wchar_t *text, int len, unsigned long attrs,
                                    int lineAttrs, truecolour tc) {
   if (0) qDebug() << __FUNCTION__ << x << y << len << Qt::hex << attrs;
-  assert(painter.isActive());
+  assert(recording);
   assert(attrs & (TATTR_ACTCURS | TATTR_PASCURS));
 
-  setPenBrushFromAttrs(attrs);
-
+  QtRenderFrame::Overlay op = {x, y};
+  coloursFromAttrs(attrs, tc, op.fg, op.bg);
   int ctype = conf_get_int(cfg, CONF_cursor_type);
-  int char_width = fontWidth;
-  if (attrs & ATTR_WIDE) char_width *= 2;
-  x = x * fontWidth;
-  y = y * fontHeight;
-
-  if (ctype == CURSOR_BLOCK || term->big_cursor) {
-    if (attrs & TATTR_ACTCURS) {
-      painter.fillRect(x, y, char_width, fontHeight, painter.pen().color());
-    } else if (attrs & TATTR_PASCURS) {
-      painter.drawRect(x + 1, y + 1, char_width - 2, fontHeight - 2);
-    }
+  if (ctype == CURSOR_BLOCK || term->big_cursor)
+    op.kind = QtRenderFrame::CURSOR_BLOCK;
+  else if (ctype == CURSOR_UNDERLINE)
+    op.kind = QtRenderFrame::CURSOR_UNDERLINE;
+  else
+    op.kind = QtRenderFrame::CURSOR_VERTICAL;
+  op.active = attrs & TATTR_ACTCURS;
+  op.wide = attrs & ATTR_WIDE;
+  op.right = attrs & TATTR_RIGHTCURS;
+  frames.back().overlays.push_back(op);
+}
+
+void GuiTerminalWindow::drawTrustSigil(int x, int y) {
+  assert(recording);
+  frames.back().overlays.push_back({x, y, 0, 0, QtRenderFrame::TRUST_SIGIL});
+}
+
+/*
+ * Called by do_paint for characters the terminal considers narrow, to
+ * find out whether the font would draw them wider than one cell.
+ */
+int GuiTerminalWindow::charWidth(int uc) {
+  // characters from the 8-bit character sets, translated as in decode()
+  switch (uc & CSET_MASK) {
+    case CSET_ASCII:
+      uc &= 0xFF;
+      break;
+    case CSET_OEMCP:
+      uc = ucsdata.unitab_oemcp[uc & 0xFF];
+      break;
+    case CSET_LINEDRW:
+      uc = ucsdata.unitab_line[uc & 0xFF];
+      break;
+    case CSET_SCOACS:
+      uc = ucsdata.unitab_scoacs[uc & 0xFF];
+      break;
+    case CSET_ACP:
+      // decoded by the system codec, which is at worst one cell per byte
+      return 1;
+  }
+  return charWidths.width(char32_t(uc));
+}
+
+/*
+ * Move already painted rows of the frame buffer instead of having the
+ * terminal redraw them. The scroll starts a new frame, as it applies
+ * to what has been drawn so far.
+ */
+bool GuiTerminalWindow::scrollRegion(int topline, int botline, int lines) {
+  assert(recording);
+  if (!renderer.canScroll(devicePixelRatioF())) return false;
+
+  if (!frames.back().isEmpty()) frames.emplace_back();
+  QtRenderFrame &frame = frames.back();
+  frame.scrollTop = topline;
+  frame.scrollBottom = botline;
+  frame.scrollLines = lines;
+  return true;
+}
+
+void GuiTerminalWindow::freeContext() {
+  assert(recording);
+  recording = false;
+  if (frames.size() == 1 && frames.back().isEmpty()) {
+    frames.clear();
     return;
   }
 
-  assert(ctype != CURSOR_BLOCK);
-  int startx, starty, dx, dy, length, i;
-  if (ctype == CURSOR_UNDERLINE) {
-    startx = x;
-    starty = y + fontMetrics().descent();
-    dx = 1;
-    dy = 0;
-    length = char_width;
-  } else {
-    int xadjust = 0;
-    if (attrs & TATTR_RIGHTCURS) xadjust = char_width - 1;
-    startx = x + xadjust;
-    starty = y + 1;
-    dx = 0;
-    dy = 1;
-    length = fontHeight - 2;
+  if (renderInWorker) {
+    for (QtRenderFrame &frame : frames) queuedFrames.push_back(std::move(frame));
+    frames.clear();
+    if (!renderInFlight) submitRender();
+    return;
   }
-  if (attrs & TATTR_ACTCURS) {
-    // To draw the vertical and underline active cursors
-    painter.drawLine(startx, starty + length * dx, startx + length * dx, starty + length);
-  } else {
-    // To draw the vertical and underline passive cursors
-    QPen fg = painter.pen();
-    QPen bg = QPen(painter.brush().color(), 0);
-    for (i = 0; i < length; i++) {
-      painter.setPen((i % 2 == 0) ? fg : bg);
-      painter.drawPoint(startx, starty + length * dx);
-      startx += dx;
-      starty += dy;
+
+  QRegion dirty;
+  for (const QtRenderFrame &frame : frames) dirty += renderer.render(frameBuffer, frame);
+  frames.clear();
+  if (!dirty.isEmpty()) {
+    viewport()->update(dirty);
+    framePending = true;
+  }
+}
+
+/*
+ * With the render worker enabled, recorded frames are rasterised on
+ * the global thread pool into a back buffer, while paintEvent keeps
+ * showing the front buffer. At most one job per window is in flight;
+ * frames recorded meanwhile are queued for the next one. When a job
+ * finishes the buffers are swapped, which leaves the new back buffer
+ * behind by the area that job painted - the next job copies that area
+ * over from the front buffer before rendering on top of it.
+ */
+void GuiTerminalWindow::submitRender() {
+  assert(!renderInFlight && !queuedFrames.empty());
+  renderInFlight = true;
+  renderFinished = false;
+
+  std::vector<QtRenderFrame> jobFrames;
+  jobFrames.swap(queuedFrames);
+  QThreadPool::globalInstance()->start([this, jobFrames = std::move(jobFrames),
+                                        back = std::move(backBuffer), front = frameBuffer,
+                                        stale = std::exchange(staleRegion, {})]() mutable {
+    if (back.size() != front.size() || back.devicePixelRatio() != front.devicePixelRatio()) {
+      back = front.copy();
+    } else if (!stale.isEmpty()) {
+      qreal dpr = front.devicePixelRatio();
+      QPainter p(&back);
+      p.setCompositionMode(QPainter::CompositionMode_Source);
+      for (const QRect &r : stale)
+        p.drawImage(r, front, QRectF(r.x() * dpr, r.y() * dpr, r.width() * dpr, r.height() * dpr));
     }
+    // this becomes the GUI's back buffer once we're done; don't keep it shared
+    front = QImage();
+
+    QRegion dirty;
+    for (const QtRenderFrame &frame : jobFrames) dirty += renderer.render(back, frame);
+
+    QMutexLocker lock(&renderMutex);
+    renderResult = std::move(back);
+    renderDirty = dirty;
+    // posted before signalling, since a waiting destructor may delete us right after
+    QMetaObject::invokeMethod(this, &GuiTerminalWindow::collectRender, Qt::QueuedConnection);
+    renderFinished = true;
+    renderDone.wakeAll();
+  });
+}
+
+void GuiTerminalWindow::collectRender() {
+  if (!renderInFlight) return;  // already collected by waitForRender()
+  QImage image;
+  QRegion dirty;
+  {
+    QMutexLocker lock(&renderMutex);
+    if (!renderFinished) return;
+    image = std::move(renderResult);
+    dirty = std::move(renderDirty);
+  }
+  renderInFlight = false;
+
+  backBuffer = std::move(frameBuffer);
+  frameBuffer = std::move(image);
+  staleRegion = dirty;
+  if (!dirty.isEmpty()) {
+    viewport()->update(dirty);
+    framePending = true;
   }
+  if (!queuedFrames.empty()) submitRender();
 }
 
-void GuiTerminalWindow::drawTrustSigil(int x, int y) {
-  if (trustSigil.isNull()) {
-    QIcon ic = QIcon(u":/icons/qutty.ico"_s);
-    QSize s = QSize(2 * fontWidth, fontHeight);
-    trustSigil = ic.pixmap(s, devicePixelRatioF());
+// wait until all recorded frames are in the front buffer and the renderer is idle
+void GuiTerminalWindow::waitForRender() {
+  while (renderInFlight) {
+    {
+      QMutexLocker lock(&renderMutex);
+      while (!renderFinished) renderDone.wait(&renderMutex);
+    }
+    collectRender();
   }
-  assert(painter.isActive());
-  painter.drawPixmap(x * fontWidth, y * fontHeight, trustSigil);
 }
 
-int GuiTerminalWindow::charWidth(int uc) { return 1; }
+// called by QtFrameScheduler when the next frame is due
+void GuiTerminalWindow::updateFrame() {
+  if (resizePending) applyResize();
+  if (!term || !term->window_update_pending) return;
+  // noteOutput() asks again once the next progress frame is due
+  if (flooding && floodFrame.elapsed() < FLOOD_FRAME_MS) return;
+  if (flooding) floodFrame.start();
+  term_update(term);
+}
 
-void GuiTerminalWindow::freeContext() {
-  assert(painter.isActive());
-  painter.end();
-  viewport()->update();
+/*
+ * Flood mode. Output arriving faster than FLOOD_BYTES per
+ * FLOOD_SAMPLE_MS (a "cat hugefile", not an application redrawing its
+ * screen) is parsed as it comes, but only a progress frame every
+ * FLOOD_FRAME_MS is drawn, so that the time goes into keeping up with
+ * the connection rather than into frames nobody gets to read. Once
+ * output has stopped for FLOOD_IDLE_MS, the final screen is drawn and
+ * updates are paced by QtFrameScheduler again.
+ */
+void GuiTerminalWindow::noteOutput(size_t len) {
+  if (flooding) {
+    floodIdle.start();
+    if (term->window_update_pending && floodFrame.elapsed() >= FLOOD_FRAME_MS)
+      QtFrameScheduler::instance().requestUpdate(this);
+    return;
+  }
+
+  if (!floodSample.isValid() || floodSample.elapsed() >= FLOOD_SAMPLE_MS) {
+    floodSample.start();
+    floodBytes = 0;
+  }
+  floodBytes += len;
+  if (floodBytes >= FLOOD_BYTES) {
+    flooding = true;
+    floodFrame.start();
+    floodIdle.start();
+  }
+}
+
+void GuiTerminalWindow::endFlood() {
+  flooding = false;
+  floodSample.invalidate();
+  if (term && term->window_update_pending) QtFrameScheduler::instance().requestUpdate(this);
 }
 
 int GuiTerminalWindow::from_backend(SeatOutputType type, const char *data, size_t len) {
+  noteOutput(len);
   if (_tmuxMode == TMUX_MODE_GATEWAY && _tmuxGateway) {
     size_t rc = _tmuxGateway->fromBackend(type == SEAT_OUTPUT_STDERR, data, len);
     if (rc && rc < len && _tmuxMode == TMUX_MODE_GATEWAY_DETACH_INIT) {
@@ -557,6 +900,13 @@ void GuiTerminalWindow::setTermFont(Conf *cfg) {
   fontWidth = fontMetrics.horizontalAdvance(QChar('a'));
   fontHeight = fontMetrics.height();
   fontAscent = fontMetrics.ascent();
+
+  waitForRender();
+  renderer.setFont(_font, fontWidth, fontHeight, fontAscent, fontMetrics.descent());
+  charWidths.reset(_font, fontWidth, conf_get_bool(cfg, CONF_cjk_ambig_wide));
+  QIcon sigil = QIcon(u":/icons/qutty.ico"_s);
+  renderer.setTrustSigil(sigil.pixmap(QSize(2 * fontWidth, fontHeight), devicePixelRatioF())
+                             .toImage());
 }
 
 void GuiTerminalWindow::setPalette(unsigned start, unsigned ncolours, const rgb *colours) {
@@ -727,14 +1077,89 @@ void GuiTerminalWindow::getClip(wchar_t **p, int *len) {
 }
 
 void GuiTerminalWindow::requestPaste(int clipboard) {
-  auto text = QApplication::clipboard()->text().toStdWString();
-  term_do_paste(term, text.c_str(), text.size());
+  QString text = QApplication::clipboard()->text();
+  endPaste();
+  if (text.size() <= PASTE_STREAM_CHARS) {
+    auto wtext = text.toStdWString();
+    term_do_paste(term, wtext.c_str(), wtext.size());
+  } else {
+    // keeps only the clipboard's QString, and goes no faster than the backend
+    pasteText = text;
+    pastePos = 0;
+    pastePiece.resize(PASTE_PIECE_CHARS);
+    term_paste_stream_start(term);
+    if (!pasteProgress) {
+      pasteProgress = new QProgressDialog(tr("Pasting..."), tr("Cancel"), 0, 1000, this);
+      pasteProgress->setWindowModality(Qt::NonModal);
+      pasteProgress->setMinimumDuration(500);
+      pasteProgress->setAutoReset(false);
+      connect(pasteProgress, &QProgressDialog::canceled, this, [this] {
+        if (term) term_nopaste(term);
+        endPaste();
+      });
+    }
+    pasteProgress->reset();
+    pasteProgress->setValue(0);
+    pastePump.start();
+    pumpPaste();
+  }
 
-  // Save the paste in our persistent list.
-  qutty_web_plugin_map.hash_map["PASTE_HISTORY"].prepend(QApplication::clipboard()->text());
+  // Save the paste in our persistent list; a big one only by its beginning.
+  if (text.size() > PASTE_HISTORY_CHARS)
+    text = text.left(PASTE_HISTORY_CHARS) + tr("... [%1 characters]").arg(text.size());
+  qutty_web_plugin_map.hash_map["PASTE_HISTORY"].prepend(text);
   qutty_web_plugin_map.save();
 }
 
+/*
+ * Move a streamed paste along: pass the terminal pieces of it until
+ * the backend has PASTE_SENDBUFFER_MAX waiting to go out (for SSH,
+ * that includes what the channel window holds up) or we've spent
+ * PASTE_PUMP_MS on it. Runs off pastePump, and when the backend
+ * reports that its backlog went down.
+ */
+void GuiTerminalWindow::pumpPaste() {
+  // a key press or another paste stops a streamed paste in the terminal
+  if (!term || !term->paste_stream) {
+    endPaste();
+    return;
+  }
+
+  QElapsedTimer spent;
+  spent.start();
+  qsizetype size = pasteText.size();
+  while (pastePos < size && spent.elapsed() < PASTE_PUMP_MS) {
+    if (backend && backend_sendbuffer(backend) >= PASTE_SENDBUFFER_MAX) break;
+    qsizetype n = std::min(PASTE_PIECE_CHARS, size - pastePos);
+    // keep surrogate pairs together
+    if (pastePos + n < size && pasteText.at(pastePos + n - 1).isHighSurrogate()) n--;
+    qsizetype len = QStringView(pasteText).mid(pastePos, n).toWCharArray(pastePiece.data());
+    term_paste_stream_data(term, pastePiece.data(), len);
+    pastePos += n;
+  }
+
+  if (pastePos == size) {
+    term_paste_stream_end(term);
+    endPaste();
+    return;
+  }
+  pasteProgress->setValue(int(pastePos * 1000 / size));
+}
+
+void GuiTerminalWindow::endPaste() {
+  if (!pastePump.isActive()) return;
+  pastePump.stop();
+  pasteText.clear();
+  pastePiece = {};
+  pasteProgress->reset();
+}
+
+// the backend's send buffer went down, see qt_sent()
+void GuiTerminalWindow::pasteSent() {
+  if (pastePump.isActive())
+    QMetaObject::invokeMethod(this, &GuiTerminalWindow::pumpPaste, Qt::QueuedConnection);
+}
+
 void GuiTerminalWindow::writeClip(int /*clipboard*/, wchar_t *data, int * /*attr*/,
                                   truecolour * /*colours*/, int len, int /*must_deselect*/) {
   data[len] = 0;
@@ -742,6 +1167,51 @@ void GuiTerminalWindow::writeClip(int /*clipboard*/, wchar_t *data, int * /*attr
   QApplication::clipboard()->setText(s);
 }
 
+/*
+ * The terminal hands over selections too big to turn into text on the
+ * spot. The copy runs on QtClipboardCopy's thread, and a progress
+ * dialog, from which it can be cancelled, comes up if it takes a
+ * while. Until it is done the clipboard keeps what it had before.
+ * 'clipboard' is CLIP_NULL if the copy is just for the terminal's own
+ * clipboard, which the terminal fills from the termclip at the end.
+ */
+bool GuiTerminalWindow::writeClipStream(int clipboard, termclip *clip) {
+  if (!clipCopy) {
+    clipCopy = new QtClipboardCopy(this);
+    clipProgress = new QProgressDialog(tr("Copying selection..."), tr("Cancel"), 0, 0, this);
+    clipProgress->setWindowModality(Qt::NonModal);
+    clipProgress->setMinimumDuration(500);
+    clipProgress->setAutoReset(false);
+    connect(clipProgress, &QProgressDialog::canceled, clipCopy, &QtClipboardCopy::cancel);
+    connect(clipCopy, &QtClipboardCopy::progress, this, [this](int done, int total) {
+      clipProgress->setMaximum(total);
+      clipProgress->setValue(done);
+    });
+    connect(clipCopy, &QtClipboardCopy::finished, this,
+            [this](const QString &text, termclip *clip) {
+              clipProgress->reset();
+              if (clipTarget != CLIP_NULL) QApplication::clipboard()->setText(text);
+              int lost = termclip_lost(clip);
+              if (term)
+                term_clip_stream_done(term, clip);
+              else
+                termclip_free(clip);
+              if (lost)
+                QMessageBox::warning(this, tr(APPNAME " Copy"),
+                                     tr("%n line(s) of scrollback could not be read back from "
+                                        "disk, and are missing from the copied text.",
+                                        nullptr, lost));
+            });
+  }
+  clipTarget = clipboard;
+  clipCopy->start(clip);
+  // the dialog only shows once the copy has taken its minimum duration
+  clipProgress->reset();
+  clipProgress->setRange(0, 0);
+  clipProgress->setValue(0);
+  return true;
+}
+
 void GuiTerminalWindow::resizeEvent(QResizeEvent *) {
   if (viewport()->height() == 0 || viewport()->width() == 0) {
     // skip the spurious resizes during split-pane create/delete/drag-drop
@@ -751,6 +1221,7 @@ void GuiTerminalWindow::resizeEvent(QResizeEvent *) {
 
   if (viewport()->size() != frameBuffer.size()) {
     using std::swap;
+    waitForRender();
     QImage newFB = QImage(viewport()->size() * devicePixelRatioF(), QImage::Format_RGB32);
     newFB.fill(colours[OSC4_COLOUR_bg]);
     painter.begin(&newFB);
@@ -760,6 +1231,16 @@ void GuiTerminalWindow::resizeEvent(QResizeEvent *) {
     swap(newFB, frameBuffer);
   }
 
+  // a splitter drag or window resize sends a storm of these; the
+  // terminal only follows once per frame, see applyResize()
+  resizePending = true;
+  QtFrameScheduler::instance().requestUpdate(this);
+}
+
+void GuiTerminalWindow::applyResize() {
+  resizePending = false;
+  if (viewport()->height() == 0 || viewport()->width() == 0) return;
+
   int width = termWidth();
   int height = termHeight();
 
@@ -969,6 +1450,12 @@ static void qtwin_clip_write(TermWin *win, int clipboard, wchar_t *text, int *at
   gw->writeClip(clipboard, text, attrs, colours, len, must_deselect);
 }
 
+static bool qtwin_clip_write_stream(TermWin *win, int clipboard, termclip *clip,
+                                    bool /*must_deselect*/) {
+  GuiTerminalWindow *gw = static_cast<GuiTerminalWindow *>(win);
+  return gw->writeClipStream(clipboard, clip);
+}
+
 static void qtwin_clip_request_paste(TermWin *win, int clipboard) {
   GuiTerminalWindow *gw = static_cast<GuiTerminalWindow *>(win);
   gw->requestPaste(clipboard);
@@ -1020,6 +1507,16 @@ void qtwin_unthrottle(TermWin *win, size_t bufsize) {
   backend_unthrottle(gw->backend, bufsize);
 }
 
+static bool qtwin_scroll(TermWin *win, int topline, int botline, int lines) {
+  GuiTerminalWindow *gw = static_cast<GuiTerminalWindow *>(win);
+  return gw->scrollRegion(topline, botline, lines);
+}
+
+static void qtwin_schedule_update(TermWin *win) {
+  GuiTerminalWindow *gw = static_cast<GuiTerminalWindow *>(win);
+  QtFrameScheduler::instance().requestUpdate(gw);
+}
+
 const TermWinVtable qttermwin_vt = {
     qtwin_setup_draw_ctx,
     qtwin_draw_text,
@@ -1046,4 +1543,7 @@ const TermWinVtable qttermwin_vt = {
     qtwin_palette_set,
     qtwin_palette_get_overrides,
     qtwin_unthrottle,
+    qtwin_scroll,
+    qtwin_schedule_update,
+    qtwin_clip_write_stream,
 };
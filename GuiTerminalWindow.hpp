@@ -13,12 +13,18 @@
 #include <QFont>
 #include <QFontInfo>
 #include <QFontMetrics>
+#include <QMutex>
 #include <QPainter>
+#include <QTimer>
+#include <QWaitCondition>
 
 #include "GuiBase.hpp"
 #include "GuiDrag.hpp"
+#include "QtCharWidthTable.hpp"
+#include "QtClipboardCopy.hpp"
 #include "QtCommon.hpp"
 #include "QtConfig.hpp"
+#include "QtTerminalRenderer.hpp"
 #include "tmux/TmuxGateway.hpp"
 #include "tmux/TmuxWindowPane.hpp"
 #include "tmux/tmux.h"
@@ -28,6 +34,7 @@ extern "C" {
 }
 
 class GuiMainWindow;
+class QProgressDialog;
 
 class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public TermWin, public Seat {
   Q_OBJECT
@@ -43,20 +50,66 @@ class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public Ter
   QImage frameBuffer;
   QPainter painter;
 
-  QPixmap trustSigil;
+  QtTerminalRenderer renderer;
 
   QFont _font;
   int fontWidth, fontHeight, fontAscent;
+  QtCharWidthTable charWidths;
   struct unicode_data ucsdata = {};
   bool _any_update = false;
-  QRegion termrgn;
+  bool framePending = false;  // viewport update issued but not painted yet
   std::array<QColor, OSC4_NCOLOURS> colours;
 
+  // draw_text/draw_cursor calls recorded between setupContext and freeContext
+  bool recording = false;
+  std::vector<QtRenderFrame> frames;
+
+  void queueText(int x, int y, QStringView str, unsigned long attrs, int lineAttrs,
+                 truecolour tc, bool atlas);
+
+  // scratch buffers for decode(), reused across draw_text calls
+  QString decodeBuf;
+  QByteArray decodeBytes;
+
+  // optional render worker, see submitRender()
+  bool renderInWorker = false;
+  bool renderInFlight = false;
+  std::vector<QtRenderFrame> queuedFrames;
+  QImage backBuffer;
+  QRegion staleRegion;
+  QMutex renderMutex;
+  QWaitCondition renderDone;
+  bool renderFinished = false;  // guarded by renderMutex, as are the two below
+  QImage renderResult;
+  QRegion renderDirty;
+
+  void submitRender();
+  void collectRender();
+  void waitForRender();
+
+  // flood mode, see noteOutput()
+  static constexpr qint64 FLOOD_BYTES = 1 << 20;  // output per sample that starts a flood
+  static constexpr int FLOOD_SAMPLE_MS = 100;
+  static constexpr int FLOOD_FRAME_MS = 250;  // between progress frames
+  static constexpr int FLOOD_IDLE_MS = 50;    // how long output must stop to end a flood
+  bool flooding = false;
+  qint64 floodBytes = 0;
+  QElapsedTimer floodSample;
+  QElapsedTimer floodFrame;
+  QTimer floodIdle;
+
+  void noteOutput(size_t len);
+  void endFlood();
+
+  // term_size for the viewport's current size is due, see resizeEvent()
+  bool resizePending = false;
+  void applyResize();
+
   // to detect mouse double/triple clicks
   Mouse_Action mouseButtonAction;
   QElapsedTimer mouseClickTimer;
 
-  enum { BOLD_COLOURS, BOLD_SHADOW, BOLD_FONT } bold_mode;
+  enum { BOLD_COLOURS, BOLD_SHADOW, BOLD_FONT } bold_mode = BOLD_COLOURS;
 
   // members for drag-drop support
   QPoint dragStartPos;
@@ -65,6 +118,28 @@ class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public Ter
   wchar_t *clipboard_contents = nullptr;
   int clipboard_length = 0;
 
+  // streamed pastes, see requestPaste()
+  static constexpr qsizetype PASTE_STREAM_CHARS = 64 * 1024;  // smaller pastes go in at once
+  static constexpr qsizetype PASTE_PIECE_CHARS = 16 * 1024;
+  static constexpr size_t PASTE_SENDBUFFER_MAX = 256 * 1024;  // backlog that holds the paste up
+  static constexpr int PASTE_PUMP_MS = 10;                     // also the time spent per pump
+  static constexpr qsizetype PASTE_HISTORY_CHARS = 1024;       // kept of a paste in the history
+  QString pasteText;
+  qsizetype pastePos = 0;
+  std::vector<wchar_t> pastePiece;
+  QTimer pastePump;
+  QProgressDialog *pasteProgress = nullptr;
+
+  void pumpPaste();
+  void endPaste();
+
+  // large selections are copied in the background, see writeClipStream()
+  QtClipboardCopy *clipCopy = nullptr;
+  QProgressDialog *clipProgress = nullptr;
+  int clipTarget = CLIP_NULL;
+
+  void setupClipboards();
+
   // session title
   QString runtime_title;  // given by terminal/shell
   QString custom_title;   // given by user
@@ -76,6 +151,12 @@ class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public Ter
   int termWidth() const { return viewport()->width() / fontWidth; }
   int termHeight() const { return viewport()->height() / fontHeight; }
 
+  void attachScrollbackSpill();
+
+  // session logs are written from a thread of their own, see newLogContext()
+  std::vector<LogContext *> logContexts;
+  LogContext *newLogContext();
+
  public:
   Terminal *term = nullptr;
   Backend *backend = nullptr;
@@ -87,6 +168,12 @@ class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public Ter
   // order-of-usage
   uint32_t mru_count = 0;
 
+  // counters for the render benchmark
+  struct RenderStats {
+    quint64 frames = 0;
+    quint64 drawTextCalls = 0;
+  } renderStats;
+
   const PuttyConfig &config() const { return cfgOwner; }
   Conf *getCfg() const { return cfgOwner.get(); }
 
@@ -101,6 +188,7 @@ class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public Ter
    * 2. termWnd->initTerminal() -> init the internals with config
    */
   int initTerminal();
+  int initBenchTerminal(int cols, int rows);
   int restartTerminal();
   int reconfigureTerminal(const PuttyConfig &new_cfg);
 
@@ -110,7 +198,9 @@ class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public Ter
   void keyReleaseEvent(QKeyEvent *e) override;
   int from_backend(SeatOutputType type, const char *data, size_t len);
 
-  void setPenBrushFromAttrs(unsigned long attrs);
+  void coloursFromAttrs(unsigned long attrs, truecolour tc, QRgb &fg, QRgb &bg) const;
+  uint8_t glyphStyle(unsigned long attrs) const;
+  QStringView decode(const wchar_t *text, int len);
   bool setupContext();
   void drawText(int x, int y, const wchar_t *text, int len, unsigned long attrs, int lineAttrs,
                 truecolour tc);
@@ -120,15 +210,20 @@ class GuiTerminalWindow : public QAbstractScrollArea, public GuiBase, public Ter
                   truecolour tc);
   void drawTrustSigil(int x, int y);
   int charWidth(int uc);
+  bool scrollRegion(int topline, int botline, int lines);
   void freeContext();
+  bool isFramePending() const { return framePending || renderInFlight; }
+  void updateFrame();
 
   void setTermFont(Conf *cfg);
   void setPalette(unsigned start, unsigned ncolours, const rgb *colours);
   void requestPaste(int clipboard);
+  void pasteSent();
   void getClip(wchar_t **p, int *len);
 
   void writeClip(int clipboard, wchar_t *data, int *attr, truecolour *colours, int len,
                  int must_deselect);
+  bool writeClipStream(int clipboard, termclip *clip);
 
   void setScrollBar(int total, int start, int page);
   int TranslateKey(QKeyEvent *keyevent, char *output);
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtCharWidthTable.hpp"
+
+#include <QFontMetrics>
+#include <algorithm>
+
+extern "C" {
+#include "putty.h"
+}
+
+void QtCharWidthTable::reset(const QFont &font, int cellWidth, bool cjkAmbigWide) {
+  this->font = font;
+  this->cellWidth = std::max(cellWidth, 1);
+  this->cjkAmbigWide = cjkAmbigWide;
+
+  index.fill(0);
+  pages.assign(3, {});
+  pages[NARROW_PAGE].fill(1);
+  pages[WIDE_PAGE].fill(2);
+
+  // Latin and the line drawing characters are on nearly every screen
+  buildPage(0x00);
+  buildPage(0x25);
+}
+
+uint16_t QtCharWidthTable::buildPage(char32_t page) {
+  QFontMetrics metrics(font);
+  std::array<uint8_t, 256> widths;
+  for (char32_t i = 0; i < 256; i++) {
+    char32_t uc = (page << 8) | i;
+    int w = cjkAmbigWide ? mk_wcwidth_cjk(uc) : mk_wcwidth(uc);
+    if (w == 1 && !QChar::isSurrogate(uc)) {
+      // a glyph that is nearly two cells wide would overlap the next cell
+      int advance = metrics.horizontalAdvance(QString::fromUcs4(&uc, 1));
+      if (advance + cellWidth / 2 - 1 >= 2 * cellWidth) w = 2;
+    }
+    widths[i] = w == 2 ? 2 : 1;
+  }
+
+  uint16_t n;
+  if (widths == pages[NARROW_PAGE]) {
+    n = NARROW_PAGE;
+  } else if (widths == pages[WIDE_PAGE]) {
+    n = WIDE_PAGE;
+  } else {
+    n = uint16_t(pages.size());
+    pages.push_back(widths);
+  }
+  index[page] = n;
+  return n;
+}
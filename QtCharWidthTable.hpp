@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTCHARWIDTHTABLE_H
+#define QTCHARWIDTHTABLE_H
+
+#include <QFont>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Number of character cells the terminal font needs for each code
+ * point: 2 where wcwidth() says the character is wide, or where the
+ * font (or its fallback) draws a nominally narrow character at close
+ * to two cells, and 1 otherwise.
+ *
+ * Widths are kept in a two-level table of 256-entry pages. Pages that
+ * are all narrow or all wide share one copy, and a page is measured
+ * the first time one of its characters is asked for, so a lookup is an
+ * index load plus a page load.
+ */
+class QtCharWidthTable {
+ public:
+  void reset(const QFont &font, int cellWidth, bool cjkAmbigWide);
+
+  int width(char32_t uc) {
+    if (uc >= UNICODE_LIMIT) return 1;
+    uint16_t page = index[uc >> 8];
+    if (!page) page = buildPage(uc >> 8);
+    return pages[page][uc & 0xFF];
+  }
+
+ private:
+  static constexpr char32_t UNICODE_LIMIT = 0x110000;
+  // pages[0] is unused, so that 0 in the index means "not measured yet"
+  enum : uint16_t { NARROW_PAGE = 1, WIDE_PAGE = 2 };
+
+  QFont font;
+  int cellWidth = 1;
+  bool cjkAmbigWide = false;
+
+  std::array<uint16_t, (UNICODE_LIMIT >> 8)> index = {};
+  std::vector<std::array<uint8_t, 256>> pages;
+
+  uint16_t buildPage(char32_t page);
+};
+
+#endif  // QTCHARWIDTHTABLE_H
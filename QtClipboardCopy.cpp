@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtClipboardCopy.hpp"
+
+#include <QElapsedTimer>
+#include <atomic>
+#include <utility>
+
+struct QtClipboardCopy::Job {
+  unsigned generation;
+  termclip *clip;
+  std::atomic<bool> cancelled = false;
+
+  ~Job() {
+    if (clip) termclip_free(clip);
+  }
+};
+
+QtClipboardCopy::QtClipboardCopy(QObject *parent) : QObject(parent) {
+  // the steps of a copy have to run in order
+  pool.setMaxThreadCount(1);
+}
+
+QtClipboardCopy::~QtClipboardCopy() {
+  cancel();
+  pool.waitForDone();
+}
+
+void QtClipboardCopy::start(termclip *clip) {
+  cancel();
+  job = std::make_shared<Job>();
+  job->generation = ++generation;
+  job->clip = clip;
+  pool.start([this, job = job] { run(job); });
+}
+
+void QtClipboardCopy::cancel() {
+  if (!job) return;
+  job->cancelled = true;
+  job.reset();
+  generation++;
+}
+
+void QtClipboardCopy::run(const std::shared_ptr<Job> &job) {
+  static constexpr int PROGRESS_MS = 100;  // between progress() reports
+  unsigned gen = job->generation;
+  int steps = int(termclip_steps(job->clip));
+  QString text;
+  QElapsedTimer sinceReport;
+  sinceReport.start();
+
+  for (int i = 0; i < steps; i++) {
+    if (job->cancelled) return;
+    termclip_step(
+        job->clip, i,
+        [](void *ctx, const wchar_t *chunk, size_t len) {
+          static_cast<QString *>(ctx)->append(QString::fromWCharArray(chunk, qsizetype(len)));
+        },
+        &text);
+    if (sinceReport.elapsed() >= PROGRESS_MS) {
+      sinceReport.start();
+      QMetaObject::invokeMethod(
+          this,
+          [this, gen, done = i + 1, steps] {
+            if (gen == generation) emit progress(done, steps);
+          },
+          Qt::QueuedConnection);
+    }
+  }
+
+  QMetaObject::invokeMethod(
+      this,
+      [this, gen, text = std::move(text)] {
+        if (gen != generation) return;
+        termclip *clip = std::exchange(this->job->clip, nullptr);
+        this->job.reset();
+        emit finished(text, clip);
+      },
+      Qt::QueuedConnection);
+}
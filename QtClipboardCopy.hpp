@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTCLIPBOARDCOPY_H
+#define QTCLIPBOARDCOPY_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <memory>
+
+extern "C" {
+#include "putty.h"
+#include "terminal/terminal.h"
+}
+
+/*
+ * Turns a selection too big to copy on the GUI thread into clipboard
+ * text in the background.
+ *
+ * start() takes over a termclip from the terminal and runs its steps
+ * in order on the copier's own thread, appending each step's text to
+ * the result as UTF-16. progress() reports how many steps are done,
+ * and finished() hands over the text once all of it is there, along
+ * with the termclip, which the receiver passes on to
+ * term_clip_stream_done() or frees. A new start(), cancel() or the
+ * copier's destruction drops a copy in progress.
+ */
+class QtClipboardCopy : public QObject {
+  Q_OBJECT
+
+ public:
+  explicit QtClipboardCopy(QObject *parent = nullptr);
+  ~QtClipboardCopy() override;
+
+  void start(termclip *clip);
+  void cancel();
+  bool isRunning() const { return bool(job); }
+
+ signals:
+  void progress(int done, int total);
+  void finished(const QString &text, termclip *clip);
+
+ private:
+  struct Job;
+
+  QThreadPool pool;
+  std::shared_ptr<Job> job;
+  unsigned generation = 0;
+
+  void run(const std::shared_ptr<Job> &job);
+};
+
+#endif  // QTCLIPBOARDCOPY_H
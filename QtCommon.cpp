@@ -8,7 +8,9 @@
 #include "QtCommon.hpp"
 #define SECURITY_WIN32
 
+#include <QCoreApplication>
 #include <QKeyEvent>
+#include <QTimer>
 #include <cstdio>
 #include <cstring>
 
@@ -41,6 +43,25 @@ QtTimer *globalTimer = new QtTimer;
 
 void timer_change_notify(unsigned long next) { globalTimer->startTimerForTick(next); }
 
+static bool callbacks_posted = false;
+
+void callback_notify(void *frontend) {
+  // one posted event runs all callbacks queued until then
+  if (callbacks_posted) return;
+  callbacks_posted = true;
+  QTimer::singleShot(0, qApp, [] {
+    callbacks_posted = false;
+    while (run_toplevel_callbacks());
+  });
+}
+
+// Connection sharing is not implemented yet
+extern "C" const bool share_can_be_downstream;
+extern "C" const bool share_can_be_upstream;
+
+const bool share_can_be_downstream = false;
+const bool share_can_be_upstream = false;
+
 int GuiTerminalWindow::TranslateKey(QKeyEvent *keyevent, char *output) {
   Conf *conf = term->conf;
   char *p = output;
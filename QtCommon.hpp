@@ -30,6 +30,8 @@ class QTimer;
 extern QTimer *qtimer;
 extern long timing_next_time;
 
+void callback_notify(void *frontend);
+
 QAbstractSocket *sk_getqtsock(Socket *socket);
 
 void qstring_to_char(char *dst, const QString &src, int dstlen);
@@ -38,6 +38,10 @@ typedef struct qutty_mainwindow_settings_t__ {
   int flag;
   bool menubar_visible;
   bool titlebar_tabs;
+  bool render_worker;  // rasterise terminal frames off the GUI thread
+  int scrollback_memory_lines;  // scrollback beyond this goes to disk; 0 keeps it all in memory
+  int log_buffer_kb;  // session log output queued for the writer before log_overflow applies
+  int log_overflow;   // a QtLogWriter::Overflow
 } qutty_mainwindow_settings_t;
 
 class PuttyConfig {
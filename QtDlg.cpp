@@ -372,7 +372,10 @@ static bool qt_eof(Seat *seat) { return true; /* do respond to incoming EOF with
  * proactively notified that the amount of buffered data has
  * become smaller.
  */
-static void qt_sent(Seat *seat, size_t new_sendbuffer) {}
+static void qt_sent(Seat *seat, size_t new_sendbuffer) {
+  GuiTerminalWindow *f = static_cast<GuiTerminalWindow *>(seat);
+  f->pasteSent();
+}
 
 /*
  * Provide authentication-banner output from the session setup.
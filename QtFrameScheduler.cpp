@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtFrameScheduler.hpp"
+
+#include <QGuiApplication>
+#include <QScreen>
+#include <algorithm>
+
+#include "GuiTerminalWindow.hpp"
+
+QtFrameScheduler &QtFrameScheduler::instance() {
+  static QtFrameScheduler scheduler;
+  return scheduler;
+}
+
+/*
+ * Frame period in milliseconds, following the fastest screen that
+ * currently has a terminal waiting for an update.
+ */
+int QtFrameScheduler::framePeriod() const {
+  qreal rate = 0;
+  for (const Request &r : pending) {
+    if (!r.window) continue;
+    QScreen *screen = r.window->screen();
+    if (screen) rate = std::max(rate, screen->refreshRate());
+  }
+  if (rate <= 0) rate = 60;  // some platforms don't report it
+  return std::max(1, int(1000 / rate));
+}
+
+void QtFrameScheduler::requestUpdate(GuiTerminalWindow *window) {
+  for (const Request &r : pending)
+    if (r.window == window) return;
+  pending.push_back({window, 0});
+
+  if (timerId == -1) {
+    // after a quiet spell draw right away, so that keyboard echo isn't delayed
+    qint64 wait = 0;
+    if (lastFrame.isValid()) wait = std::max<qint64>(0, framePeriod() - lastFrame.elapsed());
+    timerId = startTimer(int(wait), Qt::PreciseTimer);
+  }
+}
+
+void QtFrameScheduler::timerEvent(QTimerEvent *event) {
+  assert(event->timerId() == timerId);
+  killTimer(timerId);
+  timerId = -1;
+  lastFrame.start();
+
+  std::vector<Request> due;
+  due.swap(pending);
+  for (Request &r : due) {
+    if (!r.window) continue;  // closed in the meantime
+    if (r.window->isFramePending() && r.skipped < MAX_SKIPPED_FRAMES) {
+      r.skipped++;
+      pending.push_back(r);
+      continue;
+    }
+    r.window->updateFrame();
+  }
+
+  // terminals that got new output while being drawn are already back in the queue
+  if (!pending.empty()) timerId = startTimer(framePeriod(), Qt::PreciseTimer);
+}
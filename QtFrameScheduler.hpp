@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTFRAMESCHEDULER_H
+#define QTFRAMESCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QTimerEvent>
+#include <vector>
+
+class GuiTerminalWindow;
+
+/*
+ * Paces terminal window updates to the display refresh rate.
+ *
+ * Terminals ask for an update whenever their contents change; all the
+ * requests made during one frame are served together by a single
+ * timer tick, so however much output arrives, each terminal is drawn
+ * at most once per frame. A terminal whose previous frame hasn't been
+ * presented yet sits the tick out, up to MAX_SKIPPED_FRAMES times, so
+ * that under flood output we don't draw frames nobody will see.
+ */
+class QtFrameScheduler : public QObject {
+  Q_OBJECT
+
+ public:
+  static QtFrameScheduler &instance();
+
+  void requestUpdate(GuiTerminalWindow *window);
+
+ protected:
+  void timerEvent(QTimerEvent *event) override;
+
+ private:
+  static constexpr int MAX_SKIPPED_FRAMES = 4;
+
+  struct Request {
+    QPointer<GuiTerminalWindow> window;
+    int skipped;
+  };
+  std::vector<Request> pending;
+  int timerId = -1;
+  QElapsedTimer lastFrame;
+
+  int framePeriod() const;
+};
+
+#endif  // QTFRAMESCHEDULER_H
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtGlyphAtlas.hpp"
+
+#include <QPainter>
+#include <algorithm>
+#include <cmath>
+
+void QtGlyphAtlas::reset(const QFont &font, int cellWidth, int cellHeight, int ascent,
+                         qreal dpr) {
+  this->font = font;
+  this->boldFont = font;
+  this->boldFont.setBold(true);
+  this->cellWidth = cellWidth;
+  this->cellHeight = cellHeight;
+  this->ascent = ascent;
+  this->pixelWidth = int(std::ceil(cellWidth * dpr));
+  this->pixelHeight = int(std::ceil(cellHeight * dpr));
+  this->_dpr = dpr;
+
+  // start small, the atlas grows on demand in allocSlot()
+  rows = 8;
+  cells = QImage(ATLAS_COLUMNS * pixelWidth, rows * pixelHeight, QImage::Format_RGB32);
+  used = 0;
+  slots.clear();
+}
+
+void QtGlyphAtlas::clear() {
+  used = 0;
+  slots.clear();
+}
+
+int QtGlyphAtlas::allocSlot() {
+  if (used == rows * ATLAS_COLUMNS) {
+    if (rows == ATLAS_MAX_ROWS) {
+      // atlas is full - start over rather than tracking usage per glyph
+      clear();
+    } else {
+      rows = std::min(rows * 2, ATLAS_MAX_ROWS);
+      cells = cells.copy(0, 0, ATLAS_COLUMNS * pixelWidth, rows * pixelHeight);
+    }
+  }
+  return used++;
+}
+
+QRect QtGlyphAtlas::glyph(char16_t ch, uint8_t style, QRgb fg, QRgb bg) {
+  Key key = {ch, style, fg, bg};
+  auto it = slots.constFind(key);
+  if (it != slots.constEnd()) return slotRect(*it);
+
+  int slot = allocSlot();
+  QRect r = slotRect(slot);
+  slots.insert(key, slot);
+
+  QPainter p(&cells);
+  p.fillRect(r, QColor(bg));
+  p.setClipRect(r);
+  p.translate(r.topLeft());
+  p.scale(_dpr, _dpr);
+  p.setFont((style & STYLE_BOLD) ? boldFont : font);
+  p.setPen(QPen(QColor(fg), 0));
+  p.drawText(0, ascent, QString(QChar(ch)));
+  if (style & STYLE_UNDERLINE) p.drawLine(0, ascent + 1, cellWidth - 1, ascent + 1);
+  return r;
+}
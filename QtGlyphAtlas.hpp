@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTGLYPHATLAS_H
+#define QTGLYPHATLAS_H
+
+#include <QFont>
+#include <QHash>
+#include <QImage>
+#include <QRect>
+
+/*
+ * Cache of pre-rasterised terminal cells.
+ *
+ * Every glyph is rendered once, together with its background, into a
+ * fixed-size cell of a single atlas image. Drawing a run of text then
+ * becomes a sequence of image blits instead of a full text shaping
+ * pass. An atlas is only valid for the font and device pixel ratio it
+ * was created with; the owner must call reset() when either changes.
+ */
+class QtGlyphAtlas {
+ public:
+  enum Style : uint8_t {
+    STYLE_BOLD = 0x01,
+    STYLE_UNDERLINE = 0x02,
+  };
+
+  void reset(const QFont &font, int cellWidth, int cellHeight, int ascent, qreal dpr);
+  void clear();
+
+  bool isValidFor(qreal dpr) const { return !cells.isNull() && dpr == _dpr; }
+  const QImage &image() const { return cells; }
+
+  // source rectangle (in atlas pixels) of the glyph, rendered on demand
+  QRect glyph(char16_t ch, uint8_t style, QRgb fg, QRgb bg);
+
+ private:
+  struct Key {
+    char16_t ch;
+    uint8_t style;
+    QRgb fg, bg;
+
+    bool operator==(const Key &o) const {
+      return ch == o.ch && style == o.style && fg == o.fg && bg == o.bg;
+    }
+  };
+  friend size_t qHash(const Key &k, size_t seed) {
+    return qHashMulti(seed, k.ch, k.style, k.fg, k.bg);
+  }
+
+  // atlas geometry, in cells
+  static constexpr int ATLAS_COLUMNS = 64;
+  static constexpr int ATLAS_MAX_ROWS = 64;
+
+  QFont font, boldFont;
+  int cellWidth = 0, cellHeight = 0, ascent = 0;
+  int pixelWidth = 0, pixelHeight = 0;
+  qreal _dpr = 1.0;
+
+  QImage cells;
+  int rows = 0;
+  int used = 0;
+  QHash<Key, int> slots;
+
+  QRect slotRect(int slot) const {
+    return {(slot % ATLAS_COLUMNS) * pixelWidth, (slot / ATLAS_COLUMNS) * pixelHeight, pixelWidth,
+            pixelHeight};
+  }
+  int allocSlot();
+};
+
+#endif  // QTGLYPHATLAS_H
@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtLogWriter.hpp"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+
+extern "C" {
+#include "putty.h"
+// min/max interferes with std::min/max
+#undef min
+#undef max
+}
+
+using namespace Qt::Literals::StringLiterals;
+
+class QtLogWriter::Writer : public logwriter {
+ public:
+  Writer(size_t highWater, Overflow overflow);
+  ~Writer();
+
+ private:
+  const Overflow overflow;
+  const size_t highWater;
+  const size_t mask;
+  std::unique_ptr<char[]> ring;
+  std::atomic<uint64_t> head{0};  // advanced by the GUI thread
+  std::atomic<uint64_t> tail{0};  // advanced by the writer thread
+
+  struct NextFile {
+    uint64_t at;  // output queued before the switch
+    FILE *fp;
+    bool compress;
+  };
+
+  uint64_t queued = 0;    // taken into the ring or the spill, by the GUI thread
+  uint64_t dropping = 0;  // bytes lost since the last marker
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<unsigned> maxLatency{0};
+  std::atomic<unsigned> flushWanted{0};
+  std::atomic<bool> failed{false};
+  std::atomic<bool> sleeping{false};
+  std::atomic<bool> blocked{false};
+  std::atomic<bool> spilling{false};
+
+  // guarded by mutex
+  QMutex mutex;
+  QWaitCondition wake;     // writer waits for work
+  QWaitCondition drained;  // GUI thread waits for room, or for close()
+  std::deque<NextFile> nextFiles;
+  std::string spill;
+  uint64_t spillAfter = 0;  // ring position the spilled data follows
+  bool closing = false;
+  bool stopping = false;
+
+  // writer thread only
+  FILE *fp = nullptr;
+  gzip_compressor *gz = nullptr;
+  strbuf *zbuf = nullptr;
+  uint64_t written = 0;  // counterpart of queued
+  std::deque<NextFile> switches;
+
+  std::unique_ptr<QThread> thread;
+
+  size_t room() const;
+  void push(const char *data, size_t len);
+  void wakeWriter(bool always);
+  bool queue(const char *data, size_t len);
+  void run();
+  void drain(uint64_t upto);
+  void emit(const char *data, size_t len);
+  void writeOut(const char *data, size_t len);
+  void writeCompressed();
+  void finishFile();
+
+  static void open(logwriter *lw, FILE *fp, bool compress);
+  static bool write(logwriter *lw, const void *data, size_t len);
+  static void flush(logwriter *lw);
+  static void close(logwriter *lw);
+  static void stats(logwriter *lw, uint64_t *dropped, unsigned *max_latency_ms);
+  static void free(logwriter *lw);
+  static const logwriter_vtable vtable;
+};
+
+// how long queued output may wait for the writer when nobody asks for it
+static const unsigned long LOGWRITER_IDLE_MS = 100;
+
+const logwriter_vtable QtLogWriter::Writer::vtable = {
+    Writer::open, Writer::write, Writer::flush, Writer::close, Writer::stats, Writer::free,
+};
+
+static size_t ringSize(size_t atLeast) {
+  size_t size = 4096;
+  while (size < atLeast) size <<= 1;
+  return size;
+}
+
+QtLogWriter::Writer::Writer(size_t highWater, Overflow overflow)
+    : overflow(overflow),
+      highWater(std::max<size_t>(highWater, 4096)),
+      mask(ringSize(highWater) - 1) {
+  vt = &vtable;
+}
+
+QtLogWriter::Writer::~Writer() {
+  if (!thread) return;
+  close(this);
+  {
+    QMutexLocker lock(&mutex);
+    stopping = true;
+    wake.wakeOne();
+  }
+  thread->wait();
+}
+
+QtLogWriter::Overflow QtLogWriter::overflowFromName(const QString &name) {
+  if (name == "block"_L1) return Block;
+  if (name == "drop"_L1) return Drop;
+  return Spill;
+}
+
+QString QtLogWriter::overflowName(Overflow overflow) {
+  switch (overflow) {
+    case Block:
+      return u"block"_s;
+    case Drop:
+      return u"drop"_s;
+    default:
+      return u"spill"_s;
+  }
+}
+
+logwriter *QtLogWriter::create(size_t highWater, Overflow overflow) {
+  return new Writer(highWater, overflow);
+}
+
+size_t QtLogWriter::Writer::room() const {
+  return highWater - size_t(head.load(std::memory_order_relaxed) - tail.load());
+}
+
+void QtLogWriter::Writer::push(const char *data, size_t len) {
+  uint64_t h = head.load(std::memory_order_relaxed);
+  size_t at = h & mask, first = std::min(len, mask + 1 - at);
+  memcpy(&ring[at], data, first);
+  memcpy(&ring[0], data + first, len - first);
+  head.store(h + len);
+  queued += len;
+}
+
+void QtLogWriter::Writer::wakeWriter(bool always) {
+  // the writer checks the same before going to sleep, see run()
+  if (!sleeping.load()) return;
+  if (!always && highWater - room() < highWater / 4) return;
+  QMutexLocker lock(&mutex);
+  wake.wakeOne();
+}
+
+/*
+ * Queues data from the GUI thread, applying the overflow policy.
+ * Returns false once the writer has failed.
+ */
+bool QtLogWriter::Writer::queue(const char *data, size_t len) {
+  if (failed.load(std::memory_order_relaxed)) return false;
+
+  switch (overflow) {
+    case Block:
+      while (len) {
+        if (failed.load()) return false;
+        size_t n = std::min(len, room());
+        if (!n) {
+          QMutexLocker lock(&mutex);
+          blocked.store(true);
+          wake.wakeOne();
+          while (!room() && !failed.load()) drained.wait(&mutex);
+          blocked.store(false);
+          continue;
+        }
+        push(data, n);
+        data += n;
+        len -= n;
+      }
+      break;
+
+    case Drop:
+      if (dropping) {
+        char marker[64];
+        int n = snprintf(marker, sizeof(marker),
+                         "\r\n[%" PRIu64 " bytes of session log dropped]\r\n", dropping);
+        if (room() < size_t(n) + len) {
+          dropping += len;
+          dropped.fetch_add(len, std::memory_order_relaxed);
+          wakeWriter(true);
+          return true;
+        }
+        push(marker, n);
+        dropping = 0;
+      } else if (room() < len) {
+        dropping = len;
+        dropped.fetch_add(len, std::memory_order_relaxed);
+        wakeWriter(true);
+        return true;
+      }
+      push(data, len);
+      break;
+
+    case Spill:
+      if (spilling.load() || room() < len) {
+        QMutexLocker lock(&mutex);
+        // the writer may have emptied the spill since
+        if (spill.empty()) {
+          if (room() >= len) {
+            push(data, len);
+            break;
+          }
+          spillAfter = head.load(std::memory_order_relaxed);
+          spilling.store(true);
+        }
+        spill.append(data, len);
+        queued += len;
+        wake.wakeOne();
+        return true;
+      }
+      push(data, len);
+      break;
+  }
+  wakeWriter(false);
+  return true;
+}
+
+static void noteLatency(std::atomic<unsigned> &max, const QElapsedTimer &timer) {
+  unsigned ms = timer.elapsed();
+  if (ms > max.load(std::memory_order_relaxed)) max.store(ms, std::memory_order_relaxed);
+}
+
+void QtLogWriter::Writer::writeOut(const char *data, size_t len) {
+  if (!fp || failed.load(std::memory_order_relaxed)) return;  // discarded
+  if (gz) {
+    gzip_compress(gz, data, len, zbuf);
+    writeCompressed();
+    return;
+  }
+  QElapsedTimer timer;
+  timer.start();
+  if (fwrite(data, 1, len, fp) < len) failed.store(true);
+  noteLatency(maxLatency, timer);
+}
+
+void QtLogWriter::Writer::writeCompressed() {
+  QElapsedTimer timer;
+  timer.start();
+  if (fwrite(zbuf->u, 1, zbuf->len, fp) < zbuf->len) failed.store(true);
+  noteLatency(maxLatency, timer);
+  strbuf_clear(zbuf);
+}
+
+void QtLogWriter::Writer::finishFile() {
+  if (!fp) return;
+  if (gz) {
+    gzip_compress_finish(gz, zbuf);
+    if (!failed.load(std::memory_order_relaxed)) writeCompressed();
+    strbuf_clear(zbuf);
+    gzip_compress_free(gz);
+    gz = nullptr;
+  }
+  fclose(fp);
+  fp = nullptr;
+}
+
+/*
+ * Writes out the next len bytes of output, switching files on the
+ * way where the GUI thread asked for it.
+ */
+void QtLogWriter::Writer::emit(const char *data, size_t len) {
+  for (;;) {
+    while (!switches.empty() && switches.front().at == written) {
+      finishFile();
+      fp = switches.front().fp;
+      if (switches.front().compress) gz = gzip_compress_new();
+      switches.pop_front();
+    }
+    if (!len) break;
+    size_t n = len;
+    if (!switches.empty()) n = std::min<uint64_t>(n, switches.front().at - written);
+    writeOut(data, n);
+    data += n;
+    len -= n;
+    written += n;
+  }
+}
+
+/*
+ * Writes out the ring up to position upto, making room for the GUI
+ * thread as it goes.
+ */
+void QtLogWriter::Writer::drain(uint64_t upto) {
+  uint64_t t = tail.load(std::memory_order_relaxed);
+  while (t < upto) {
+    size_t at = t & mask, n = std::min<uint64_t>(upto - t, mask + 1 - at);
+    emit(&ring[at], n);
+    t += n;
+    tail.store(t);
+    if (blocked.load()) {
+      QMutexLocker lock(&mutex);
+      drained.wakeAll();
+    }
+  }
+}
+
+void QtLogWriter::Writer::run() {
+  unsigned flushed = 0;
+  zbuf = strbuf_new_nm();
+  QMutexLocker lock(&mutex);
+  for (;;) {
+    std::string spilled;
+    uint64_t upto = head.load();
+    if (!spill.empty()) {
+      // older output in the ring goes first
+      spilled.swap(spill);
+      upto = spillAfter;
+      spilling.store(false);
+    }
+    // switches to files handed over before any of this output
+    uint64_t end = written + (upto - tail.load(std::memory_order_relaxed)) + spilled.size();
+    while (!nextFiles.empty() && nextFiles.front().at <= end) {
+      switches.push_back(nextFiles.front());
+      nextFiles.pop_front();
+    }
+    unsigned flushing = flushWanted.load();
+
+    if (end == written && switches.empty() && flushing == flushed) {
+      if (closing) {
+        lock.unlock();
+        finishFile();
+        lock.relock();
+        closing = false;
+        drained.wakeAll();
+        continue;
+      }
+      if (stopping) break;
+      sleeping.store(true);
+      // anything queued since that wakeWriter() would not wake us for
+      if (head.load() - tail.load(std::memory_order_relaxed) < highWater / 4 &&
+          flushWanted.load() == flushed && nextFiles.empty())
+        wake.wait(&mutex, LOGWRITER_IDLE_MS);
+      sleeping.store(false);
+      continue;
+    }
+
+    lock.unlock();
+    drain(upto);
+    emit(spilled.data(), spilled.size());
+    emit(nullptr, 0);  // any switch right at the end
+    if (flushing != flushed && fp && !failed.load(std::memory_order_relaxed)) {
+      if (gz) {
+        gzip_compress_flush(gz, zbuf);
+        writeCompressed();
+      }
+      QElapsedTimer timer;
+      timer.start();
+      if (fflush(fp)) failed.store(true);
+      noteLatency(maxLatency, timer);
+    }
+    flushed = flushing;
+    if (failed.load(std::memory_order_relaxed) && blocked.load()) {
+      // nothing more will be written, so don't leave anyone waiting
+      QMutexLocker wakeLock(&mutex);
+      drained.wakeAll();
+    }
+    lock.relock();
+  }
+  strbuf_free(zbuf);
+}
+
+void QtLogWriter::Writer::open(logwriter *lw, FILE *fp, bool compress) {
+  auto *w = static_cast<Writer *>(lw);
+  {
+    QMutexLocker lock(&w->mutex);
+    w->nextFiles.push_back({w->queued, fp, compress});
+    w->wake.wakeOne();
+  }
+  // nothing is set up until there is something to log
+  if (!w->thread) {
+    w->ring.reset(new char[w->mask + 1]);
+    w->thread.reset(QThread::create([w] { w->run(); }));
+    w->thread->start();
+  }
+}
+
+bool QtLogWriter::Writer::write(logwriter *lw, const void *data, size_t len) {
+  return static_cast<Writer *>(lw)->queue(static_cast<const char *>(data), len);
+}
+
+void QtLogWriter::Writer::flush(logwriter *lw) {
+  auto *w = static_cast<Writer *>(lw);
+  w->flushWanted.fetch_add(1);
+  w->wakeWriter(true);
+}
+
+void QtLogWriter::Writer::close(logwriter *lw) {
+  auto *w = static_cast<Writer *>(lw);
+  QMutexLocker lock(&w->mutex);
+  w->closing = true;
+  w->wake.wakeOne();
+  while (w->closing) w->drained.wait(&w->mutex);
+  // ready for the next open()
+  w->dropping = 0;
+  w->failed.store(false);
+}
+
+void QtLogWriter::Writer::stats(logwriter *lw, uint64_t *dropped,
+                                unsigned *max_latency_ms) {
+  auto *w = static_cast<Writer *>(lw);
+  *dropped = w->dropped.exchange(0);
+  *max_latency_ms = w->maxLatency.exchange(0);
+}
+
+void QtLogWriter::Writer::free(logwriter *lw) { delete static_cast<Writer *>(lw); }
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTLOGWRITER_H
+#define QTLOGWRITER_H
+
+#include <QString>
+#include <cstddef>
+
+struct logwriter;
+
+/*
+ * Writes a session log on its own thread, so that a slow file system
+ * holds up neither the terminal nor the keyboard.
+ *
+ * The ring and the thread are only set up once a log file is opened.
+ * Data is queued in the ring, lock-free, by the GUI thread as its only
+ * producer, for the writer thread as its only consumer. The writer is
+ * woken once the ring is a quarter full or a flush is asked for, and
+ * otherwise picks up what is there every 100 ms. When the ring holds
+ * highWater bytes, further output is handled by the overflow policy:
+ *  - Block waits on the GUI thread for the writer to catch up, which
+ *    is what writing the log directly would have done;
+ *  - Drop discards it, and writes a marker saying how much was lost
+ *    once there is room again;
+ *  - Spill queues it on the heap, without bound, until the writer has
+ *    emptied the ring.
+ *
+ * Files handed over while one is open take effect at the point in the
+ * output they were handed over at; the writer finishes the previous
+ * file, compressing and closing it on its own thread.
+ */
+class QtLogWriter {
+ public:
+  enum Overflow { Block, Drop, Spill };
+
+  // a writer for log_set_writer(), which takes ownership of it
+  static logwriter *create(size_t highWater, Overflow overflow);
+
+  static Overflow overflowFromName(const QString &name);
+  static QString overflowName(Overflow overflow);
+
+ private:
+  class Writer;
+};
+
+#endif  // QTLOGWRITER_H
@@ -24,6 +24,8 @@ extern const struct SocketVtable QtSocket_sockvt;
 static void sk_tcp_close(Socket *);
 static SockAddr *sk_addr_new();
 
+constexpr size_t READ_BUFFER_SIZE = 20480;
+
 struct SockAddr {
   struct Deleter {
     void operator()(SockAddr *addr) { sk_addr_free(addr); }
@@ -33,6 +35,10 @@ struct SockAddr {
   QByteArray error;
 };
 
+struct SharedBufferDeleter {
+  void operator()(SharedBuffer *sb) { sharedbuf_unref(sb); }
+};
+
 struct QtSocket : Socket {
   struct Deleter {
     void operator()(QtSocket *sock) { sk_close(sock); }
@@ -42,6 +48,8 @@ struct QtSocket : Socket {
   QByteArray error;
   QByteArray outputData;
   std::unique_ptr<SockAddr, SockAddr::Deleter> addr;
+  // what incoming data is read into; replaced whenever the plug holds on to it
+  std::unique_ptr<SharedBuffer, SharedBufferDeleter> readBuf;
   Plug *plug = nullptr;
 
   int port = -1;
@@ -85,11 +93,18 @@ static void on_readyRead(QtSocket *s) {
     s->frozen_readable = true;
     return;
   }
-  char buf[20480];
   do {
-    auto len = s->qtsock.read(buf, sizeof(buf));
+    if (!s->readBuf || sharedbuf_is_shared(s->readBuf.get()))
+      s->readBuf.reset(sharedbuf_new(READ_BUFFER_SIZE));
+    // our own reference, in case the plug closes the socket while receiving
+    SharedBuffer *sb = sharedbuf_ref(s->readBuf.get());
+    char *buf = static_cast<char *>(sharedbuf_data(sb));
+    auto len = s->qtsock.read(buf, READ_BUFFER_SIZE);
     noise_ultralight(NOISE_SOURCE_IOLEN, len);
+    sharedbuf_enter(sb);
     plug_receive(s->plug, 0, buf, len);
+    sharedbuf_leave(sb);
+    sharedbuf_unref(sb);
   } while (s->qtsock.bytesAvailable());
 }
 
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTPENCACHE_H
+#define QTPENCACHE_H
+
+#include <QBrush>
+#include <QPen>
+#include <array>
+
+/*
+ * Small least-recently-used cache of solid cosmetic pens and brushes,
+ * keyed on colour. With 24-bit colour almost every run of text can
+ * have its own colour, and constructing a fresh QPen/QBrush for each
+ * one means a heap allocation per run.
+ */
+class QtPenCache {
+ public:
+  const QPen &pen(QRgb rgb) { return entry(rgb).pen; }
+  const QBrush &brush(QRgb rgb) { return entry(rgb).brush; }
+
+  void clear() {
+    for (Entry &e : entries) e.lastUsed = 0;
+    clock = 0;
+  }
+
+ private:
+  static constexpr int CACHE_SIZE = 64;
+
+  struct Entry {
+    QRgb rgb = 0;
+    unsigned lastUsed = 0;  // 0: unused
+    QPen pen;
+    QBrush brush;
+  };
+  std::array<Entry, CACHE_SIZE> entries;
+  unsigned clock = 0;
+
+  Entry &entry(QRgb rgb) {
+    if (++clock == 0) {  // wrapped around
+      clear();
+      clock = 1;
+    }
+    Entry *victim = &entries[0];
+    for (Entry &e : entries) {
+      if (e.lastUsed && e.rgb == rgb) {
+        e.lastUsed = clock;
+        return e;
+      }
+      if (e.lastUsed < victim->lastUsed) victim = &e;
+    }
+    victim->rgb = rgb;
+    victim->lastUsed = clock;
+    victim->pen = QPen(QColor(rgb), 0);
+    victim->brush = QBrush(QColor(rgb));
+    return *victim;
+  }
+};
+
+#endif  // QTPENCACHE_H
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+/*
+ * Headless rendering benchmark, run as "qutty_render_bench [scenario...]".
+ *
+ * Canned output is fed straight into term_data() of a terminal window
+ * that has no backend, and the cost of parsing and of each terminal
+ * update is reported per scenario. Each scenario runs twice, to compare
+ * the end-to-end throughput of copying the output into the terminal
+ * with that of the terminal adopting it from a shared buffer, as it
+ * does with data from the network. The "decode" scenario times the
+ * conversion of draw_text runs to UTF-16 on its own, per character set.
+ * Without an explicit platform the offscreen QPA is used, so neither a
+ * network nor a display is needed.
+ */
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+
+#include "GuiTerminalWindow.hpp"
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+
+// amount of output generated per scenario, and how much of it arrives per frame
+constexpr qsizetype STREAM_BYTES = 4 << 20;
+constexpr qsizetype CHUNK_BYTES = 4096;
+
+constexpr int BENCH_COLS = 120;
+constexpr int BENCH_ROWS = 40;
+
+// draw_text run length and number of runs decoded per character set
+constexpr int DECODE_RUN = 200;
+constexpr int DECODE_RUNS = 200000;
+
+// where decoded characters go, so that decoding isn't optimised away
+volatile quint64 decodeSink;
+
+// deterministic, so that runs are comparable
+struct Lcg {
+  uint32_t state = 12345;
+  uint32_t next(uint32_t n) {
+    state = state * 1103515245 + 12345;
+    return (state >> 16) % n;
+  }
+};
+
+QByteArray asciiFlood() {
+  QByteArray out;
+  Lcg rnd;
+  int line = 0;
+  while (out.size() < STREAM_BYTES) {
+    out += QByteArray::number(line++).rightJustified(8, ' ');
+    out += ": ";
+    int len = 20 + rnd.next(BENCH_COLS - 30);
+    for (int i = 0; i < len; i++) out += char(' ' + rnd.next(95));
+    out += "\r\n";
+  }
+  return out;
+}
+
+QByteArray sgrColours() {
+  QByteArray out;
+  Lcg rnd;
+  while (out.size() < STREAM_BYTES) {
+    for (int word = 0; word < 12; word++) {
+      out += "\033[";
+      if (rnd.next(4) == 0) out += "1;";
+      out += "38;5;" + QByteArray::number(rnd.next(256));
+      if (rnd.next(3) == 0) out += ";48;5;" + QByteArray::number(rnd.next(256));
+      out += 'm';
+      int len = 2 + rnd.next(8);
+      for (int i = 0; i < len; i++) out += char('a' + rnd.next(26));
+      out += "\033[0m ";
+    }
+    out += "\r\n";
+  }
+  return out;
+}
+
+QByteArray wideText() {
+  QByteArray out;
+  Lcg rnd;
+  while (out.size() < STREAM_BYTES) {
+    for (int i = 0; i < BENCH_COLS / 2 - 1; i++)
+      out += QString(QChar(char16_t(0x4E00 + rnd.next(0x5000)))).toUtf8();
+    out += "\r\n";
+  }
+  return out;
+}
+
+QByteArray boxDrawing() {
+  static const char16_t box[] = u"─│┌┐└┘├┤┬┴┼═║╔╗╚╝";
+  QByteArray out;
+  Lcg rnd;
+  while (out.size() < STREAM_BYTES) {
+    // alternate between UTF-8 box characters and the DEC line drawing set
+    if (rnd.next(2)) {
+      for (int i = 0; i < BENCH_COLS - 1; i++)
+        out += QString(QChar(box[rnd.next(std::size(box) - 1)])).toUtf8();
+    } else {
+      out += "\033(0";
+      for (int i = 0; i < BENCH_COLS - 1; i++) out += "jklmnqtuvwx"[rnd.next(11)];
+      out += "\033(B";
+    }
+    out += "\r\n";
+  }
+  return out;
+}
+
+QByteArray altScreenRedraws() {
+  QByteArray out = "\033[?1049h";
+  Lcg rnd;
+  int frame = 0;
+  while (out.size() < STREAM_BYTES) {
+    // a status-bar style TUI: header, a table with a moving highlight, footer
+    out += "\033[H\033[7m top - frame " + QByteArray::number(frame) + "\033[K\033[0m";
+    for (int row = 2; row < BENCH_ROWS; row++) {
+      out += "\033[" + QByteArray::number(row) + ";1H";
+      if (row == 2 + frame % (BENCH_ROWS - 3)) out += "\033[44;1m";
+      out += QByteArray::number(1000 + row) + "  ";
+      out += QByteArray::number(rnd.next(100)) + "." + QByteArray::number(rnd.next(10)) + "%  ";
+      for (int i = 0; i < 40; i++) out += char('a' + rnd.next(26));
+      out += "\033[K\033[0m";
+    }
+    out += "\033[" + QByteArray::number(BENCH_ROWS) + ";1H\033[7m F1 Help  F10 Quit\033[K\033[0m";
+    frame++;
+  }
+  out += "\033[?1049l";
+  return out;
+}
+
+QByteArray truecolourGradient() {
+  QByteArray out;
+  int frame = 0;
+  while (out.size() < STREAM_BYTES) {
+    out += "\033[H";
+    for (int row = 0; row < BENCH_ROWS; row++) {
+      for (int col = 0; col < BENCH_COLS; col++) {
+        int r = (col * 255 / BENCH_COLS + frame) & 0xFF;
+        int g = (row * 255 / BENCH_ROWS) & 0xFF;
+        int b = (r + g + frame * 3) & 0xFF;
+        out += "\033[48;2;" + QByteArray::number(r) + ';' + QByteArray::number(g) + ';' +
+               QByteArray::number(b) + "m ";
+      }
+      out += "\033[0m";
+      if (row < BENCH_ROWS - 1) out += "\r\n";
+    }
+    frame++;
+  }
+  return out;
+}
+
+struct Scenario {
+  const char *name;
+  std::function<QByteArray()> generate;
+};
+
+const Scenario scenarios[] = {
+    {"ascii", asciiFlood},
+    {"sgr", sgrColours},
+    {"cjk", wideText},
+    {"box", boxDrawing},
+    {"altscreen", altScreenRedraws},
+    {"truecolour", truecolourGradient},
+};
+
+struct Timings {
+  qint64 parseNs = 0;
+  qint64 updateNs = 0;
+  quint64 updates = 0;
+};
+
+/*
+ * Feed a stream to the terminal a chunk at a time. Each chunk is first
+ * read into a shared buffer, as QtNet does with socket data, and then
+ * either copied into the terminal's input by term_data() or, with
+ * 'adopt', handed over by reference.
+ */
+Timings feed(GuiTerminalWindow &window, const QByteArray &stream, bool adopt) {
+  Timings t;
+  QElapsedTimer timer;
+  for (qsizetype pos = 0; pos < stream.size(); pos += CHUNK_BYTES) {
+    qsizetype len = std::min(CHUNK_BYTES, stream.size() - pos);
+    SharedBuffer *sb = sharedbuf_new(len);
+    memcpy(sharedbuf_data(sb), stream.constData() + pos, len);
+    timer.start();
+    if (adopt) sharedbuf_enter(sb);
+    term_data(window.term, sharedbuf_data(sb), len);
+    if (adopt) sharedbuf_leave(sb);
+    t.parseNs += timer.nsecsElapsed();
+    sharedbuf_unref(sb);
+
+    // one frame per chunk, as if output arrived faster than the display refreshes
+    if (window.term->window_update_pending) {
+      timer.start();
+      term_update(window.term);
+      t.updateNs += timer.nsecsElapsed();
+      t.updates++;
+    }
+    QCoreApplication::processEvents();
+  }
+  return t;
+}
+
+/*
+ * Time GuiTerminalWindow::decode() on line-width runs in each of the
+ * character sets draw_text is given.
+ */
+void decodeBench(QTextStream &out, const PuttyConfig &cfg) {
+  GuiTerminalWindow window(nullptr, nullptr, cfg.copyWithNewName(u"render-bench"));
+  window.initBenchTerminal(BENCH_COLS, BENCH_ROWS);
+
+  struct Run {
+    const char *name;
+    wchar_t text[DECODE_RUN];
+  } runs[] = {{"ascii"}, {"unicode"}, {"linedrw"}, {"acp"}};
+  Lcg rnd;
+  for (int i = 0; i < DECODE_RUN; i++) {
+    runs[0].text[i] = wchar_t(CSET_ASCII | (' ' + rnd.next(95)));
+    runs[1].text[i] = wchar_t(0x4E00 + rnd.next(0x5000));
+    runs[2].text[i] = wchar_t(CSET_LINEDRW | "jklmnqtuvwx"[rnd.next(11)]);
+    runs[3].text[i] = wchar_t(CSET_ACP | (' ' + rnd.next(95)));
+  }
+
+  out << u"%1 %2 %3\n"_s.arg(u"decode"_s, -12).arg(u"ns/run"_s, 12).arg(u"Mchar/s"_s, 10);
+  for (const Run &run : runs) {
+    // once to grow the scratch buffers, as the first line drawn would
+    quint64 sum = window.decode(run.text, DECODE_RUN).size();
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < DECODE_RUNS; i++)
+      sum += window.decode(run.text, DECODE_RUN)[i % 8].unicode();
+    qint64 ns = timer.nsecsElapsed();
+    decodeSink = sum;
+    out << u"%1 %2 %3\n"_s.arg(QLatin1String(run.name), -12)
+               .arg(double(ns) / DECODE_RUNS, 12, 'f', 1)
+               .arg(double(DECODE_RUNS) * DECODE_RUN / ns * 1e3, 10, 'f', 1);
+  }
+  out.flush();
+}
+
+int runRenderBench(const QStringList &args) {
+  QTextStream out(stdout);
+
+  PuttyConfig cfg = PuttyConfig::make(u"render-bench");
+  load_open_settings(nullptr, cfg.get());
+  conf_set_str(cfg.get(), CONF_line_codepage, "UTF-8");
+  conf_set_int(cfg.get(), CONF_width, BENCH_COLS);
+  conf_set_int(cfg.get(), CONF_height, BENCH_ROWS);
+
+  int ran = 0;
+  if (args.isEmpty() || args.contains("decode"_L1)) {
+    decodeBench(out, cfg);
+    ran++;
+  }
+
+  bool header = false;
+  for (const Scenario &sc : scenarios) {
+    if (!args.isEmpty() && !args.contains(QLatin1String(sc.name))) continue;
+    if (!header) {
+      if (ran) out << '\n';
+      out << u"%1 %2 %3 %4 %5 %6 %7 %8\n"_s.arg(u"scenario"_s, -12)
+                 .arg(u"MB/s parsed"_s, 12)
+                 .arg(u"frames"_s, 8)
+                 .arg(u"frames/s"_s, 10)
+                 .arg(u"us/update"_s, 10)
+                 .arg(u"draw_text/frame"_s, 16)
+                 .arg(u"MB/s copy"_s, 10)
+                 .arg(u"MB/s adopt"_s, 10);
+      header = true;
+    }
+    ran++;
+
+    QByteArray stream = sc.generate();
+    Timings timings[2];
+    GuiTerminalWindow::RenderStats stats;
+    for (bool adopt : {false, true}) {
+      GuiTerminalWindow window(nullptr, nullptr, cfg.copyWithNewName(u"render-bench"));
+      // no focus events (they would go to the main window) and no scroll bar changing the width
+      window.setFocusPolicy(Qt::NoFocus);
+      window.setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+      window.initBenchTerminal(BENCH_COLS, BENCH_ROWS);
+      window.show();
+      QCoreApplication::processEvents();
+
+      window.renderStats = {};
+      timings[adopt] = feed(window, stream, adopt);
+      if (!adopt) stats = window.renderStats;
+    }
+
+    const Timings &t = timings[0];
+    double totalSecs = (t.parseNs + t.updateNs) / 1e9;
+    auto throughput = [&](const Timings &timing) {
+      return stream.size() / ((timing.parseNs + timing.updateNs) / 1e9) / (1 << 20);
+    };
+    out << u"%1 %2 %3 %4 %5 %6 %7 %8\n"_s.arg(QLatin1String(sc.name), -12)
+               .arg(stream.size() / (t.parseNs / 1e9) / (1 << 20), 12, 'f', 1)
+               .arg(t.updates, 8)
+               .arg(t.updates / totalSecs, 10, 'f', 1)
+               .arg(t.updates ? t.updateNs / 1e3 / t.updates : 0.0, 10, 'f', 1)
+               .arg(stats.frames ? double(stats.drawTextCalls) / stats.frames : 0.0, 16, 'f', 1)
+               .arg(throughput(timings[0]), 10, 'f', 1)
+               .arg(throughput(timings[1]), 10, 'f', 1);
+    out.flush();
+  }
+
+  if (!ran) {
+    out << "unknown scenario; available: decode";
+    for (const Scenario &sc : scenarios) out << ' ' << sc.name;
+    out << '\n';
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+  request_callback_notifications(callback_notify, nullptr);
+  int rc = runRenderBench(app.arguments().mid(1));
+  request_callback_notifications(nullptr, nullptr);
+  return rc;
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtScrollbackScan.hpp"
+
+#include <QCoreApplication>
+#include <atomic>
+
+QtSearchPattern::QtSearchPattern(const QString &text, bool regex) : text(text), regex(regex) {
+  if (regex) re = QRegularExpression(text, QRegularExpression::CaseInsensitiveOption);
+}
+
+qsizetype QtSearchPattern::indexIn(const QString &str, qsizetype from, qsizetype *len) const {
+  if (!regex) {
+    *len = text.length();
+    return str.indexOf(text, from, Qt::CaseInsensitive);
+  }
+  for (auto it = re.globalMatch(str, from); it.hasNext();) {
+    QRegularExpressionMatch m = it.next();
+    if (!m.capturedLength()) continue;
+    *len = m.capturedLength();
+    return m.capturedStart();
+  }
+  return -1;
+}
+
+qsizetype QtSearchPattern::lastIndexIn(const QString &str, qsizetype from, qsizetype *len) const {
+  if (!regex) {
+    *len = text.length();
+    return str.lastIndexOf(text, from, Qt::CaseInsensitive);
+  }
+  qsizetype found = -1;
+  for (auto it = re.globalMatch(str); it.hasNext();) {
+    QRegularExpressionMatch m = it.next();
+    if (m.capturedStart() > from) break;
+    if (!m.capturedLength()) continue;
+    found = m.capturedStart();
+    *len = m.capturedLength();
+  }
+  return found;
+}
+
+void QtSearchPattern::matchAll(const QString &str, int row, QList<Match> &out) const {
+  if (text.isEmpty()) return;
+  if (!regex) {
+    for (qsizetype pos = 0; (pos = str.indexOf(text, pos, Qt::CaseInsensitive)) >= 0;
+         pos += text.length())
+      out.append({row, int(pos), int(text.length())});
+    return;
+  }
+  for (auto it = re.globalMatch(str); it.hasNext();) {
+    QRegularExpressionMatch m = it.next();
+    if (m.capturedLength()) out.append({row, int(m.capturedStart()), int(m.capturedLength())});
+  }
+}
+
+/*
+ * Search text is case-folded Latin-1, at least a trigram long, and
+ * matched against each block's filter. A regular expression could
+ * match anything, so it gets no key.
+ */
+QByteArray QtSearchPattern::indexKey() const {
+  if (regex) return {};
+  QString folded = text.toCaseFolded();
+  if (folded.length() < 3) return {};
+  for (QChar c : folded)
+    if (c.unicode() > 0xFF) return {};
+  return folded.toLatin1();
+}
+
+struct QtScrollbackScan::Job {
+  unsigned generation;
+  QtSearchPattern pattern;
+  sbsnapshot *snapshot = nullptr;
+  struct unicode_data ucsdata;
+  std::atomic<bool> cancelled = false;
+  std::atomic<size_t> remaining;
+
+  // the last task may drop the job, but the snapshot shares blocks with the store
+  ~Job() {
+    if (snapshot) QMetaObject::invokeMethod(qApp, [ss = snapshot] { sbsnapshot_free(ss); });
+  }
+};
+
+QtScrollbackScan::QtScrollbackScan(QObject *parent) : QObject(parent) {}
+
+QtScrollbackScan::~QtScrollbackScan() {
+  cancel();
+  pool.waitForDone();
+}
+
+void QtScrollbackScan::start(Terminal *term, const QtSearchPattern &pattern) {
+  cancel();
+  if (pattern.isEmpty() || !pattern.isValid()) return;
+
+  job = std::make_shared<Job>();
+  job->generation = ++generation;
+  job->pattern = pattern;
+  QByteArray key = pattern.indexKey();
+  job->snapshot = sbstore_snapshot(term->scrollback, key.constData(), key.size());
+  job->ucsdata = *term->ucsdata;
+  size_t blocks = sbsnapshot_blocks(job->snapshot);
+  job->remaining = blocks + 1;
+
+  QList<Match> matches;
+  int sblen = sbstore_count(term->scrollback);
+  strbuf *buf = strbuf_new();
+  for (int row = sblen; row < sblen + term->rows; row++) {
+    strbuf_clear(buf);
+    term_search_text(term, row, buf);
+    pattern.matchAll(QString::fromLatin1(buf->s, buf->len), row, matches);
+  }
+  strbuf_free(buf);
+  deliver(job, std::move(matches));
+
+  for (size_t i = 0; i < blocks; i++)
+    pool.start([this, job = job, i] { scanBlock(job, i); });
+}
+
+void QtScrollbackScan::cancel() {
+  if (!job) return;
+  job->cancelled = true;
+  job.reset();
+  generation++;
+}
+
+void QtScrollbackScan::scanBlock(const std::shared_ptr<Job> &job, size_t block) {
+  QList<Match> matches;
+  if (!job->cancelled) {
+    struct Context {
+      Job *job;
+      // a pattern of its own, so that no regex state is shared between threads
+      QtSearchPattern pattern;
+      QList<Match> *matches;
+      strbuf *buf;
+    } ctx = {job.get(), QtSearchPattern(job->pattern.pattern(), job->pattern.isRegex()), &matches,
+             strbuf_new()};
+
+    // a block whose segment file has gone has no matches to show
+    sbsnapshot_lines(
+        job->snapshot, block,
+        [](void *vctx, int index, compressed_scrollback_line *cline) {
+          Context *ctx = static_cast<Context *>(vctx);
+          strbuf_clear(ctx->buf);
+          sbline_search_text(&ctx->job->ucsdata, cline, ctx->buf);
+          ctx->pattern.matchAll(QString::fromLatin1(ctx->buf->s, ctx->buf->len), index,
+                                *ctx->matches);
+        },
+        &ctx);
+    strbuf_free(ctx.buf);
+  }
+  deliver(job, std::move(matches));
+}
+
+/*
+ * Post a block's matches to the GUI thread, followed by finished()
+ * after the last one. Called from any thread.
+ */
+void QtScrollbackScan::deliver(const std::shared_ptr<Job> &job, QList<Match> matches) {
+  unsigned gen = job->generation;
+  if (!matches.isEmpty())
+    QMetaObject::invokeMethod(
+        this,
+        [this, gen, matches = std::move(matches)] {
+          if (gen == generation) emit matchesFound(matches);
+        },
+        Qt::QueuedConnection);
+  if (--job->remaining == 0)
+    QMetaObject::invokeMethod(
+        this,
+        [this, gen] {
+          if (gen != generation) return;
+          this->job.reset();
+          emit finished();
+        },
+        Qt::QueuedConnection);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTSCROLLBACKSCAN_H
+#define QTSCROLLBACKSCAN_H
+
+#include <QList>
+#include <QObject>
+#include <QRegularExpression>
+#include <QThreadPool>
+#include <memory>
+
+extern "C" {
+#include "putty.h"
+#include "terminal/terminal.h"
+}
+
+/*
+ * What the find bar looks for: plain text, compared case-insensitively,
+ * or a case-insensitive regular expression.
+ */
+class QtSearchPattern {
+ public:
+  struct Match {
+    int row;
+    int col;
+    int len;
+  };
+
+  QtSearchPattern() = default;
+  QtSearchPattern(const QString &text, bool regex);
+
+  bool isEmpty() const { return text.isEmpty(); }
+  bool isValid() const { return !regex || re.isValid(); }
+  bool isRegex() const { return regex; }
+  const QString &pattern() const { return text; }
+
+  // first match starting at or after 'from', or -1
+  qsizetype indexIn(const QString &str, qsizetype from, qsizetype *len) const;
+  // last match starting at or before 'from', or -1
+  qsizetype lastIndexIn(const QString &str, qsizetype from, qsizetype *len) const;
+  // all non-overlapping matches in 'str', appended to 'out' as being on 'row'
+  void matchAll(const QString &str, int row, QList<Match> &out) const;
+
+  // the text for sbstore_find(), or empty if the scrollback index can't help
+  QByteArray indexKey() const;
+
+ private:
+  QString text;
+  bool regex = false;
+  QRegularExpression re;
+};
+
+/*
+ * Searches all of a terminal's scrollback in the background.
+ *
+ * start() snapshots the scrollback blocks that may hold a match, which
+ * copies none of them but the newest, and each block is then read
+ * back from disk if need be, decompressed and searched as a separate
+ * task on the scanner's own thread pool. Matches are handed back a block at a
+ * time, in no particular order, through matchesFound(); rows on the
+ * screen, which keep changing, are searched by start() itself. A new
+ * start(), cancel() or the scanner's destruction drops whatever an
+ * earlier scan had yet to report.
+ */
+class QtScrollbackScan : public QObject {
+  Q_OBJECT
+
+ public:
+  using Match = QtSearchPattern::Match;
+
+  explicit QtScrollbackScan(QObject *parent = nullptr);
+  ~QtScrollbackScan() override;
+
+  void start(Terminal *term, const QtSearchPattern &pattern);
+  void cancel();
+  bool isRunning() const { return bool(job); }
+
+ signals:
+  void matchesFound(const QList<QtScrollbackScan::Match> &matches);
+  void finished();
+
+ private:
+  struct Job;
+
+  QThreadPool pool;
+  std::shared_ptr<Job> job;
+  unsigned generation = 0;
+
+  void scanBlock(const std::shared_ptr<Job> &job, size_t block);
+  void deliver(const std::shared_ptr<Job> &job, QList<Match> matches);
+};
+
+#endif  // QTSCROLLBACKSCAN_H
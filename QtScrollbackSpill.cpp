@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtScrollbackSpill.hpp"
+
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QRegularExpression>
+#include <atomic>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <signal.h>
+#endif
+
+using namespace Qt::Literals::StringLiterals;
+
+// scrollback may hold anything shown on screen, passwords included
+static const QFile::Permissions PRIVATE_DIR =
+    QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner;
+static const QFile::Permissions PRIVATE_FILE = QFile::ReadOwner | QFile::WriteOwner;
+
+static QString scrollbackRoot() { return QDir::home().filePath(u"qutty/scrollback"_s); }
+
+static bool processRunning(qint64 pid) {
+#ifdef _WIN32
+  HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, DWORD(pid));
+  if (!process) return GetLastError() == ERROR_ACCESS_DENIED;
+  DWORD code = 0;
+  bool running = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+  CloseHandle(process);
+  return running;
+#else
+  return kill(pid_t(pid), 0) == 0 || errno == EPERM;
+#endif
+}
+
+/*
+ * Delete the segment files of processes that are no longer running,
+ * which they would have deleted themselves unless they crashed.
+ */
+static void removeStaleSegments(const QDir &root) {
+  static const QRegularExpression segmentName(u"^(\\d+)-\\d+-\\d+\\.seg$"_s);
+  qint64 self = QCoreApplication::applicationPid();
+  QDirIterator sessions(root.absolutePath(), QDir::Dirs | QDir::NoDotAndDotDot);
+  while (sessions.hasNext()) {
+    QDir session(sessions.next());
+    const QStringList files = session.entryList({u"*.seg"_s}, QDir::Files);
+    for (const QString &file : files) {
+      QRegularExpressionMatch m = segmentName.match(file);
+      if (!m.hasMatch()) continue;
+      qint64 pid = m.captured(1).toLongLong();
+      if (pid != self && !processRunning(pid)) session.remove(file);
+    }
+    root.rmdir(session.dirName());
+  }
+}
+
+// creates path with owner-only access, or restricts it if it is there already
+static bool makePrivateDir(const QString &path) {
+  QDir dir(path);
+  if (dir.exists()) return QFile::setPermissions(path, PRIVATE_DIR);
+  return dir.mkdir(path, PRIVATE_DIR);
+}
+
+const sbspill_vtable QtScrollbackSpill::vtable = {
+    QtScrollbackSpill::write,  QtScrollbackSpill::map,    QtScrollbackSpill::unmap,
+    QtScrollbackSpill::read,   QtScrollbackSpill::remove, QtScrollbackSpill::free,
+};
+
+QtScrollbackSpill::QtScrollbackSpill(const QString &session) {
+  static std::atomic<unsigned> serial;
+  vt = &vtable;
+
+  QString name = session;
+  name.replace(QRegularExpression(u"[^A-Za-z0-9._-]"_s), u"_"_s);
+  if (name.isEmpty() || name.startsWith(u'.')) name.prepend(u"session"_s);
+  QDir root(scrollbackRoot());
+  dir = QDir(root.filePath(name));
+  prefix = u"%1-%2-"_s.arg(QCoreApplication::applicationPid()).arg(serial++);
+
+  static std::atomic<bool> cleaned;
+  if (!cleaned.exchange(true) && root.exists()) removeStaleSegments(root);
+}
+
+QtScrollbackSpill::~QtScrollbackSpill() {
+  while (!segments.empty()) remove(this, segments.begin()->first);
+  // only goes if no other window is still spilling into it
+  dir.rmdir(dir.absolutePath());
+}
+
+QFile *QtScrollbackSpill::segment(unsigned n, bool create) {
+  auto it = segments.find(n);
+  if (it != segments.end()) return it->second.get();
+  if (!create) return nullptr;
+
+  if (!dir.exists()) {
+    QDir::home().mkpath(u"qutty"_s);
+    if (!makePrivateDir(scrollbackRoot()) || !makePrivateDir(dir.absolutePath())) return nullptr;
+  }
+  auto file = std::make_unique<QFile>(dir.filePath(u"%1%2.seg"_s.arg(prefix).arg(n)));
+  // the permissions only apply to a new file, so set them for one that was left behind too
+  if (!file->open(QIODevice::ReadWrite | QIODevice::Truncate, PRIVATE_FILE) ||
+      !file->setPermissions(PRIVATE_FILE))
+    return nullptr;
+  return segments.emplace(n, std::move(file)).first->second.get();
+}
+
+int64_t QtScrollbackSpill::write(sbspill *sp, unsigned n, const void *data, size_t len) {
+  auto self = static_cast<QtScrollbackSpill *>(sp);
+  QMutexLocker locker(&self->lock);
+  QFile *file = self->segment(n, true);
+  if (!file) return -1;
+  int64_t offset = file->size();
+  // flushed right away, as it is mapped straight from the file
+  if (!file->seek(offset) || file->write(static_cast<const char *>(data), len) != qint64(len) ||
+      !file->flush())
+    return -1;
+  return offset;
+}
+
+const void *QtScrollbackSpill::map(sbspill *sp, unsigned n, uint64_t offset, size_t len) {
+  auto self = static_cast<QtScrollbackSpill *>(sp);
+  QMutexLocker locker(&self->lock);
+  QFile *file = self->segment(n, false);
+  if (!file) return nullptr;
+  return file->map(offset, len);
+}
+
+void QtScrollbackSpill::unmap(sbspill *sp, unsigned n, const void *data) {
+  auto self = static_cast<QtScrollbackSpill *>(sp);
+  QMutexLocker locker(&self->lock);
+  QFile *file = self->segment(n, false);
+  if (file) file->unmap(const_cast<uchar *>(static_cast<const uchar *>(data)));
+}
+
+bool QtScrollbackSpill::read(sbspill *sp, unsigned n, uint64_t offset, void *buf, size_t len) {
+  auto self = static_cast<QtScrollbackSpill *>(sp);
+  QMutexLocker locker(&self->lock);
+  QFile *file = self->segment(n, false);
+  if (!file) return false;
+  const uchar *data = file->map(offset, len);
+  if (!data) return false;
+  memcpy(buf, data, len);
+  file->unmap(const_cast<uchar *>(data));
+  return true;
+}
+
+void QtScrollbackSpill::remove(sbspill *sp, unsigned n) {
+  auto self = static_cast<QtScrollbackSpill *>(sp);
+  QMutexLocker locker(&self->lock);
+  auto it = self->segments.find(n);
+  if (it == self->segments.end()) return;
+  it->second->remove();
+  self->segments.erase(it);
+}
+
+void QtScrollbackSpill::free(sbspill *sp) { delete static_cast<QtScrollbackSpill *>(sp); }
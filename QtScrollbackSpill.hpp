@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTSCROLLBACKSPILL_H
+#define QTSCROLLBACKSPILL_H
+
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <map>
+#include <memory>
+
+extern "C" {
+#include "putty.h"
+#include "terminal/terminal.h"
+}
+
+/*
+ * Segment files that a terminal's scrollback store spills its oldest
+ * blocks into, under ~/qutty/scrollback/<session>. Files are named
+ * after the process and the store, so that several windows of one
+ * session can spill side by side, and are deleted once the store
+ * drops them or is freed. Only the user can read them. Files that a
+ * crashed process left behind are deleted when the first store of a
+ * later process is created. read() comes from scan threads as well,
+ * so the segments are only used with 'lock' held.
+ */
+class QtScrollbackSpill : public sbspill {
+ public:
+  explicit QtScrollbackSpill(const QString &session);
+  ~QtScrollbackSpill();
+
+ private:
+  QDir dir;
+  QString prefix;
+  QMutex lock;
+  std::map<unsigned, std::unique_ptr<QFile>> segments;
+
+  QFile *segment(unsigned n, bool create);
+
+  static int64_t write(sbspill *sp, unsigned segment, const void *data, size_t len);
+  static const void *map(sbspill *sp, unsigned segment, uint64_t offset, size_t len);
+  static void unmap(sbspill *sp, unsigned segment, const void *data);
+  static bool read(sbspill *sp, unsigned segment, uint64_t offset, void *buf, size_t len);
+  static void remove(sbspill *sp, unsigned segment);
+  static void free(sbspill *sp);
+  static const sbspill_vtable vtable;
+};
+
+#endif  // QTSCROLLBACKSPILL_H
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#include "QtTerminalRenderer.hpp"
+
+#include <QFontMetrics>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void QtTerminalRenderer::setFont(const QFont &font, int cellWidth, int cellHeight, int ascent,
+                                 int descent) {
+  this->font = font;
+  this->boldFont = font;
+  this->boldFont.setBold(true);
+  this->cellWidth = cellWidth;
+  this->cellHeight = cellHeight;
+  this->ascent = ascent;
+  this->descent = descent;
+  // rebuilt for the right pixel ratio on the next render()
+  glyphAtlas = QtGlyphAtlas();
+}
+
+/*
+ * Rows are moved as whole scanlines, so this only works when a text
+ * row covers a whole number of device pixels.
+ */
+bool QtTerminalRenderer::canScroll(qreal dpr) const {
+  qreal rowPixels = cellHeight * dpr;
+  return rowPixels == std::floor(rowPixels);
+}
+
+void QtTerminalRenderer::scroll(QImage &target, int topline, int botline, int lines) {
+  qreal rowPixels = cellHeight * target.devicePixelRatio();
+  int top = int(topline * rowPixels);
+  int bottom = std::min(int((botline + 1) * rowPixels), target.height());
+  int shift = int(std::abs(lines) * rowPixels);
+  if (bottom - top <= shift) return;
+
+  qsizetype stride = target.bytesPerLine();
+  uchar *bits = target.bits();
+  if (lines > 0)
+    memmove(bits + top * stride, bits + (top + shift) * stride, (bottom - top - shift) * stride);
+  else
+    memmove(bits + (top + shift) * stride, bits + top * stride, (bottom - top - shift) * stride);
+}
+
+void QtTerminalRenderer::drawGlyphs(QPainter &painter, const QtRenderFrame::TextRun &run,
+                                    QStringView str) {
+  for (int i = 0; i < str.length(); i++) {
+    QRect src = glyphAtlas.glyph(str[i].unicode(), run.style, run.fg, run.bg);
+    painter.drawImage(QRectF((run.x + i) * cellWidth, run.y * cellHeight, cellWidth, cellHeight),
+                      glyphAtlas.image(), src);
+  }
+}
+
+/*
+ * Draw one character per cell, horizontally scaled down where the
+ * glyph is wider than the cell.
+ */
+void QtTerminalRenderer::drawNarrow(QPainter &painter, const QtRenderFrame::TextRun &run,
+                                    QStringView str) {
+  QFontMetrics metrics(painter.font());
+  int x = run.x * cellWidth;
+  for (qsizetype i = 0; i < str.length(); x += cellWidth) {
+    qsizetype n = (str[i].isHighSurrogate() && i + 1 < str.length()) ? 2 : 1;
+    QString ch = str.mid(i, n).toString();
+    i += n;
+    int advance = metrics.horizontalAdvance(ch);
+    painter.save();
+    painter.translate(x, run.y * cellHeight + ascent);
+    if (advance > cellWidth) painter.scale(qreal(cellWidth) / advance, 1);
+    painter.drawText(0, 0, ch);
+    painter.restore();
+  }
+}
+
+/*
+ * Runs arrive from do_paint in row order, and each row is painted in
+ * two passes: one pass of background fills, merging neighbouring runs
+ * that share a background colour, then one pass of text which only
+ * touches the pen and font when they actually change. Atlas glyphs
+ * carry their own background and skip the fill pass. Cursors and trust
+ * sigils are drawn last, on top of the text they belong to.
+ */
+QRegion QtTerminalRenderer::render(QImage &target, const QtRenderFrame &frame) {
+  QRegion dirty;
+  qreal dpr = target.devicePixelRatio();
+
+  if (frame.scrollLines) {
+    scroll(target, frame.scrollTop, frame.scrollBottom, frame.scrollLines);
+    dirty += QRect(0, frame.scrollTop * cellHeight, int(target.width() / dpr),
+                   (frame.scrollBottom - frame.scrollTop + 1) * cellHeight);
+  }
+  if (frame.runs.empty() && frame.overlays.empty()) return dirty;
+
+  // the atlas is per device pixel ratio, which changes when moving between screens
+  if (!glyphAtlas.isValidFor(dpr)) glyphAtlas.reset(font, cellWidth, cellHeight, ascent, dpr);
+
+  QPainter painter(&target);
+  painter.setFont(font);
+  bool havePen = false;
+  QRgb penRgb = 0;
+  bool boldFontSet = false;
+
+  const std::vector<QtRenderFrame::TextRun> &runs = frame.runs;
+  for (size_t first = 0, last; first < runs.size(); first = last) {
+    int y = runs[first].y;
+    last = first + 1;
+    while (last < runs.size() && runs[last].y == y) last++;
+
+    int dirtyStart = runs[first].x, dirtyEnd = dirtyStart;
+    for (size_t i = first; i < last; i++) {
+      const QtRenderFrame::TextRun &run = runs[i];
+      int cells = run.wide ? 2 * run.len : run.len;
+      // text drawn by QPainter may spill a little past its cells
+      if (!run.atlas) cells++;
+      dirtyStart = std::min(dirtyStart, run.x);
+      dirtyEnd = std::max(dirtyEnd, run.x + cells);
+    }
+    dirty += QRect(dirtyStart * cellWidth, y * cellHeight, (dirtyEnd - dirtyStart) * cellWidth,
+                   cellHeight);
+
+    int fillStart = -1, fillEnd = -1;
+    QRgb fillColour = 0;
+    for (size_t i = first; i < last; i++) {
+      const QtRenderFrame::TextRun &run = runs[i];
+      if (run.atlas) continue;
+      if (fillStart >= 0 && run.x == fillEnd && run.bg == fillColour) {
+        fillEnd += run.len;
+        continue;
+      }
+      if (fillStart >= 0)
+        painter.fillRect(fillStart * cellWidth, y * cellHeight, (fillEnd - fillStart) * cellWidth,
+                         cellHeight, penCache.brush(fillColour));
+      fillStart = run.x;
+      fillEnd = run.x + run.len;
+      fillColour = run.bg;
+    }
+    if (fillStart >= 0)
+      painter.fillRect(fillStart * cellWidth, y * cellHeight, (fillEnd - fillStart) * cellWidth,
+                       cellHeight, penCache.brush(fillColour));
+
+    for (size_t i = first; i < last; i++) {
+      const QtRenderFrame::TextRun &run = runs[i];
+      QStringView str = QStringView(frame.text).mid(run.offset, run.len);
+      if (run.atlas) {
+        drawGlyphs(painter, run, str);
+        continue;
+      }
+
+      if (!havePen || run.fg != penRgb) {
+        painter.setPen(penCache.pen(run.fg));
+        penRgb = run.fg;
+        havePen = true;
+      }
+      bool bold = run.style & QtGlyphAtlas::STYLE_BOLD;
+      if (bold != boldFontSet) {
+        painter.setFont(bold ? boldFont : font);
+        boldFontSet = bold;
+      }
+      if (run.narrow)
+        drawNarrow(painter, run, str);
+      else
+        painter.drawText(run.x * cellWidth, y * cellHeight + ascent, str.toString());
+      if (run.style & QtGlyphAtlas::STYLE_UNDERLINE)
+        painter.drawLine(run.x * cellWidth, y * cellHeight + ascent + 1,
+                         (run.x + run.len) * cellWidth - 1, y * cellHeight + ascent + 1);
+    }
+  }
+  if (boldFontSet) painter.setFont(font);
+
+  for (const QtRenderFrame::Overlay &op : frame.overlays) {
+    int cells = (op.kind == QtRenderFrame::TRUST_SIGIL || op.wide) ? 2 : 1;
+    dirty += QRect(op.x * cellWidth, op.y * cellHeight, cells * cellWidth, cellHeight);
+    if (op.kind == QtRenderFrame::TRUST_SIGIL)
+      painter.drawImage(QPoint(op.x * cellWidth, op.y * cellHeight), trustSigil);
+    else
+      paintCursor(painter, op);
+  }
+  return dirty;
+}
+
+void QtTerminalRenderer::paintCursor(QPainter &painter, const QtRenderFrame::Overlay &op) {
+  painter.setPen(penCache.pen(op.fg));
+  painter.setBrush(penCache.brush(op.bg));
+
+  int char_width = cellWidth;
+  if (op.wide) char_width *= 2;
+  int x = op.x * cellWidth;
+  int y = op.y * cellHeight;
+
+  if (op.kind == QtRenderFrame::CURSOR_BLOCK) {
+    if (op.active)
+      painter.fillRect(x, y, char_width, cellHeight, QColor(op.fg));
+    else
+      painter.drawRect(x + 1, y + 1, char_width - 2, cellHeight - 2);
+    return;
+  }
+
+  int startx, starty, dx, dy, length, i;
+  if (op.kind == QtRenderFrame::CURSOR_UNDERLINE) {
+    startx = x;
+    starty = y + descent;
+    dx = 1;
+    dy = 0;
+    length = char_width;
+  } else {
+    int xadjust = 0;
+    if (op.right) xadjust = char_width - 1;
+    startx = x + xadjust;
+    starty = y + 1;
+    dx = 0;
+    dy = 1;
+    length = cellHeight - 2;
+  }
+  if (op.active) {
+    // To draw the vertical and underline active cursors
+    painter.drawLine(startx, starty + length * dx, startx + length * dx, starty + length);
+  } else {
+    // To draw the vertical and underline passive cursors
+    for (i = 0; i < length; i++) {
+      painter.setPen(penCache.pen((i % 2 == 0) ? op.fg : op.bg));
+      painter.drawPoint(startx, starty + length * dx);
+      startx += dx;
+      starty += dy;
+    }
+  }
+}
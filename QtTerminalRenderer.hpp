@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+#ifndef QTTERMINALRENDERER_H
+#define QTTERMINALRENDERER_H
+
+#include <QFont>
+#include <QImage>
+#include <QPainter>
+#include <QRegion>
+#include <QString>
+#include <vector>
+
+#include "QtGlyphAtlas.hpp"
+#include "QtPenCache.hpp"
+
+/*
+ * One frame of terminal drawing, as recorded by GuiTerminalWindow
+ * between setupContext() and freeContext(). Colours, styles and cursor
+ * shapes are resolved while recording, so that a frame can be rendered
+ * without looking at the terminal or the window - and so on any thread.
+ */
+struct QtRenderFrame {
+  struct TextRun {
+    int x, y;
+    int offset, len;  // into text
+    QRgb fg, bg;
+    uint8_t style;  // QtGlyphAtlas::Style
+    bool wide;
+    bool narrow;  // characters the font draws wider than a cell, squeezed into one
+    bool atlas;
+  };
+  enum OverlayKind : uint8_t {
+    CURSOR_BLOCK,
+    CURSOR_UNDERLINE,
+    CURSOR_VERTICAL,
+    TRUST_SIGIL,
+  };
+  struct Overlay {
+    int x, y;
+    QRgb fg, bg;
+    OverlayKind kind;
+    bool active;  // focused cursor
+    bool wide;
+    bool right;  // vertical cursor on the right edge of the cell
+  };
+
+  // screen lines scrolled before anything is drawn; none if scrollLines is 0
+  int scrollTop = 0, scrollBottom = 0, scrollLines = 0;
+  QString text;
+  std::vector<TextRun> runs;
+  std::vector<Overlay> overlays;
+
+  bool isEmpty() const { return !scrollLines && runs.empty() && overlays.empty(); }
+};
+
+/*
+ * Rasterises recorded frames into a frame buffer image. A renderer is
+ * not thread-safe, but it only touches its own state and the target
+ * image, so it can be driven from a worker thread as long as only one
+ * thread uses it at a time.
+ */
+class QtTerminalRenderer {
+ public:
+  void setFont(const QFont &font, int cellWidth, int cellHeight, int ascent, int descent);
+  void setTrustSigil(const QImage &sigil) { trustSigil = sigil; }
+
+  // whether scrolled rows can be moved in a frame buffer of this pixel ratio
+  bool canScroll(qreal dpr) const;
+
+  // returns the area of the target that changed, in device independent pixels
+  QRegion render(QImage &target, const QtRenderFrame &frame);
+
+ private:
+  QFont font, boldFont;
+  int cellWidth = 1, cellHeight = 1, ascent = 0, descent = 0;
+  QImage trustSigil;
+
+  QtGlyphAtlas glyphAtlas;
+  QtPenCache penCache;
+
+  void scroll(QImage &target, int topline, int botline, int lines);
+  void drawGlyphs(QPainter &painter, const QtRenderFrame::TextRun &run, QStringView str);
+  void drawNarrow(QPainter &painter, const QtRenderFrame::TextRun &run, QStringView str);
+  void paintCursor(QPainter &painter, const QtRenderFrame::Overlay &op);
+};
+
+#endif  // QTTERMINALRENDERER_H
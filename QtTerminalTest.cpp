@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2012 Rajendran Thirupugalsamy
+ * See LICENSE for full copyright and license information.
+ * See COPYING for distribution information.
+ */
+
+/*
+ * Checks of terminal behaviour, run by ctest as "qutty_terminal_test".
+ *
+ * The scrollback store is checked on its own. The other checks feed
+ * output into a terminal window that has no backend, as the render
+ * benchmark does, and look at the terminal's lines afterwards. Without
+ * an explicit platform the offscreen QPA is used.
+ */
+
+#include <QApplication>
+#include <QClipboard>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <cstring>
+
+#include "GuiTerminalWindow.hpp"
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+
+constexpr int TEST_COLS = 80;
+constexpr int TEST_ROWS = 24;
+
+QTextStream out(stdout);
+int failures = 0;
+
+void expect(bool ok, const char *check, const char *what) {
+  if (ok) return;
+  out << check << ": " << what << '\n';
+  failures++;
+}
+
+void feed(Terminal *term, const char *data) { term_data(term, data, strlen(data)); }
+
+// the text of screen line y, without trailing blanks
+QString lineText(Terminal *term, int y) {
+  termline *line = term_get_line(term, y);
+  QString text;
+  for (int x = 0; x < line->cols; x++) text += QChar(char16_t(line->chars[x].chr & 0xFF));
+  term_release_line(line);
+  while (text.endsWith(u' ')) text.chop(1);
+  return text;
+}
+
+bool lineTrusted(Terminal *term, int y) {
+  termline *line = term_get_line(term, y);
+  bool trusted = line->trusted;
+  term_release_line(line);
+  return trusted;
+}
+
+/*
+ * Untrusted output written over a line left from trusted output, such
+ * as an authentication prompt, must wipe the line and clear its trust
+ * flag, so that the trust sigil isn't drawn next to it. Runs of plain
+ * ASCII take a fast path in term_out, which has to do the same.
+ */
+void checkUntrustedAsciiRun(Terminal *term) {
+  const char *check = "untrusted ASCII run";
+  term_set_trust_status(term, true);
+  feed(term, "Password for user@host: ");
+  expect(lineTrusted(term, 0), check, "line not trusted after trusted output");
+
+  term_set_trust_status(term, false);
+  feed(term, "\rspoofed");
+  expect(!lineTrusted(term, 0), check, "line still trusted after untrusted output");
+  expect(lineText(term, 0) == "spoofed"_L1, check, "trusted text left on the line");
+}
+
+bool sameColour(const optionalrgb &a, const optionalrgb &b) {
+  return a.enabled == b.enabled && (!a.enabled || (a.r == b.r && a.g == b.g && a.b == b.b));
+}
+
+// whether both terminals have the same cursor and screen, down to each cell
+bool sameScreen(Terminal *a, Terminal *b) {
+  if (a->curs.x != b->curs.x || a->curs.y != b->curs.y || a->wrapnext != b->wrapnext) return false;
+  bool same = true;
+  for (int y = 0; y < a->rows && same; y++) {
+    termline *la = term_get_line(a, y), *lb = term_get_line(b, y);
+    same = la->cols == lb->cols && la->lattr == lb->lattr && la->trusted == lb->trusted;
+    for (int x = 0; x < la->cols && same; x++) {
+      const termchar &ca = la->chars[x], &cb = lb->chars[x];
+      const truecolour &ta = a->tctable.colours[ca.truecolour];
+      const truecolour &tb = b->tctable.colours[cb.truecolour];
+      same = ca.chr == cb.chr && ca.attr == cb.attr && !ca.cc_next == !cb.cc_next &&
+             sameColour(ta.fg, tb.fg) && sameColour(ta.bg, tb.bg);
+    }
+    term_release_line(la);
+    term_release_line(lb);
+  }
+  return same;
+}
+
+/*
+ * Runs of plain ASCII take a fast path in term_out, which must leave
+ * the terminal just as term_display_graphic_char would, byte by byte.
+ * Session logging of printable output turns the fast path off, so each
+ * case is fed to a terminal logging to a scratch file and to one that
+ * isn't, and the two compared.
+ */
+void checkAsciiFastPath(const PuttyConfig &cfg) {
+  static const struct {
+    const char *check;
+    bool trusted;
+    const char *data;
+  } cases[] = {
+      {"ASCII run wrapping at the last column", false,
+       "\033[1;75Habcdefghijkl\033[24;70H0123456789abcdef"
+       "\033[?7l\033[3;70Hzyxwvutsrqponm\033[?7h"},
+      // runs starting on the right half of a wide character, and ending on its left half
+      {"ASCII run over a wide character", false,
+       "\033[1;11H\xe4\xb8\xad\033[1;12Hx\033[2;11H\xe4\xb8\xad\033[2;10Hab"
+       "\033[3;11H\xe4\xb8\xad\033[3;8Habcd"},
+      {"ASCII run in insert mode", false,
+       "hello world\033[1;3H\033[4hXYZ\033[4l\r\nabc\033[2;1H\033[4h"
+       "defghijklmnopqrstuvwxyz0123456789012345678901234567890123456789012345678901234"
+       "\033[4l"},
+      {"ASCII run on a trusted line", true,
+       "0123456789012345678901234567890123456789012345678901234567890123456789012345678901234567"
+       "890123456789\r\n\033[2;76Habcdefgh"},
+      {"ASCII run in true colour", false,
+       "\033[38;2;10;20;30;48;2;200;100;50mcoloured\033[0m plain \033[1;4;31mbold"
+       "\033[38;2;1;2;3m more\033[0m"},
+  };
+
+  QTemporaryDir logDir;
+  PuttyConfig slowCfg = cfg.copyWithNewName(u"terminal-test");
+  conf_set_int(slowCfg.get(), CONF_logtype, LGTYP_ASCII);
+  conf_set_int(slowCfg.get(), CONF_logxfovr, LGXF_OVR);
+  Filename *logFile = filename_from_str(logDir.filePath(u"ascii.log"_s).toLocal8Bit().constData());
+  conf_set_filename(slowCfg.get(), CONF_logfilename, logFile);
+  filename_free(logFile);
+
+  for (const auto &c : cases) {
+    LogContext *logctx = log_init(default_logpolicy, slowCfg.get());
+    {
+      GuiTerminalWindow fast(nullptr, nullptr, cfg.copyWithNewName(u"terminal-test"));
+      GuiTerminalWindow slow(nullptr, nullptr, slowCfg.copy());
+      fast.initBenchTerminal(TEST_COLS, TEST_ROWS);
+      slow.initBenchTerminal(TEST_COLS, TEST_ROWS);
+      term_provide_logctx(slow.term, logctx);
+      for (Terminal *term : {fast.term, slow.term}) {
+        term_set_trust_status(term, c.trusted);
+        feed(term, c.data);
+      }
+      expect(sameScreen(fast.term, slow.term), c.check, "differs from byte-at-a-time output");
+    }
+    log_free(logctx);
+  }
+}
+
+/*
+ * A mouse selection of thousands of lines is copied in the background
+ * (see writeClipStream), into both the terminal's own clipboard and,
+ * with auto-copy on, the system one. Both must end up with the text.
+ */
+void checkStreamedSelection(Terminal *term) {
+  const char *check = "streamed selection";
+  const int lines = 6000;
+  QString expected;
+  QByteArray data;
+  for (int i = 0; i < lines; i++) {
+    QByteArray line = "line " + QByteArray::number(i);
+    data += line + "\r\n";
+    expected += QString::fromLatin1(line) + u'\n';
+  }
+  term_data(term, data.constData(), data.size());
+
+  // from the top of the scrollback to the end of the last line written
+  term_scroll(term, -1, 0);
+  term_mouse(term, MBT_LEFT, MBT_SELECT, MA_CLICK, 0, 0, false, false, false);
+  term_scroll(term, 1, 0);
+  term_mouse(term, MBT_LEFT, MBT_SELECT, MA_DRAG, TEST_COLS - 1, TEST_ROWS - 2, false, false,
+             false);
+  term_mouse(term, MBT_LEFT, MBT_SELECT, MA_RELEASE, TEST_COLS - 1, TEST_ROWS - 2, false, false,
+             false);
+  expect(term->last_selected_clip, check, "selection not streamed");
+
+  QElapsedTimer waited;
+  waited.start();
+  while (term->last_selected_clip && waited.elapsed() < 30000)
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+  expect(!term->last_selected_clip, check, "copy didn't finish");
+
+  QString local = QString::fromWCharArray(term->last_selected_text, term->last_selected_len);
+  expect(local == expected, check, "wrong text in the local clipboard");
+  expect(QApplication::clipboard()->text() == expected, check,
+         "wrong text in the system clipboard");
+}
+
+/*
+ * Scrollback records are opaque to the store, so these fill it with
+ * made-up ones: a mix of repeated text, long runs of one byte (matches
+ * that overlap what they copy) and noise (long literals), which is
+ * what the block compressor has to round-trip.
+ */
+QByteArray scrollbackRecord(int i, int len) {
+  QByteArray data;
+  quint32 seed = quint32(i) * 2654435761u;
+  while (data.size() < len) {
+    seed = seed * 1103515245u + 12345u;
+    switch (seed >> 29) {
+      case 0:
+        data.append(QByteArray(int(seed >> 8 & 511), char(seed >> 16)));
+        break;
+      case 1:
+        for (int k = 0; k < 200; k++) data.append(char((seed = seed * 69069u + 1) >> 24));
+        break;
+      default:
+        data.append(QByteArray::number(i) + " the quick brown fox jumps over the lazy dog ");
+    }
+  }
+  data.truncate(len);
+  return data;
+}
+
+void addRecord(sbstore *sb, int i, int len) {
+  QByteArray data = scrollbackRecord(i, len);
+  auto *cline = reinterpret_cast<compressed_scrollback_line *>(
+      snewn(sizeof(compressed_scrollback_line) + len, unsigned char));
+  cline->len = len;
+  memcpy(cline + 1, data.constData(), len);
+  sbstore_add(sb, cline, data.constData(), len);
+}
+
+bool recordIs(sbstore *sb, int index, int i, int len) {
+  compressed_scrollback_line *cline = sbstore_index(sb, index);
+  return cline && cline->len == size_t(len) &&
+         memcmp(cline + 1, scrollbackRecord(i, len).constData(), len) == 0;
+}
+
+// enough lines to seal a few dozen blocks, read back through their expansion
+void checkScrollbackRoundTrip() {
+  const char *check = "scrollback round trip";
+  sbstore *sb = sbstore_new();
+  const int lines = 20000;
+  for (int i = 0; i < lines; i++) addRecord(sb, i, 20 + i % 600);
+  expect(sbstore_count(sb) == lines, check, "wrong line count");
+  bool intact = true;
+  for (int i = 0; i < lines && intact; i++) intact = recordIs(sb, i, i, 20 + i % 600);
+  expect(intact, check, "line changed by compression");
+  sbstore_free(sb);
+}
+
+/*
+ * A line too long for the rest of a block starts a new one and seals
+ * the old. A resize that pulls it back onto the screen empties the
+ * new block, and the shorter lines that follow must not be written
+ * into the sealed one's buffer (which was expanded to just its size).
+ */
+void checkScrollbackAddAfterDelLast() {
+  const char *check = "scrollback add after dellast";
+  sbstore *sb = sbstore_new();
+  // 60 records of 1 KB leave too little of a 64 KiB block for 6 KB
+  for (int i = 0; i < 60; i++) addRecord(sb, i, 1000);
+  addRecord(sb, 60, 6000);
+  sbstore_dellast(sb);
+  for (int i = 60; i < 68; i++) addRecord(sb, i, 900);
+  expect(sbstore_count(sb) == 68, check, "wrong line count");
+  bool intact = true;
+  for (int i = 0; i < 68 && intact; i++) intact = recordIs(sb, i, i, i < 60 ? 1000 : 900);
+  expect(intact, check, "line changed");
+  sbstore_free(sb);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+  request_callback_notifications(callback_notify, nullptr);
+
+  PuttyConfig cfg = PuttyConfig::make(u"terminal-test");
+  load_open_settings(nullptr, cfg.get());
+  conf_set_str(cfg.get(), CONF_line_codepage, "UTF-8");
+  conf_set_int(cfg.get(), CONF_savelines, 10000);
+  conf_set_bool(cfg.get(), CONF_mouseautocopy, true);
+
+  void (*const storeChecks[])() = {
+      checkScrollbackRoundTrip,
+      checkScrollbackAddAfterDelLast,
+  };
+  for (auto check : storeChecks) check();
+
+  checkAsciiFastPath(cfg);
+
+  // each on a fresh terminal
+  void (*const checks[])(Terminal *term) = {
+      checkUntrustedAsciiRun,
+      checkStreamedSelection,
+  };
+  for (auto check : checks) {
+    GuiTerminalWindow window(nullptr, nullptr, cfg.copyWithNewName(u"terminal-test"));
+    window.initBenchTerminal(TEST_COLS, TEST_ROWS);
+    check(window.term);
+  }
+
+  out << (failures ? "FAILED\n" : "OK\n");
+  out.flush();
+  request_callback_notifications(nullptr, nullptr);
+  return failures ? 1 : 0;
+}
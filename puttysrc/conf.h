@@ -858,6 +858,23 @@ CONF_OPTION(logheader,
     DEFAULT_BOOL(true),
     SAVE_KEYWORD("LogHeader"),
 )
+#ifdef IS_QUTTY
+CONF_OPTION(logrotatesize,
+    VALUE_TYPE(INT), /* in megabytes of output; 0 for no limit */
+    DEFAULT_INT(0),
+    SAVE_KEYWORD("LogRotateSize"),
+)
+CONF_OPTION(logrotatetime,
+    VALUE_TYPE(INT), /* in minutes, counted from midnight; 0 for none */
+    DEFAULT_INT(0),
+    SAVE_KEYWORD("LogRotateTime"),
+)
+CONF_OPTION(logcompress, /* write log files gzip-compressed */
+    VALUE_TYPE(BOOL),
+    DEFAULT_BOOL(false),
+    SAVE_KEYWORD("LogCompress"),
+)
+#endif
 CONF_OPTION(logomitpass,
     VALUE_TYPE(BOOL),
     DEFAULT_BOOL(true),
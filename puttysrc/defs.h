@@ -92,6 +92,12 @@ typedef struct Filename Filename;
 typedef struct FontSpec FontSpec;
 
 typedef struct bufchain_tag bufchain;
+#ifdef IS_QUTTY
+typedef struct SharedBuffer SharedBuffer;
+typedef struct termclip termclip;
+typedef struct logwriter logwriter;
+typedef struct gzip_compressor gzip_compressor;
+#endif
 
 typedef struct strbuf strbuf;
 typedef struct LoadedFile LoadedFile;
@@ -20,12 +20,97 @@ struct LogContext {
     LogPolicy *lp;
     Conf *conf;
     int logtype;                       /* cached out of conf */
+#ifdef IS_QUTTY
+    logwriter *writer;                 /* if non-NULL, owns lgfp */
+    gzip_compressor *gz;               /* compressing without a writer */
+    bool compress;                     /* cached out of conf */
+    uint64_t rotate_size;              /* cached out of conf, 0 if none */
+    int rotate_minutes;                /* cached out of conf, 0 if none */
+    uint64_t filelen;                  /* output logged to this file */
+    time_t rotate_at;                  /* when to start the next, or 0 */
+#endif
 };
 
 static Filename *xlatlognam(const Filename *s,
                             const char *hostname, int port,
                             const struct tm *tm);
 
+#ifdef IS_QUTTY
+/*
+ * Log file I/O, which goes through the writer if there is one, and
+ * otherwise compresses on the spot if need be.
+ */
+static bool logfile_write(LogContext *ctx, ptrlen data)
+{
+    strbuf *sb;
+    bool ok;
+
+    if (ctx->writer)
+        return ctx->writer->vt->write(ctx->writer, data.ptr, data.len);
+    if (!ctx->gz)
+        return fwrite(data.ptr, 1, data.len, ctx->lgfp) == data.len;
+    sb = strbuf_new_nm();
+    gzip_compress(ctx->gz, data.ptr, data.len, sb);
+    ok = fwrite(sb->u, 1, sb->len, ctx->lgfp) == sb->len;
+    strbuf_free(sb);
+    return ok;
+}
+
+/* Ends and closes a file written without a writer. */
+static void logfile_finish(LogContext *ctx)
+{
+    if (ctx->gz) {
+        strbuf *sb = strbuf_new_nm();
+        gzip_compress_finish(ctx->gz, sb);
+        fwrite(sb->u, 1, sb->len, ctx->lgfp);
+        strbuf_free(sb);
+        gzip_compress_free(ctx->gz);
+        ctx->gz = NULL;
+    }
+    fclose(ctx->lgfp);
+    ctx->lgfp = NULL;
+}
+
+/*
+ * Time-based rotation happens on multiples of the interval counted
+ * from local midnight, so that e.g. 1440 starts a file every day at
+ * 00:00 and 60 one every hour on the hour.
+ */
+static time_t log_next_rotation(LogContext *ctx)
+{
+    struct tm tm;
+    int minutes;
+
+    if (!ctx->rotate_minutes)
+        return 0;
+    tm = ltime();
+    minutes = tm.tm_hour * 60 + tm.tm_min;
+    return time(NULL) - tm.tm_sec +
+        60 * (ctx->rotate_minutes - minutes % ctx->rotate_minutes);
+}
+
+/* Sets up lgfp, just opened, as the file further output goes to. */
+static void logfile_start(LogContext *ctx)
+{
+    ctx->filelen = 0;
+    ctx->rotate_at = log_next_rotation(ctx);
+    if (ctx->writer)
+        ctx->writer->vt->open(ctx->writer, ctx->lgfp, ctx->compress);
+    else if (ctx->compress)
+        ctx->gz = gzip_compress_new();
+}
+
+static bool logrotate_due(LogContext *ctx, size_t len)
+{
+    ctx->filelen += len;
+    if (ctx->rotate_size && ctx->filelen >= ctx->rotate_size)
+        return true;
+    return ctx->rotate_at && time(NULL) >= ctx->rotate_at;
+}
+
+static void logrotate(LogContext *ctx);
+#endif
+
 /*
  * Internal wrapper function which must be called for _all_ output
  * to the log file. It takes care of opening the log file if it
@@ -46,12 +131,20 @@ static void logwrite(LogContext *ctx, ptrlen data)
         bufchain_add(&ctx->queue, data.ptr, data.len);
     } else if (ctx->state == L_OPEN) {
         assert(ctx->lgfp);
+#ifdef IS_QUTTY
+        if (!logfile_write(ctx, data)) {
+#else
         if (fwrite(data.ptr, 1, data.len, ctx->lgfp) < data.len) {
+#endif
             logfclose(ctx);
             ctx->state = L_ERROR;
             lp_eventlog(ctx->lp, "Disabled writing session log "
                         "due to error while writing");
         }
+#ifdef IS_QUTTY
+        else if (logrotate_due(ctx, data.len))
+            logrotate(ctx);
+#endif
     }                                  /* else L_ERROR, so ignore the write */
 }
 
@@ -78,8 +171,21 @@ static PRINTF_LIKE(2, 3) void logprintf(LogContext *ctx, const char *fmt, ...)
 void logflush(LogContext *ctx)
 {
     if (ctx->logtype > 0)
-        if (ctx->state == L_OPEN)
+        if (ctx->state == L_OPEN) {
+#ifdef IS_QUTTY
+            if (ctx->writer) {
+                ctx->writer->vt->flush(ctx->writer);
+                return;
+            }
+            if (ctx->gz) {
+                strbuf *sb = strbuf_new_nm();
+                gzip_compress_flush(ctx->gz, sb);
+                fwrite(sb->u, 1, sb->len, ctx->lgfp);
+                strbuf_free(sb);
+            }
+#endif
             fflush(ctx->lgfp);
+        }
 }
 
 LogPolicy *log_get_policy(LogContext *ctx)
@@ -102,6 +208,9 @@ static void logfopen_callback(void *vctx, int mode)
         ctx->lgfp = f_open(ctx->currlogfilename, fmode, false);
         if (ctx->lgfp) {
             ctx->state = L_OPEN;
+#ifdef IS_QUTTY
+            logfile_start(ctx);
+#endif
         } else {
             ctx->state = L_ERROR;
             shout = true;
@@ -150,6 +259,120 @@ static void logfopen_callback(void *vctx, int mode)
     logflush(ctx);
 }
 
+#ifdef IS_QUTTY
+/*
+ * Whether a file is there already. Not open_for_write_would_lose_data,
+ * which the front end may answer with false to skip asking about it.
+ */
+static bool log_file_exists(const Filename *fn)
+{
+    FILE *fp = f_open(fn, "rb", false);
+
+    if (!fp)
+        return false;
+    fclose(fp);
+    return true;
+}
+
+/*
+ * The name of a log file, with .gz added if compressing. A file
+ * started by rotation never replaces an existing one: if the name
+ * is taken (say, because it has no date or time codes in it), a
+ * number is added.
+ */
+static Filename *log_filename(LogContext *ctx, const struct tm *tm,
+                              bool rotated)
+{
+    Filename *fn =
+        xlatlognam(conf_get_filename(ctx->conf, CONF_logfilename),
+                   conf_dest(ctx->conf),    /* hostname or serial line */
+                   conf_get_int(ctx->conf, CONF_port), tm);
+    const char *name = filename_to_str(fn);
+    size_t len = strlen(name);
+    const char *suffix = "";
+    char *base, *str;
+    unsigned n;
+
+    if (!ctx->compress && !rotated)
+        return fn;
+
+    if (ctx->compress) {
+        suffix = ".gz";
+        if (len >= 3 && !strcmp(name + len - 3, suffix))
+            len -= 3;
+    }
+    base = dupprintf("%.*s", (int)len, name);
+    filename_free(fn);
+
+    str = dupcat(base, suffix);
+    fn = filename_from_str(str);
+    sfree(str);
+    for (n = 1; rotated && log_file_exists(fn); n++) {
+        filename_free(fn);
+        str = dupprintf("%s.%u%s", base, n, suffix);
+        fn = filename_from_str(str);
+        sfree(str);
+    }
+    sfree(base);
+    return fn;
+}
+
+/*
+ * Carry on logging in a new file, once the current one has reached
+ * its size or time limit. With a writer, the old file is finished
+ * and closed on the writer's thread, after what was already queued
+ * for it.
+ */
+static void logrotate(LogContext *ctx)
+{
+    char buf[256], *event;
+    struct tm tm = ltime();
+    Filename *fn = log_filename(ctx, &tm, true);
+    FILE *fp = f_open(fn, "wb", false);
+
+    if (!fp) {
+        event = dupprintf("Error starting new session log file %s; "
+                          "carrying on in %s", filename_to_str(fn),
+                          filename_to_str(ctx->currlogfilename));
+        lp_eventlog(ctx->lp, event);
+        sfree(event);
+        filename_free(fn);
+        /* try again at the next limit, not on every write */
+        ctx->filelen = 0;
+        ctx->rotate_at = log_next_rotation(ctx);
+        return;
+    }
+
+    if (!ctx->writer)
+        logfile_finish(ctx);
+    ctx->lgfp = fp;
+    filename_free(ctx->currlogfilename);
+    ctx->currlogfilename = fn;
+    logfile_start(ctx);
+
+    event = dupprintf("Continuing session log in file: %s",
+                      filename_to_str(fn));
+    lp_eventlog(ctx->lp, event);
+    sfree(event);
+
+    if (conf_get_bool(ctx->conf, CONF_logheader)) {
+        strftime(buf, 24, "%Y.%m.%d %H:%M:%S", &tm);
+        logprintf(ctx, "=~=~=~=~=~=~=~=~=~=~=~= PuTTY log %s"
+                  " =~=~=~=~=~=~=~=~=~=~=~=\r\n", buf);
+    }
+}
+
+static void log_cache_conf(LogContext *ctx)
+{
+    int size = conf_get_int(ctx->conf, CONF_logrotatesize);
+    int minutes = conf_get_int(ctx->conf, CONF_logrotatetime);
+
+    ctx->compress = conf_get_bool(ctx->conf, CONF_logcompress);
+    ctx->rotate_size = size > 0 ? (uint64_t)size << 20 : 0;
+    ctx->rotate_minutes = minutes > 0 ? minutes : 0;
+}
+#endif
+
 /*
  * Open the log file. Takes care of detecting an already-existing
  * file and asking the user whether they want to append, overwrite
@@ -172,10 +395,14 @@ void logfopen(LogContext *ctx)
     /* substitute special codes in file name */
     if (ctx->currlogfilename)
         filename_free(ctx->currlogfilename);
+#ifdef IS_QUTTY
+    ctx->currlogfilename = log_filename(ctx, &tm, false);
+#else
     ctx->currlogfilename =
         xlatlognam(conf_get_filename(ctx->conf, CONF_logfilename),
                    conf_dest(ctx->conf),    /* hostname or serial line */
                    conf_get_int(ctx->conf, CONF_port), &tm);
+#endif
 
     if (open_for_write_would_lose_data(ctx->currlogfilename)) {
         int logxfovr = conf_get_int(ctx->conf, CONF_logxfovr);
@@ -195,6 +422,26 @@ void logfopen(LogContext *ctx)
 
 void logfclose(LogContext *ctx)
 {
+#ifdef IS_QUTTY
+    if (ctx->lgfp && ctx->writer) {
+        uint64_t dropped;
+        unsigned latency;
+
+        ctx->writer->vt->close(ctx->writer);
+        ctx->lgfp = NULL;
+        ctx->writer->vt->stats(ctx->writer, &dropped, &latency);
+        /* Only worth mentioning if the file system was being slow */
+        if (dropped || latency >= 100) {
+            char *event = dupprintf(
+                "Session log writer dropped %"PRIu64" bytes; slowest "
+                "write took %u ms", dropped, latency);
+            lp_eventlog(ctx->lp, event);
+            sfree(event);
+        }
+    }
+    if (ctx->lgfp)
+        logfile_finish(ctx);
+#endif
     if (ctx->lgfp) {
         fclose(ctx->lgfp);
         ctx->lgfp = NULL;
@@ -389,12 +636,30 @@ LogContext *log_init(LogPolicy *lp, Conf *conf)
     ctx->logtype = conf_get_int(ctx->conf, CONF_logtype);
     ctx->currlogfilename = NULL;
     bufchain_init(&ctx->queue);
+#ifdef IS_QUTTY
+    ctx->writer = NULL;
+    ctx->gz = NULL;
+    log_cache_conf(ctx);
+#endif
     return ctx;
 }
 
+#ifdef IS_QUTTY
+void log_set_writer(LogContext *ctx, logwriter *lw)
+{
+    /* Only before anything has been written, so lgfp is still ours */
+    assert(!ctx->writer && ctx->state == L_CLOSED);
+    ctx->writer = lw;
+}
+#endif
+
 void log_free(LogContext *ctx)
 {
     logfclose(ctx);
+#ifdef IS_QUTTY
+    if (ctx->writer)
+        ctx->writer->vt->free(ctx->writer);
+#endif
     bufchain_clear(&ctx->queue);
     if (ctx->currlogfilename)
         filename_free(ctx->currlogfilename);
@@ -411,6 +676,11 @@ void log_reconfig(LogContext *ctx, Conf *conf)
         conf_get_int(ctx->conf, CONF_logtype) !=
         conf_get_int(conf, CONF_logtype))
         reset_logging = true;
+#ifdef IS_QUTTY
+    else if (conf_get_bool(ctx->conf, CONF_logcompress) !=
+             conf_get_bool(conf, CONF_logcompress))
+        reset_logging = true;          /* can't change in mid-file */
+#endif
     else
         reset_logging = false;
 
@@ -421,6 +691,11 @@ void log_reconfig(LogContext *ctx, Conf *conf)
     ctx->conf = conf_copy(conf);
 
     ctx->logtype = conf_get_int(ctx->conf, CONF_logtype);
+#ifdef IS_QUTTY
+    log_cache_conf(ctx);
+    if (!reset_logging && ctx->state == L_OPEN)
+        ctx->rotate_at = log_next_rotation(ctx);
+#endif
 
     if (reset_logging)
         logfopen(ctx);
@@ -71,6 +71,22 @@ bool strbuf_chomp(strbuf *buf, char char_to_remove);
 strbuf *strbuf_new_for_agent_query(void);
 void strbuf_finalise_agent_query(strbuf *buf);
 
+#ifdef IS_QUTTY
+/*
+ * gzip (RFC1952) files made with the SSH Zlib compressor in
+ * ssh/zlib.c, for session logs. gzip_compress() appends compressed
+ * data to 'out' as it goes; gzip_compress_flush() makes all of it so
+ * far decodable, at a cost of a few bytes, and gzip_compress_finish()
+ * ends the file.
+ */
+gzip_compressor *gzip_compress_new(void);
+void gzip_compress(gzip_compressor *gz, const void *data, size_t len,
+                   strbuf *out);
+void gzip_compress_flush(gzip_compressor *gz, strbuf *out);
+void gzip_compress_finish(gzip_compressor *gz, strbuf *out);
+void gzip_compress_free(gzip_compressor *gz);
+#endif
+
 /* String-to-Unicode converters that auto-allocate the destination and
  * work around the rather deficient interface of mb_to_wc. */
 wchar_t *dup_mb_to_wc_c(int codepage, const char *string,
@@ -149,6 +165,27 @@ bool bufchain_try_consume(bufchain *ch, size_t len);
 bool bufchain_try_fetch(bufchain *ch, void *data, size_t len);
 bool bufchain_try_fetch_consume(bufchain *ch, void *data, size_t len);
 size_t bufchain_fetch_consume_up_to(bufchain *ch, void *data, size_t len);
+#ifdef IS_QUTTY
+/*
+ * A reference-counted block of memory. Whoever fills one can bracket
+ * handing its contents on with sharedbuf_enter/sharedbuf_leave, and a
+ * consumer given a pointer into it meanwhile (found by
+ * sharedbuf_owning) may take a reference and keep the data instead of
+ * copying it.
+ */
+SharedBuffer *sharedbuf_new(size_t size);
+void *sharedbuf_data(SharedBuffer *sb);
+size_t sharedbuf_size(SharedBuffer *sb);
+bool sharedbuf_is_shared(SharedBuffer *sb);
+SharedBuffer *sharedbuf_ref(SharedBuffer *sb);
+void sharedbuf_unref(SharedBuffer *sb);
+void sharedbuf_enter(SharedBuffer *sb);
+void sharedbuf_leave(SharedBuffer *sb);
+SharedBuffer *sharedbuf_owning(const void *data, size_t len);
+void bufchain_add_shared(bufchain *ch, SharedBuffer *sb,
+                         const void *data, size_t len);
+void bufchain_add_adopting(bufchain *ch, const void *data, size_t len);
+#endif
 void bufchain_set_callback_inner(
     bufchain *ch, IdempotentCallback *ic,
     void (*queue_idempotent_callback)(IdempotentCallback *ic));
@@ -1734,6 +1734,28 @@ struct TermWinVtable {
      * output has reduced. (Front ends will likely pass this straight
      * on to backend_unthrottle.) */
     void (*unthrottle)(TermWin *, size_t bufsize);
+
+#ifdef IS_QUTTY
+    /* Move the window contents of screen lines topline..botline
+     * (inclusive) by 'lines' lines, during a painting operation, in
+     * the same sense as the terminal's own scroll(): +ve moves them
+     * up. Returns false if the front end can't do that, in which case
+     * the terminal simply redraws the affected lines. */
+    bool (*scroll)(TermWin *, int topline, int botline, int lines);
+
+    /* Ask the front end to call term_update() when the window is
+     * next due to be redrawn. This replaces the fixed UPDATE_DELAY
+     * cooldown, letting the front end pace updates to the display. */
+    void (*schedule_update)(TermWin *);
+
+    /* Like clip_write, for a selection too big to turn into text on
+     * the spot: the front end takes over 'clip', runs its steps (see
+     * termclip_step) wherever suits it and writes the result to the
+     * clipboard. Returns false if it can't, in which case the
+     * terminal does the copy itself. */
+    bool (*clip_write_stream)(TermWin *, int clipboard, termclip *clip,
+                              bool must_deselect);
+#endif
 };
 
 static inline bool win_setup_draw_ctx(TermWin *win)
@@ -1792,6 +1814,16 @@ static inline void win_palette_get_overrides(TermWin *win, Terminal *term)
 { win->vt->palette_get_overrides(win, term); }
 static inline void win_unthrottle(TermWin *win, size_t size)
 { win->vt->unthrottle(win, size); }
+#ifdef IS_QUTTY
+static inline bool win_scroll(TermWin *win, int topline, int botline,
+                              int lines)
+{ return win->vt->scroll(win, topline, botline, lines); }
+static inline void win_schedule_update(TermWin *win)
+{ win->vt->schedule_update(win); }
+static inline bool win_clip_write_stream(
+    TermWin *win, int clipboard, termclip *clip, bool deselect)
+{ return win->vt->clip_write_stream(win, clipboard, clip, deselect); }
+#endif
 
 /*
  * Global functions not specific to a connection instance.
@@ -2182,6 +2214,37 @@ LogPolicy *log_get_policy(LogContext *logctx);
 void logevent(LogContext *logctx, const char *event);
 void logeventf(LogContext *logctx, const char *fmt, ...) PRINTF_LIKE(2, 3);
 void logeventvf(LogContext *logctx, const char *fmt, va_list ap);
+#ifdef IS_QUTTY
+/*
+ * A log writer takes the session log's file I/O off the calling
+ * thread. Once one is attached, the LogContext still opens the log
+ * file, but hands the FILE over to the writer, which from then on
+ * owns it. open() may also be given a new file while one is still
+ * open, when the log is rotated: output queued so far goes to the
+ * old file, which the writer then finishes and closes itself.
+ * 'compress' has the writer gzip what goes into the file. write()
+ * only queues the data, and returns false once the writer has given
+ * up on the file (e.g. after a write error); flush() only asks for
+ * the file to be flushed; close() drains what is queued and closes
+ * the file, waiting for that to finish.
+ */
+struct logwriter {
+    const struct logwriter_vtable *vt;
+};
+struct logwriter_vtable {
+    void (*open)(logwriter *lw, FILE *fp, bool compress);
+    bool (*write)(logwriter *lw, const void *data, size_t len);
+    void (*flush)(logwriter *lw);
+    void (*close)(logwriter *lw);
+    /* Bytes dropped and the slowest single write or flush, in
+     * milliseconds, since the last call. */
+    void (*stats)(logwriter *lw, uint64_t *dropped,
+                  unsigned *max_latency_ms);
+    void (*free)(logwriter *lw);
+};
+/* Attaches a writer to a LogContext, which takes ownership of it. */
+void log_set_writer(LogContext *logctx, logwriter *lw);
+#endif
 
 /*
  * Pass a dynamically allocated string to logevent and immediately
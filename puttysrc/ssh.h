@@ -60,6 +60,9 @@ typedef struct PktIn {
     int type;
     unsigned long sequence; /* SSH-2 incoming sequence number */
     PacketQueueNode qnode;  /* for linking this packet on to a queue */
+#ifdef IS_QUTTY
+    SharedBuffer *shared;   /* holds this packet, if not allocated alone */
+#endif
     BinarySource_IMPLEMENTATION;
 } PktIn;
 
@@ -99,6 +102,12 @@ typedef struct PktOutQueue {
     PktOut *(*after)(PacketQueueBase *, PacketQueueNode *prev, bool pop);
 } PktOutQueue;
 
+#ifdef IS_QUTTY
+void ssh_free_pktin(PktIn *pktin);
+#else
+#define ssh_free_pktin(pktin) sfree(pktin)
+#endif
+
 void pq_base_push(PacketQueueBase *pqb, PacketQueueNode *node);
 void pq_base_push_front(PacketQueueBase *pqb, PacketQueueNode *node);
 void pq_base_concatenate(PacketQueueBase *dest,
@@ -91,6 +91,9 @@ static void ssh2_bare_bpp_handle_input(BinaryPacketProtocol *bpp)
         s->pktin = snew_plus(PktIn, s->packetlen);
         s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
         s->pktin->qnode.on_free_queue = false;
+#ifdef IS_QUTTY
+        s->pktin->shared = NULL;
+#endif
         s->maxlen = 0;
         s->data = snew_plus_get_aux(s->pktin);
 
@@ -161,6 +161,9 @@ static void ssh1_bpp_handle_input(BinaryPacketProtocol *bpp)
         s->pktin = snew_plus(PktIn, s->biglen);
         s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
         s->pktin->qnode.on_free_queue = false;
+#ifdef IS_QUTTY
+        s->pktin->shared = NULL;
+#endif
         s->pktin->type = 0;
 
         s->maxlen = s->biglen;
@@ -71,6 +71,23 @@ BinaryPacketProtocol *ssh2_bpp_new(
     return &s->bpp;
 }
 
+/*
+ * In QuTTY an incoming packet lives in a SharedBuffer, so that the
+ * terminal can adopt channel data from it once it is decrypted,
+ * rather than copying it.
+ */
+static PktIn *ssh2_bpp_new_pktin(size_t extra)
+{
+#ifdef IS_QUTTY
+    SharedBuffer *sb = sharedbuf_new(sizeof(PktIn) + extra);
+    PktIn *pktin = sharedbuf_data(sb);
+    pktin->shared = sb;
+    return pktin;
+#else
+    return snew_plus(PktIn, extra);
+#endif
+}
+
 static void ssh2_bpp_free_outgoing_crypto(struct ssh2_bpp_state *s)
 {
     if (s->out.mac)
@@ -98,7 +115,7 @@ static void ssh2_bpp_free(BinaryPacketProtocol *bpp)
     sfree(s->buf);
     ssh2_bpp_free_outgoing_crypto(s);
     ssh2_bpp_free_incoming_crypto(s);
-    sfree(s->pktin);
+    ssh_free_pktin(s->pktin);
     sfree(s);
 }
 
@@ -368,7 +385,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             /*
              * Now transfer the data into an output packet.
              */
-            s->pktin = snew_plus(PktIn, s->maxlen);
+            s->pktin = ssh2_bpp_new_pktin(s->maxlen);
             s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
             s->pktin->type = 0;
             s->pktin->qnode.on_free_queue = false;
@@ -418,7 +435,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
             /*
              * Allocate the packet to return, now we know its length.
              */
-            s->pktin = snew_plus(PktIn, OUR_V2_PACKETLIMIT + s->maclen);
+            s->pktin = ssh2_bpp_new_pktin(OUR_V2_PACKETLIMIT + s->maclen);
             s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
             s->pktin->type = 0;
             s->pktin->qnode.on_free_queue = false;
@@ -483,7 +500,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
              * Allocate the packet to return, now we know its length.
              */
             s->maxlen = s->packetlen + s->maclen;
-            s->pktin = snew_plus(PktIn, s->maxlen);
+            s->pktin = ssh2_bpp_new_pktin(s->maxlen);
             s->pktin->qnode.prev = s->pktin->qnode.next = NULL;
             s->pktin->type = 0;
             s->pktin->qnode.on_free_queue = false;
@@ -549,12 +566,18 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
                     PktIn *old_pktin = s->pktin;
 
                     s->maxlen = newlen + 5;
-                    s->pktin = snew_plus(PktIn, s->maxlen);
+                    s->pktin = ssh2_bpp_new_pktin(s->maxlen);
+#ifdef IS_QUTTY
+                    SharedBuffer *shared = s->pktin->shared;
+                    *s->pktin = *old_pktin; /* structure copy */
+                    s->pktin->shared = shared;
+#else
                     *s->pktin = *old_pktin; /* structure copy */
+#endif
                     s->data = snew_plus_get_aux(s->pktin);
 
                     smemclr(old_pktin, s->packetlen + s->maclen);
-                    sfree(old_pktin);
+                    ssh_free_pktin(old_pktin);
                 }
                 s->length = 5 + newlen;
                 memcpy(s->data + 5, newpayload, newlen);
@@ -597,7 +620,7 @@ static void ssh2_bpp_handle_input(BinaryPacketProtocol *bpp)
         }
 
         if (ssh2_bpp_check_unimplemented(&s->bpp, s->pktin)) {
-            sfree(s->pktin);
+            ssh_free_pktin(s->pktin);
             s->pktin = NULL;
             continue;
         }
@@ -55,6 +55,16 @@ void pq_base_push_front(PacketQueueBase *pqb, PacketQueueNode *node)
         queue_idempotent_callback(pqb->ic);
 }
 
+#ifdef IS_QUTTY
+void ssh_free_pktin(PktIn *pktin)
+{
+    if (pktin && pktin->shared)
+        sharedbuf_unref(pktin->shared);
+    else
+        sfree(pktin);
+}
+#endif
+
 static PacketQueueNode pktin_freeq_head = {
     &pktin_freeq_head, &pktin_freeq_head, true
 };
@@ -65,7 +75,7 @@ static void pktin_free_queue_callback(void *vctx)
         PacketQueueNode *node = pktin_freeq_head.next;
         PktIn *pktin = container_of(node, PktIn, qnode);
         pktin_freeq_head.next = node->next;
-        sfree(pktin);
+        ssh_free_pktin(pktin);
     }
 
     pktin_freeq_head.prev = &pktin_freeq_head;
@@ -545,9 +545,18 @@ static bool ssh2_connection_filter_queue(struct ssh2_connection_state *s)
                     c->remlocwin -= data.len;
                     if (ext_type != 0 && ext_type != SSH2_EXTENDED_DATA_STDERR)
                         data.len = 0; /* ignore unknown extended data */
+#ifdef IS_QUTTY
+                    /* let the terminal adopt the data from the packet */
+                    if (pktin->shared)
+                        sharedbuf_enter(pktin->shared);
+#endif
                     bufsize = chan_send(
                         c->chan, ext_type == SSH2_EXTENDED_DATA_STDERR,
                         data.ptr, data.len);
+#ifdef IS_QUTTY
+                    if (pktin->shared)
+                        sharedbuf_leave(pktin->shared);
+#endif
 
                     /*
                      * The channel may have turned into a connection-
@@ -643,7 +643,11 @@ static void ssh_receive(Plug *plug, int urgent, const char *data, size_t len)
         log_packet(ssh->logctx, PKT_INCOMING, -1, NULL, data, len,
                    0, NULL, NULL, 0, NULL);
 
+#ifdef IS_QUTTY
+    bufchain_add_adopting(&ssh->in_raw, data, len);
+#else
     bufchain_add(&ssh->in_raw, data, len);
+#endif
     if (!ssh->logically_frozen && ssh->bpp)
         queue_idempotent_callback(&ssh->bpp->ic_in_raw);
 
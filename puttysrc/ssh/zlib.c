@@ -686,6 +686,102 @@ static void zlib_compress_block(
     out->outbuf = NULL;
 }
 
+#ifdef IS_QUTTY
+/*
+ * The same Deflate stream wrapped as a gzip file instead of Zlib
+ * packets: one static block left open across calls, with the file's
+ * CRC and length at the end.
+ */
+struct gzip_compressor {
+    struct LZ77Context ectx;
+    struct Outbuf out;
+    uint32_t crc;
+    uint32_t isize;
+};
+
+gzip_compressor *gzip_compress_new(void)
+{
+    gzip_compressor *gz = snew(gzip_compressor);
+
+    lz77_init(&gz->ectx);
+    gz->ectx.literal = zlib_literal;
+    gz->ectx.match = zlib_match;
+    gz->ectx.userdata = &gz->out;
+    gz->out.outbuf = NULL;
+    gz->out.outbits = gz->out.noutbits = 0;
+    gz->out.firstblock = true;
+    gz->crc = 0xFFFFFFFF;
+    gz->isize = 0;
+    return gz;
+}
+
+void gzip_compress_free(gzip_compressor *gz)
+{
+    sfree(gz->ectx.ictx);
+    sfree(gz);
+}
+
+static void gzip_start(gzip_compressor *gz, strbuf *out)
+{
+    gz->out.outbuf = out;
+    if (gz->out.firstblock) {
+        /*
+         * gzip header: magic 1F 8B, method 8 (Deflate), no flags,
+         * no modification time, no extra flags, unknown OS. Then
+         * open the first static block.
+         */
+        static const unsigned char header[] = {
+            0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF,
+        };
+        put_data(out, header, sizeof(header));
+        outbits(&gz->out, 2, 3);
+        gz->out.firstblock = false;
+    }
+}
+
+void gzip_compress(gzip_compressor *gz, const void *data, size_t len,
+                   strbuf *out)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    gzip_start(gz, out);
+    gz->crc = crc32_update(gz->crc, make_ptrlen(data, len));
+    gz->isize += len;
+    while (len > 0) {
+        int n = len < 65536 ? (int)len : 65536;
+        lz77_compress(&gz->ectx, p, n);
+        p += n;
+        len -= n;
+    }
+    gz->out.outbuf = NULL;
+}
+
+void gzip_compress_flush(gzip_compressor *gz, strbuf *out)
+{
+    /* Zlib partial flush, as in zlib_compress_block() */
+    gzip_start(gz, out);
+    outbits(&gz->out, 0, 7);        /* close block */
+    outbits(&gz->out, 2, 3 + 7);    /* empty static block */
+    outbits(&gz->out, 2, 3);        /* open new block */
+    gz->out.outbuf = NULL;
+}
+
+void gzip_compress_finish(gzip_compressor *gz, strbuf *out)
+{
+    unsigned char trailer[8];
+
+    gzip_start(gz, out);
+    outbits(&gz->out, 0, 7);        /* close block */
+    outbits(&gz->out, 3, 3 + 7);    /* final, empty, static block */
+    if (gz->out.noutbits)
+        outbits(&gz->out, 0, 8 - gz->out.noutbits);
+    PUT_32BIT_LSB_FIRST(trailer, gz->crc ^ 0xFFFFFFFF);
+    PUT_32BIT_LSB_FIRST(trailer + 4, gz->isize);
+    put_data(out, trailer, sizeof(trailer));
+    gz->out.outbuf = NULL;
+}
+#endif
+
 /* ----------------------------------------------------------------------
  * Zlib decompression. Of course, even though our compressor always
  * uses static trees, our _decompressor_ has to be capable of
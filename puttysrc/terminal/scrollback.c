@@ -0,0 +1,902 @@
+/*
+ * Arena storage for the terminal's scrollback (QuTTY).
+ *
+ * Upstream keeps every compressed scrollback line in its own heap
+ * allocation, indexed by a tree234. With hundreds of thousands of
+ * lines per session, the malloc headers and tree nodes cost as much
+ * as the lines themselves, and the lines end up scattered all over
+ * the heap.
+ *
+ * Here compressed lines are instead appended to arena blocks of
+ * SB_BLOCK_SIZE bytes. Only the newest block is kept as plain data;
+ * once it fills up it is sealed, i.e. compressed as a unit, which
+ * squeezes out most of the redundancy between neighbouring lines. A
+ * sealed block is expanded again, into a small cache, when one of
+ * its lines is looked at.
+ *
+ * Sealing happens on the scroll path, so it uses a simple greedy LZ77
+ * with a single hash probe per position rather than the (much slower)
+ * deflate compressor in ssh/zlib.c.
+ *
+ * Past a configurable number of lines, the oldest sealed blocks are
+ * spilled: handed to the front end's sbspill, which appends them to
+ * segment files on disk, and dropped from memory. Reading a spilled
+ * block maps just that block's bytes for as long as it takes to
+ * expand them. Blocks go into a segment until it reaches
+ * SB_SEGMENT_SIZE, and a segment is removed once no block is in it any
+ * more.
+ *
+ * Every block also carries a search filter: a bitmap with one bit set
+ * for each (hashed, case-folded) trigram of the text of its lines. A
+ * search only has to expand the blocks whose filter has the bits of
+ * every trigram in the search string, and the filters stay in memory
+ * when their blocks are spilled, so that ruling a block out never
+ * touches the disk. Filters go away with their blocks.
+ *
+ * Scanning the whole scrollback can be done off the terminal's thread
+ * through a snapshot, which stays valid however the store changes
+ * afterwards. It either holds its own copy of the (compressed) blocks
+ * or, to be cheap to take, shares the sealed blocks' compressed bytes
+ * and reads spilled blocks back when they are scanned.
+ *
+ * A ring of (block, offset) pairs, one per line, finds any line in
+ * constant time. Lines are only ever added at the bottom and removed
+ * from the top (when the scrollback is full) or the bottom (when a
+ * resize pulls lines back onto the screen), so blocks are freed
+ * whole once their last line has gone.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "putty.h"
+#include "terminal.h"
+
+#define SB_BLOCK_SIZE 65536
+#define SB_CACHE_BLOCKS 4
+#define SB_SEGMENT_SIZE (4 << 20)
+
+/* search filter size in bits, as a power of two */
+#define SB_FILTER_BITS 15
+#define SB_FILTER_WORDS ((1 << SB_FILTER_BITS) / 64)
+
+/* LZ77 parameters: shortest match, hash table size, furthest match */
+#define SB_MINMATCH 4
+#define SB_HASHBITS 13
+#define SB_MAXDIST 65535
+
+/* records start size_t-aligned, for the compressed_scrollback_line header */
+#define SB_ALIGN(n) (((n) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+
+/*
+ * Compressed records that snapshots refer to as well as their block,
+ * and that go when the last of them lets go. Like everything else in
+ * the store, 'refs' is only touched on the store's thread.
+ */
+typedef struct sbzshare {
+    unsigned char *zdata;
+    int refs;
+} sbzshare;
+
+/* The front end's sbspill, likewise kept for snapshots that read it. */
+typedef struct sbspillref {
+    sbspill *spill;
+    int refs;
+} sbspillref;
+
+typedef struct sbblock {
+    unsigned char *data;        /* raw records; NULL while sealed */
+    size_t used;                /* bytes of raw records */
+    unsigned char *zdata;       /* compressed records, if sealed */
+    size_t zlen;
+    sbzshare *share;            /* of zdata, once a snapshot has it */
+    int nlines;                 /* records still referenced by the ring */
+    uint64_t firstseq;          /* sequence number of its first line */
+    uint64_t *filter;           /* trigrams of the text of its lines */
+    bool spilled;               /* zdata is in a segment file instead */
+    unsigned segment;
+    uint64_t fileoffset;
+} sbblock;
+
+typedef struct sbentry {
+    unsigned block;             /* sequence number of the owning block */
+    unsigned offset;            /* of the record in the raw block */
+} sbentry;
+
+struct sbstore {
+    sbblock *blocks;
+    size_t nblocks, blocksize;
+    unsigned firstblock;        /* sequence number of blocks[0] */
+
+    sbentry *ring;              /* one entry per line, oldest at ringhead */
+    size_t ringsize;            /* always a power of two */
+    size_t ringhead, nlines;
+    uint64_t lineseq;           /* sequence number of the oldest line */
+
+    /* sealed blocks expanded by recent lookups */
+    struct {
+        unsigned block;
+        unsigned char *data;
+    } cache[SB_CACHE_BLOCKS];
+    int cachenext;
+
+    /* blocks[0..nspilled) are on disk; see sbstore_set_spill() */
+    sbspill *spill;
+    sbspillref *spillref;
+    int memlines;               /* lines to keep in memory */
+    int residentlines;          /* lines in blocks that are not spilled */
+    size_t nspilled;
+    bool spillfailed;           /* a write failed, so keep the rest */
+    unsigned firstsegment;      /* oldest that may still be on disk */
+    unsigned segment;           /* the one being appended to */
+    uint64_t segmentbytes;
+};
+
+sbstore *sbstore_new(void)
+{
+    sbstore *sb = snew(sbstore);
+    memset(sb, 0, sizeof(*sb));
+    return sb;
+}
+
+static void sbstore_uncache(sbstore *sb, unsigned block)
+{
+    for (int i = 0; i < SB_CACHE_BLOCKS; i++) {
+        if (sb->cache[i].data && sb->cache[i].block == block) {
+            sfree(sb->cache[i].data);
+            sb->cache[i].data = NULL;
+        }
+    }
+}
+
+static void sbzshare_release(sbzshare *share)
+{
+    if (--share->refs == 0) {
+        sfree(share->zdata);
+        sfree(share);
+    }
+}
+
+static void sbspillref_release(sbspillref *ref)
+{
+    if (--ref->refs == 0) {
+        ref->spill->vt->free(ref->spill);
+        sfree(ref);
+    }
+}
+
+/* Let go of a block's compressed records. */
+static void sbblock_dropz(sbblock *b)
+{
+    if (b->share)
+        sbzshare_release(b->share);
+    else
+        sfree(b->zdata);
+    b->zdata = NULL;
+    b->share = NULL;
+}
+
+static void sbblock_free(sbblock *b)
+{
+    sfree(b->data);
+    sbblock_dropz(b);
+    sfree(b->filter);
+}
+
+/*
+ * Remove the segment files that no spilled block is in any more: those
+ * before the oldest spilled block's, and any after the newest's, which
+ * sbstore_dellast can leave behind.
+ */
+static void sbstore_drop_segments(sbstore *sb)
+{
+    if (!sb->nspilled) {
+        for (unsigned s = sb->firstsegment; s != sb->segment + 1; s++)
+            sb->spill->vt->remove(sb->spill, s);
+        sb->firstsegment = sb->segment;
+        sb->segmentbytes = 0;
+        return;
+    }
+
+    for (; sb->firstsegment != sb->blocks[0].segment; sb->firstsegment++)
+        sb->spill->vt->remove(sb->spill, sb->firstsegment);
+    unsigned last = sb->blocks[sb->nspilled - 1].segment;
+    if (last != sb->segment) {
+        for (unsigned s = last + 1; s != sb->segment + 1; s++)
+            sb->spill->vt->remove(sb->spill, s);
+        sb->segment = last + 1;
+        sb->segmentbytes = 0;
+    }
+}
+
+void sbstore_clear(sbstore *sb)
+{
+    for (size_t i = 0; i < sb->nblocks; i++)
+        sbblock_free(&sb->blocks[i]);
+    for (int i = 0; i < SB_CACHE_BLOCKS; i++) {
+        sfree(sb->cache[i].data);
+        sb->cache[i].data = NULL;
+    }
+    sb->firstblock += sb->nblocks;
+    sb->lineseq += sb->nlines;
+    sb->nblocks = sb->nspilled = 0;
+    sb->ringhead = sb->nlines = sb->residentlines = 0;
+    if (sb->spill)
+        sbstore_drop_segments(sb);
+}
+
+void sbstore_free(sbstore *sb)
+{
+    sbstore_clear(sb);
+    if (sb->spillref)
+        sbspillref_release(sb->spillref);
+    sfree(sb->blocks);
+    sfree(sb->ring);
+    sfree(sb);
+}
+
+/*
+ * Let the store spill all but the newest 'memlines' lines to disk
+ * through 'spill', which it takes ownership of. Only meant to be
+ * called on an empty store.
+ */
+void sbstore_set_spill(sbstore *sb, sbspill *spill, int memlines)
+{
+    assert(!sb->nlines);
+    if (sb->spillref)
+        sbspillref_release(sb->spillref);
+    sb->spill = spill;
+    sb->spillref = snew(sbspillref);
+    sb->spillref->spill = spill;
+    sb->spillref->refs = 1;
+    sb->memlines = memlines;
+}
+
+int sbstore_count(sbstore *sb)
+{
+    return sb->nlines;
+}
+
+/*
+ * The sequence number of line 0. Lines are numbered as they are added,
+ * so a line's index plus this stays the same while the lines above it
+ * are removed.
+ */
+uint64_t sbstore_lineseq(sbstore *sb)
+{
+    return sb->lineseq;
+}
+
+/*
+ * Index of the first line of blocks[i] still in the store. Lines are
+ * numbered in sequence as they are added, so this needs no walk over
+ * the blocks before it.
+ */
+static int sbstore_blockstart(sbstore *sb, size_t i)
+{
+    /* the oldest block may have lost some of its lines already */
+    return i ? (int)(sb->blocks[i].firstseq - sb->lineseq) : 0;
+}
+
+/*
+ * The compressed form is a sequence of LZ4-style tokens: a byte whose
+ * top and bottom nibbles give the literal count and the match length
+ * minus SB_MINMATCH (15 meaning that more length bytes follow, each
+ * adding up to 255), then the literals, then a two-byte little-endian
+ * match distance. The final token has literals only.
+ */
+static inline uint32_t sb_read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static void sb_putlength(strbuf *out, size_t n)
+{
+    for (; n >= 255; n -= 255)
+        put_byte(out, 255);
+    put_byte(out, n);
+}
+
+static void sb_putsequence(strbuf *out, const unsigned char *lit,
+                           size_t nlit, size_t mlen, size_t dist)
+{
+    size_t mcode = mlen ? mlen - SB_MINMATCH : 0;
+    put_byte(out, (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15));
+    if (nlit >= 15)
+        sb_putlength(out, nlit - 15);
+    put_data(out, lit, nlit);
+    if (!mlen)
+        return;
+    put_byte(out, dist & 0xFF);
+    put_byte(out, dist >> 8);
+    if (mcode >= 15)
+        sb_putlength(out, mcode - 15);
+}
+
+static void sbblock_seal(sbblock *b)
+{
+    uint32_t hashtab[1 << SB_HASHBITS];
+    const unsigned char *src = b->data;
+    size_t len = b->used, anchor = 0, i = 0;
+    strbuf *out = strbuf_new();
+
+    /* positions are stored +1, so that 0 means an empty slot */
+    memset(hashtab, 0, sizeof(hashtab));
+    while (i + SB_MINMATCH <= len) {
+        uint32_t v = sb_read32(src + i);
+        uint32_t h = (v * 2654435761U) >> (32 - SB_HASHBITS);
+        size_t cand = hashtab[h];
+        hashtab[h] = i + 1;
+        if (!cand || i - (cand - 1) > SB_MAXDIST ||
+            sb_read32(src + cand - 1) != v) {
+            i++;
+            continue;
+        }
+        cand--;
+        size_t mlen = SB_MINMATCH;
+        while (i + mlen < len && src[cand + mlen] == src[i + mlen])
+            mlen++;
+        sb_putsequence(out, src + anchor, i - anchor, mlen, i - cand);
+        i += mlen;
+        anchor = i;
+    }
+    sb_putsequence(out, src + anchor, len - anchor, 0, 0);
+
+    b->zlen = out->len;
+    b->zdata = (unsigned char *)strbuf_to_str(out);
+    sfree(b->data);
+    b->data = NULL;
+}
+
+static size_t sb_getlength(const unsigned char **p, size_t n)
+{
+    if (n == 15) {
+        unsigned char c;
+        do {
+            c = *(*p)++;
+            n += c;
+        } while (c == 255);
+    }
+    return n;
+}
+
+static void sb_expand(unsigned char *data, size_t len,
+                      const unsigned char *p, size_t zlen)
+{
+    const unsigned char *end = p + zlen;
+    size_t pos = 0;
+
+    while (p < end) {
+        unsigned char token = *p++;
+        size_t nlit = sb_getlength(&p, token >> 4);
+        memcpy(data + pos, p, nlit);
+        p += nlit;
+        pos += nlit;
+        if (p >= end)
+            break;
+        size_t dist = p[0] | p[1] << 8;
+        p += 2;
+        size_t mlen = sb_getlength(&p, token & 15) + SB_MINMATCH;
+        /* byte by byte, as the match may overlap what it is copying */
+        for (size_t j = 0; j < mlen; j++, pos++)
+            data[pos] = data[pos - dist];
+    }
+    assert(pos == len);
+    (void)len;
+}
+
+/*
+ * Expand a sealed block into a new buffer. Fails only if a spilled
+ * block cannot be read back.
+ */
+static unsigned char *sbblock_expand(sbstore *sb, sbblock *b)
+{
+    const void *zdata = b->zdata;
+    if (b->spilled) {
+        zdata = sb->spill->vt->map(sb->spill, b->segment, b->fileoffset,
+                                   b->zlen);
+        if (!zdata)
+            return NULL;
+    }
+    unsigned char *data = snewn(b->used ? b->used : 1, unsigned char);
+    sb_expand(data, b->used, zdata, b->zlen);
+    if (b->spilled)
+        sb->spill->vt->unmap(sb->spill, b->segment, zdata);
+    return data;
+}
+
+/*
+ * Move sealed blocks to disk, oldest first, until no more than
+ * memlines lines are left in memory.
+ */
+static void sbstore_spill(sbstore *sb)
+{
+    while (sb->nspilled < sb->nblocks && sb->blocks[sb->nspilled].zdata &&
+           sb->residentlines - sb->blocks[sb->nspilled].nlines >=
+           sb->memlines) {
+        sbblock *b = &sb->blocks[sb->nspilled];
+        if (sb->segmentbytes && sb->segmentbytes + b->zlen > SB_SEGMENT_SIZE) {
+            sb->segment++;
+            sb->segmentbytes = 0;
+        }
+        int64_t offset = sb->spill->vt->write(sb->spill, sb->segment,
+                                              b->zdata, b->zlen);
+        if (offset < 0) {
+            /* out of disk space, say: keep everything else in memory */
+            sb->spillfailed = true;
+            return;
+        }
+        b->spilled = true;
+        b->segment = sb->segment;
+        b->fileoffset = offset;
+        sb->segmentbytes = offset + b->zlen;
+        sbblock_dropz(b);
+        sb->residentlines -= b->nlines;
+        sb->nspilled++;
+    }
+}
+
+static void sbstore_growring(sbstore *sb)
+{
+    size_t newsize = sb->ringsize ? 2 * sb->ringsize : 1024;
+    sbentry *ring = snewn(newsize, sbentry);
+    for (size_t i = 0; i < sb->nlines; i++)
+        ring[i] = sb->ring[(sb->ringhead + i) & (sb->ringsize - 1)];
+    sfree(sb->ring);
+    sb->ring = ring;
+    sb->ringsize = newsize;
+    sb->ringhead = 0;
+}
+
+/*
+ * Search text is compared case-insensitively, one byte per column,
+ * as Latin-1 (which is what the find bar sees). This folds the same
+ * way as QChar::toCaseFolded() does within Latin-1.
+ */
+static inline unsigned char sb_fold(unsigned char c)
+{
+    if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7))
+        return c + 0x20;
+    return c;
+}
+
+static inline unsigned sb_trigram(const char *text)
+{
+    uint32_t t = (uint32_t)sb_fold(text[0]) << 16 |
+        (uint32_t)sb_fold(text[1]) << 8 | sb_fold(text[2]);
+    return (t * 2654435761U) >> (32 - SB_FILTER_BITS);
+}
+
+static bool sbblock_may_contain(const sbblock *b, const char *text,
+                                size_t len)
+{
+    for (size_t i = 0; i + 3 <= len; i++) {
+        unsigned bit = sb_trigram(text + i);
+        if (!(b->filter[bit / 64] & (UINT64_C(1) << (bit % 64))))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Append a line at the bottom of the scrollback. The store takes
+ * over the line, like addpos234 would: it is copied into the current
+ * block and freed. 'text' is what the line is searched as, see
+ * term_search_text().
+ */
+void sbstore_add(sbstore *sb, compressed_scrollback_line *cline,
+                 const char *text, size_t textlen)
+{
+    size_t size = SB_ALIGN(sizeof(compressed_scrollback_line) + cline->len);
+    sbblock *b = sb->nblocks ? &sb->blocks[sb->nblocks - 1] : NULL;
+
+    /* the newest block may be sealed already, after sbstore_dellast */
+    if (!b || !b->data || (b->used + size > SB_BLOCK_SIZE && b->nlines > 0)) {
+        if (b && b->data) {
+            sbblock_seal(b);
+            if (sb->spill && !sb->spillfailed)
+                sbstore_spill(sb);
+        }
+        sgrowarray(sb->blocks, sb->blocksize, sb->nblocks);
+        b = &sb->blocks[sb->nblocks++];
+        memset(b, 0, sizeof(*b));
+        /* an oversized line gets a block of its own */
+        b->data = snewn(size > SB_BLOCK_SIZE ? size : SB_BLOCK_SIZE,
+                        unsigned char);
+        b->filter = snewn(SB_FILTER_WORDS, uint64_t);
+        memset(b->filter, 0, SB_FILTER_WORDS * sizeof(uint64_t));
+        b->firstseq = sb->lineseq + sb->nlines;
+    }
+
+    if (sb->nlines == sb->ringsize)
+        sbstore_growring(sb);
+    sbentry *e = &sb->ring[(sb->ringhead + sb->nlines++) & (sb->ringsize - 1)];
+    e->block = sb->firstblock + (sb->nblocks - 1);
+    e->offset = b->used;
+
+    memcpy(b->data + b->used, cline, sizeof(*cline) + cline->len);
+    b->used += size;
+    b->nlines++;
+    sb->residentlines++;
+    sfree(cline);
+
+    for (size_t i = 0; i + 3 <= textlen; i++) {
+        unsigned bit = sb_trigram(text + i);
+        b->filter[bit / 64] |= UINT64_C(1) << (bit % 64);
+    }
+}
+
+/*
+ * Return line 'index' (0 is the oldest), or NULL if out of range. The
+ * result points into the store and is only valid until the next call
+ * to any sbstore function; decompress it before then.
+ */
+compressed_scrollback_line *sbstore_index(sbstore *sb, int index)
+{
+    if (index < 0 || index >= sb->nlines)
+        return NULL;
+
+    sbentry *e = &sb->ring[(sb->ringhead + index) & (sb->ringsize - 1)];
+    sbblock *b = &sb->blocks[e->block - sb->firstblock];
+    unsigned char *data = b->data;
+
+    if (!data) {
+        for (int i = 0; i < SB_CACHE_BLOCKS; i++) {
+            if (sb->cache[i].data && sb->cache[i].block == e->block) {
+                data = sb->cache[i].data;
+                break;
+            }
+        }
+    }
+    if (!data) {
+        data = sbblock_expand(sb, b);
+        if (!data) {
+            /* a segment file has gone missing: show blank lines */
+            static const struct {
+                compressed_scrollback_line hdr;
+                unsigned char data[2];         /* 0 columns, no lattr */
+            } blank = { { 2 }, { 0, 0 } };
+            return (compressed_scrollback_line *)&blank;
+        }
+        int slot = sb->cachenext;
+        sb->cachenext = (slot + 1) % SB_CACHE_BLOCKS;
+        sfree(sb->cache[slot].data);
+        sb->cache[slot].block = e->block;
+        sb->cache[slot].data = data;
+    }
+
+    return (compressed_scrollback_line *)(data + e->offset);
+}
+
+/* Remove the oldest line. */
+void sbstore_delfirst(sbstore *sb)
+{
+    if (!sb->nlines)
+        return;
+
+    sbentry *e = &sb->ring[sb->ringhead];
+    sbblock *b = &sb->blocks[e->block - sb->firstblock];
+    assert(b == &sb->blocks[0]);
+    sb->ringhead = (sb->ringhead + 1) & (sb->ringsize - 1);
+    sb->nlines--;
+    sb->lineseq++;
+    if (!b->spilled)
+        sb->residentlines--;
+
+    if (--b->nlines == 0) {
+        bool spilled = b->spilled;
+        sbstore_uncache(sb, sb->firstblock);
+        sbblock_free(b);
+        memmove(sb->blocks, sb->blocks + 1,
+                (sb->nblocks - 1) * sizeof(sbblock));
+        sb->nblocks--;
+        sb->firstblock++;
+        if (spilled) {
+            sb->nspilled--;
+            sbstore_drop_segments(sb);
+        }
+    }
+}
+
+/*
+ * Remove the newest line. If that empties the newest block, the one
+ * before stays sealed (or spilled), and sbstore_add starts a new one.
+ */
+void sbstore_dellast(sbstore *sb)
+{
+    if (!sb->nlines)
+        return;
+
+    sb->nlines--;
+    sbentry *e = &sb->ring[(sb->ringhead + sb->nlines) & (sb->ringsize - 1)];
+    sbblock *b = &sb->blocks[sb->nblocks - 1];
+    assert(e->block == sb->firstblock + (sb->nblocks - 1));
+    if (b->data)
+        b->used = e->offset;
+    if (!b->spilled)
+        sb->residentlines--;
+
+    if (--b->nlines == 0) {
+        bool spilled = b->spilled;
+        sbstore_uncache(sb, sb->firstblock + (sb->nblocks - 1));
+        sbblock_free(b);
+        sb->nblocks--;
+        if (spilled) {
+            sb->nspilled--;
+            sbstore_drop_segments(sb);
+        }
+    }
+}
+
+/*
+ * Return the nearest line to 'index', going towards the bottom if
+ * 'dir' is positive and towards the top otherwise, that may contain
+ * 'text'; or -1 if there is none. Lines that are passed over
+ * certainly don't contain it, while the one returned still has to be
+ * checked. 'text' is Latin-1, and is case-folded here the same way
+ * as the lines were; if it is shorter than a trigram, every line may
+ * contain it.
+ */
+int sbstore_find(sbstore *sb, const char *text, size_t len, int index,
+                 int dir)
+{
+    if (index < 0 || index >= sb->nlines)
+        return -1;
+
+    sbentry *e = &sb->ring[(sb->ringhead + index) & (sb->ringsize - 1)];
+    size_t i = e->block - sb->firstblock;
+    int first = sbstore_blockstart(sb, i);
+
+    while (!sbblock_may_contain(&sb->blocks[i], text, len)) {
+        if (dir > 0) {
+            first += sb->blocks[i].nlines;
+            if (++i == sb->nblocks)
+                return -1;
+            index = first;
+        } else {
+            if (i-- == 0)
+                return -1;
+            first -= sb->blocks[i].nlines;
+            index = first + sb->blocks[i].nlines - 1;
+        }
+    }
+    return index;
+}
+
+/*
+ * A block of a snapshot is found in one of three places: its own copy
+ * in 'data', the store's compressed records in 'share', or a segment
+ * file. If it is in none of them, its segment went missing before it
+ * could be copied.
+ */
+struct sbsnapshot {
+    struct sbsnapblock {
+        unsigned char *data;    /* compressed unless 'raw' */
+        sbzshare *share;
+        bool spilled;           /* still to be read from 'segment' */
+        unsigned segment;
+        uint64_t fileoffset;
+        size_t len, used;
+        bool raw;
+        int firstline, nlines;
+        size_t offset;          /* of the first line in the raw block */
+    } *blocks;
+    size_t nblocks;
+    sbspillref *spill;          /* for the spilled blocks, if any */
+};
+
+/* Start the snapshot of blocks[i], whose first line is 'first'. */
+static struct sbsnapblock *sbsnapshot_add(sbsnapshot *ss, sbstore *sb,
+                                          size_t i, int first)
+{
+    sbblock *b = &sb->blocks[i];
+    struct sbsnapblock *sn = &ss->blocks[ss->nblocks++];
+    sn->data = NULL;
+    sn->share = NULL;
+    sn->spilled = false;
+    sn->raw = b->data != NULL;
+    sn->len = sn->raw ? b->used : b->zlen;
+    sn->used = b->used;
+    sn->firstline = first;
+    sn->nlines = b->nlines;
+    sn->offset = i ? 0 : sb->ring[sb->ringhead].offset;
+    return sn;
+}
+
+/* Copy blocks[i], whose first line is 'first', into a snapshot. */
+static void sbsnapshot_take(sbsnapshot *ss, sbstore *sb, size_t i, int first)
+{
+    sbblock *b = &sb->blocks[i];
+    struct sbsnapblock *sn = sbsnapshot_add(ss, sb, i, first);
+    const void *src = b->data ? b->data : b->zdata;
+    if (b->spilled)
+        src = sb->spill->vt->map(sb->spill, b->segment, b->fileoffset,
+                                 b->zlen);
+    /* a block whose segment has gone missing is kept, as lost */
+    if (src) {
+        sn->data = snewn(sn->len ? sn->len : 1, unsigned char);
+        memcpy(sn->data, src, sn->len);
+        if (b->spilled)
+            sb->spill->vt->unmap(sb->spill, b->segment, src);
+    }
+}
+
+/*
+ * Put blocks[i] into a snapshot without copying it, unless it is the
+ * unsealed block, which is still being added to.
+ */
+static void sbsnapshot_refer(sbsnapshot *ss, sbstore *sb, size_t i, int first)
+{
+    sbblock *b = &sb->blocks[i];
+    if (b->data) {
+        sbsnapshot_take(ss, sb, i, first);
+        return;
+    }
+
+    struct sbsnapblock *sn = sbsnapshot_add(ss, sb, i, first);
+    if (b->spilled) {
+        sn->spilled = true;
+        sn->segment = b->segment;
+        sn->fileoffset = b->fileoffset;
+        if (!ss->spill) {
+            ss->spill = sb->spillref;
+            ss->spill->refs++;
+        }
+    } else {
+        if (!b->share) {
+            b->share = snew(sbzshare);
+            b->share->zdata = b->zdata;
+            b->share->refs = 1;
+        }
+        b->share->refs++;
+        sn->share = b->share;
+    }
+}
+
+static sbsnapshot *sbsnapshot_new(size_t maxblocks)
+{
+    sbsnapshot *ss = snew(sbsnapshot);
+    ss->blocks = snewn(maxblocks ? maxblocks : 1, struct sbsnapblock);
+    ss->nblocks = 0;
+    ss->spill = NULL;
+    return ss;
+}
+
+/*
+ * Snapshot the blocks that may contain 'text' (as in sbstore_find),
+ * for scanning with sbsnapshot_lines(). Apart from the unsealed block,
+ * nothing is copied or read back from disk here: that is left to
+ * sbsnapshot_lines(), on whichever thread scans each block. The
+ * snapshot must still be freed on the store's thread.
+ */
+sbsnapshot *sbstore_snapshot(sbstore *sb, const char *text, size_t len)
+{
+    sbsnapshot *ss = sbsnapshot_new(sb->nblocks);
+    int first = 0;
+    for (size_t i = 0; i < sb->nblocks; first += sb->blocks[i++].nlines) {
+        if (sbblock_may_contain(&sb->blocks[i], text, len))
+            sbsnapshot_refer(ss, sb, i, first);
+    }
+    return ss;
+}
+
+/*
+ * Take a copy of just the blocks holding any of lines 'first' to
+ * 'last', so that a small range of a long scrollback doesn't read
+ * back every spilled block. Spilled blocks are read back here, and
+ * the snapshot can be freed on any thread.
+ */
+sbsnapshot *sbstore_snapshot_lines(sbstore *sb, int first, int last)
+{
+    if (first < 0)
+        first = 0;
+    if (last >= sb->nlines)
+        last = sb->nlines - 1;
+    if (first > last)
+        return sbsnapshot_new(0);
+
+    sbentry *e = &sb->ring[(sb->ringhead + first) & (sb->ringsize - 1)];
+    size_t i = e->block - sb->firstblock;
+    e = &sb->ring[(sb->ringhead + last) & (sb->ringsize - 1)];
+    size_t end = e->block - sb->firstblock + 1;
+
+    sbsnapshot *ss = sbsnapshot_new(end - i);
+    for (; i < end; i++)
+        sbsnapshot_take(ss, sb, i, sbstore_blockstart(sb, i));
+    return ss;
+}
+
+size_t sbsnapshot_blocks(sbsnapshot *ss)
+{
+    return ss->nblocks;
+}
+
+/*
+ * Call 'fn' with each line of one block of a snapshot, and its index
+ * in the scrollback at the time the snapshot was taken. This touches
+ * nothing that the store changes, only reads from the spill, so
+ * different blocks can be scanned on different threads at once.
+ * Returns false, without calling 'fn', if the block couldn't be read
+ * back from its segment file.
+ */
+bool sbsnapshot_lines(sbsnapshot *ss, size_t block,
+                      void (*fn)(void *ctx, int index,
+                                 compressed_scrollback_line *cline),
+                      void *ctx)
+{
+    struct sbsnapblock *sn = &ss->blocks[block];
+    unsigned char *src = sn->share ? sn->share->zdata : sn->data;
+    unsigned char *zbuf = NULL, *data;
+    if (sn->spilled) {
+        sbspill *spill = ss->spill->spill;
+        zbuf = snewn(sn->len ? sn->len : 1, unsigned char);
+        if (spill->vt->read(spill, sn->segment, sn->fileoffset, zbuf,
+                            sn->len))
+            src = zbuf;
+    }
+    if (!src) {
+        sfree(zbuf);
+        return false;
+    }
+    if (sn->raw) {
+        data = src;
+    } else {
+        data = snewn(sn->used ? sn->used : 1, unsigned char);
+        sb_expand(data, sn->used, src, sn->len);
+    }
+
+    size_t offset = sn->offset;
+    for (int i = 0; i < sn->nlines; i++) {
+        compressed_scrollback_line *cline =
+            (compressed_scrollback_line *)(data + offset);
+        fn(ctx, sn->firstline + i, cline);
+        offset += SB_ALIGN(sizeof(*cline) + cline->len);
+    }
+
+    if (data != src)
+        sfree(data);
+    sfree(zbuf);
+    return true;
+}
+
+/* The lines of the scrollback that one block of a snapshot holds. */
+void sbsnapshot_range(sbsnapshot *ss, size_t block, int *first,
+                      int *nlines)
+{
+    *first = ss->blocks[block].firstline;
+    *nlines = ss->blocks[block].nlines;
+}
+
+void sbsnapshot_free(sbsnapshot *ss)
+{
+    for (size_t i = 0; i < ss->nblocks; i++) {
+        sfree(ss->blocks[i].data);
+        if (ss->blocks[i].share)
+            sbzshare_release(ss->blocks[i].share);
+    }
+    if (ss->spill)
+        sbspillref_release(ss->spill);
+    sfree(ss->blocks);
+    sfree(ss);
+}
+
+/* Bytes held by the store, including its own bookkeeping. */
+size_t sbstore_memory(sbstore *sb)
+{
+    size_t total = sizeof(*sb) + sb->blocksize * sizeof(sbblock) +
+        sb->ringsize * sizeof(sbentry);
+    for (size_t i = 0; i < sb->nblocks; i++) {
+        sbblock *b = &sb->blocks[i];
+        if (b->data)
+            total += b->used > SB_BLOCK_SIZE ? b->used : SB_BLOCK_SIZE;
+        if (b->zdata)
+            total += b->zlen;
+        total += SB_FILTER_WORDS * sizeof(uint64_t);
+    }
+    for (int i = 0; i < SB_CACHE_BLOCKS; i++)
+        if (sb->cache[i].data)
+            total += SB_BLOCK_SIZE;
+    return total;
+}
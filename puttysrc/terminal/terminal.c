@@ -13,6 +13,17 @@
 #include "putty.h"
 #include "terminal.h"
 
+#ifdef IS_QUTTY
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUTTY_HAVE_SSE2
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#endif
+
 #define VT52_PLUS
 
 #define CL_ANSIMIN      0x0001         /* Codes in all ANSI like terminals. */
@@ -99,6 +110,9 @@ static void update_sbar(Terminal *);
 static void deselect(Terminal *);
 static void term_print_finish(Terminal *);
 static void scroll(Terminal *, int, int, int, bool);
+#ifdef IS_QUTTY
+static void discard_scrolls(Terminal *);
+#endif
 static void parse_optionalrgb(optionalrgb *out, unsigned *values);
 static void term_added_data(Terminal *term, bool);
 static void term_update_raw_mouse_mode(Terminal *term);
@@ -116,6 +130,9 @@ static termline *newtermline(Terminal *term, int cols, bool bce)
     line->cols = line->size = cols;
     line->lattr = LATTR_NORM;
     line->trusted = false;
+#ifdef IS_QUTTY
+    line->bidi = false;
+#endif
     line->temporary = false;
     line->cc_free = 0;
 
@@ -327,6 +344,162 @@ static void clear_cc(termline *line, int col)
 #endif
 }
 
+#ifdef IS_QUTTY
+#define TCTABLE_MIN_LIMIT 4096
+
+static void tctable_init(tctable *tct)
+{
+    tct->size = 16;
+    tct->colours = snewn(tct->size, truecolour);
+    tct->colours[0].fg = tct->colours[0].bg = optionalrgb_none;
+    tct->n = 1;
+    tct->hashsize = 2 * tct->size;
+    tct->hash = snewn(tct->hashsize, tcindex);
+    memset(tct->hash, 0, tct->hashsize * sizeof(tcindex));
+    tct->last = 0;
+    tct->limit = TCTABLE_MIN_LIMIT;
+}
+
+static void tctable_free(tctable *tct)
+{
+    sfree(tct->colours);
+    sfree(tct->hash);
+}
+
+static size_t tctable_hash(const tctable *tct, truecolour tc)
+{
+    uint64_t key =
+        ((uint64_t)tc.fg.r << 40) | ((uint64_t)tc.fg.g << 32) |
+        ((uint64_t)tc.fg.b << 24) | ((uint64_t)tc.bg.r << 16) |
+        ((uint64_t)tc.bg.g << 8) | tc.bg.b |
+        ((uint64_t)tc.fg.enabled << 48) | ((uint64_t)tc.bg.enabled << 49);
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) &
+        (tct->hashsize - 1);
+}
+
+static tcindex tctable_add(tctable *tct, truecolour tc)
+{
+    size_t h = tctable_hash(tct, tc);
+    tcindex i;
+
+    if (truecolour_equal(tct->colours[0], tc))
+        return tct->last = 0;          /* the one colour not in the hash */
+    while ((i = tct->hash[h]) != 0) {
+        if (truecolour_equal(tct->colours[i], tc))
+            return tct->last = i;
+        h = (h + 1) & (tct->hashsize - 1);
+    }
+
+    if (tct->n == tct->size) {
+        size_t size = tct->size;
+        sgrowarray(tct->colours, size, tct->n);
+        tct->size = size;
+        if (tct->hashsize < 2 * size) {
+            sfree(tct->hash);
+            while (tct->hashsize < 2 * size)
+                tct->hashsize *= 2;
+            tct->hash = snewn(tct->hashsize, tcindex);
+            memset(tct->hash, 0, tct->hashsize * sizeof(tcindex));
+            for (i = 1; i < tct->n; i++) {
+                h = tctable_hash(tct, tct->colours[i]);
+                while (tct->hash[h])
+                    h = (h + 1) & (tct->hashsize - 1);
+                tct->hash[h] = i;
+            }
+            h = tctable_hash(tct, tc);
+            while (tct->hash[h])
+                h = (h + 1) & (tct->hashsize - 1);
+        }
+    }
+
+    i = tct->n++;
+    tct->colours[i] = tc;
+    tct->hash[h] = i;
+    return tct->last = i;
+}
+
+/*
+ * Find the index of a colour, adding it to the table if it's new.
+ * Colours are kept exactly as given, down to the RGB left behind in
+ * a disabled one, so that cells compare just as they did when they
+ * held the colours themselves.
+ */
+static inline tcindex tctable_intern(tctable *tct, truecolour tc)
+{
+    if (truecolour_equal(tct->colours[tct->last], tc))
+        return tct->last;
+    return tctable_add(tct, tc);
+}
+
+static void tctable_remap_cells(tctable *tct, const tctable *old,
+                                termchar *chars, int n)
+{
+    for (int i = 0; i < n; i++)
+        if (chars[i].truecolour)
+            chars[i].truecolour =
+                tctable_intern(tct, old->colours[chars[i].truecolour]);
+}
+
+/*
+ * Once the table has grown past its limit, build a new one holding
+ * just the colours that cells still refer to. This must only be
+ * called when no decompressed scrollback line is in use, since those
+ * aren't visited.
+ */
+static void term_compact_tctable(Terminal *term)
+{
+    tctable old = term->tctable;
+    termline *line;
+    int i;
+
+    if (old.n < old.limit)
+        return;
+
+    tctable_init(&term->tctable);
+    for (i = 0; (line = index234(term->screen, i)) != NULL; i++)
+        tctable_remap_cells(&term->tctable, &old, line->chars, line->cols);
+    if (term->alt_screen)
+        for (i = 0; (line = index234(term->alt_screen, i)) != NULL; i++)
+            tctable_remap_cells(&term->tctable, &old, line->chars,
+                                line->cols);
+    if (term->disptext)
+        for (i = 0; i < term->rows; i++)
+            tctable_remap_cells(&term->tctable, &old,
+                                term->disptext[i]->chars,
+                                term->disptext[i]->cols);
+    for (size_t j = 0; j < term->bidi_cache_size; j++) {
+        if (term->pre_bidi_cache[j].chars)
+            tctable_remap_cells(&term->tctable, &old,
+                                term->pre_bidi_cache[j].chars,
+                                term->pre_bidi_cache[j].width);
+        if (term->post_bidi_cache[j].chars)
+            tctable_remap_cells(&term->tctable, &old,
+                                term->post_bidi_cache[j].chars,
+                                term->post_bidi_cache[j].width);
+    }
+    tctable_remap_cells(&term->tctable, &old, &term->basic_erase_char, 1);
+    tctable_remap_cells(&term->tctable, &old, &term->erase_char, 1);
+
+    if (term->tctable.limit < 2 * term->tctable.n)
+        term->tctable.limit = 2 * term->tctable.n;
+    tctable_free(&old);
+}
+
+/*
+ * A cell's truecolour field as code outside the table deals with it:
+ * interned from, compared as and turned back into a truecolour.
+ */
+#define TCTYPE tcindex
+#define TC_INTERN(term, tc) tctable_intern(&(term)->tctable, tc)
+#define TC_VALUE(term, t) ((term)->tctable.colours[t])
+#define tc_equal(a, b) ((a) == (b))
+#else
+#define TCTYPE truecolour
+#define TC_INTERN(term, tc) (tc)
+#define TC_VALUE(term, t) (t)
+#define tc_equal(a, b) truecolour_equal(a, b)
+#endif
+
 /*
  * Compare two character cells for equality. Special case required
  * in do_paint() where we override what we expect the chr and attr
@@ -336,7 +509,7 @@ static bool termchars_equal_override(termchar *a, termchar *b,
                                      unsigned long bchr, unsigned long battr)
 {
     /* FULL-TERMCHAR */
-    if (!truecolour_equal(a->truecolour, b->truecolour))
+    if (!tc_equal(a->truecolour, b->truecolour))
         return false;
     if (a->chr != bchr)
         return false;
@@ -358,6 +531,26 @@ static bool termchars_equal(termchar *a, termchar *b)
     return termchars_equal_override(a, b, b->chr, b->attr);
 }
 
+#ifdef IS_QUTTY
+/*
+ * Set a line's bidi flag if chr is a character that bidi or Arabic
+ * shaping could act on, so that term_bidi_line can pass over lines
+ * that have never held one. A character stored as a byte of some
+ * other character set isn't mapped to Unicode until it's displayed,
+ * so any such byte outside ASCII has to count. The flag is only
+ * cleared again when the whole line is.
+ */
+static inline void note_bidi_char(termline *line, unsigned long chr)
+{
+    if (chr < 0x590 || line->bidi)
+        return;                        /* nothing below Hebrew is RTL */
+    if (DIRECT_CHAR(chr) || DIRECT_FONT(chr))
+        line->bidi = (chr & 0x80) != 0;
+    else
+        line->bidi = is_rtl(chr);
+}
+#endif
+
 /*
  * Copy a character cell. (Requires a pointer to the destination
  * termline, so as to access its free list.)
@@ -368,6 +561,9 @@ static void copy_termchar(termline *destline, int x, termchar *src)
 
     destline->chars[x] = *src;         /* copy everything except cc-list */
     destline->chars[x].cc_next = 0;    /* and make sure this is zero */
+#ifdef IS_QUTTY
+    note_bidi_char(destline, src->chr);
+#endif
 
     while (src->cc_next) {
         src += src->cc_next;
@@ -411,9 +607,23 @@ static void move_termchar(termline *line, termchar *dest, termchar *src)
  * bloating the terminal emulator's memory footprint unless those
  * features are in constant use.)
  */
+#ifdef IS_QUTTY
+/*
+ * A compressed line holds real colours, so the truecolour literals
+ * need the table that the termline's indices refer to. Decompressing
+ * with no table leaves every cell without truecolour.
+ */
+#define RLE_TCT_PARAM , tctable *tct
+#define RLE_TCT_ARG , tct
+#else
+#define RLE_TCT_PARAM
+#define RLE_TCT_ARG
+#endif
+
 static void makerle(strbuf *b, termline *ldata,
                     void (*makeliteral)(strbuf *b, termchar *c,
-                                        unsigned long *state))
+                                        unsigned long *state RLE_TCT_PARAM)
+                    RLE_TCT_PARAM)
 {
     int hdrpos, hdrsize, n, prevlen, prevpos, thislen, thispos;
     bool prev2;
@@ -430,7 +640,7 @@ static void makerle(strbuf *b, termline *ldata,
 
     while (n-- > 0) {
         thispos = b->len;
-        makeliteral(b, c++, &state);
+        makeliteral(b, c++, &state RLE_TCT_ARG);
         thislen = b->len - thispos;
         if (thislen == prevlen &&
             !memcmp(b->u + prevpos, b->u + thispos, thislen)) {
@@ -483,7 +693,7 @@ static void makerle(strbuf *b, termline *ldata,
                     int tmppos, tmplen;
                     tmppos = b->len;
                     oldstate = state;
-                    makeliteral(b, c, &state);
+                    makeliteral(b, c, &state RLE_TCT_ARG);
                     tmplen = b->len - tmppos;
                     bool match = tmplen == thislen &&
                         !memcmp(b->u + runpos+1, b->u + tmppos, tmplen);
@@ -547,7 +757,8 @@ static void makerle(strbuf *b, termline *ldata,
         strbuf_shrink_to(b, hdrpos);
     }
 }
-static void makeliteral_chr(strbuf *b, termchar *c, unsigned long *state)
+static void makeliteral_chr(strbuf *b, termchar *c, unsigned long *state
+                            RLE_TCT_PARAM)
 {
     /*
      * My encoding for characters is UTF-8-like, in that it stores
@@ -602,7 +813,8 @@ static void makeliteral_chr(strbuf *b, termchar *c, unsigned long *state)
     }
     *state = c->chr & ~0xFF;
 }
-static void makeliteral_attr(strbuf *b, termchar *c, unsigned long *state)
+static void makeliteral_attr(strbuf *b, termchar *c, unsigned long *state
+                             RLE_TCT_PARAM)
 {
     /*
      * My encoding for attributes is 16-bit-granular and assumes
@@ -645,25 +857,33 @@ static void makeliteral_attr(strbuf *b, termchar *c, unsigned long *state)
         put_byte(b, (unsigned char)(attr & 0xFF));
     }
 }
-static void makeliteral_truecolour(strbuf *b, termchar *c, unsigned long *state)
+static void makeliteral_truecolour(strbuf *b, termchar *c, unsigned long *state
+                                   RLE_TCT_PARAM)
 {
+#ifdef IS_QUTTY
+    const truecolour *tc = &tct->colours[c->truecolour];
+#else
+    const truecolour *tc = &c->truecolour;
+#endif
+
     /*
      * Put the used parts of the colour info into the buffer.
      */
-    put_byte(b, ((c->truecolour.fg.enabled ? 1 : 0) |
-                 (c->truecolour.bg.enabled ? 2 : 0)));
-    if (c->truecolour.fg.enabled) {
-        put_byte(b, c->truecolour.fg.r);
-        put_byte(b, c->truecolour.fg.g);
-        put_byte(b, c->truecolour.fg.b);
+    put_byte(b, ((tc->fg.enabled ? 1 : 0) |
+                 (tc->bg.enabled ? 2 : 0)));
+    if (tc->fg.enabled) {
+        put_byte(b, tc->fg.r);
+        put_byte(b, tc->fg.g);
+        put_byte(b, tc->fg.b);
     }
-    if (c->truecolour.bg.enabled) {
-        put_byte(b, c->truecolour.bg.r);
-        put_byte(b, c->truecolour.bg.g);
-        put_byte(b, c->truecolour.bg.b);
+    if (tc->bg.enabled) {
+        put_byte(b, tc->bg.r);
+        put_byte(b, tc->bg.g);
+        put_byte(b, tc->bg.b);
     }
 }
-static void makeliteral_cc(strbuf *b, termchar *c, unsigned long *state)
+static void makeliteral_cc(strbuf *b, termchar *c, unsigned long *state
+                           RLE_TCT_PARAM)
 {
     /*
      * For combining characters, I just encode a bunch of ordinary
@@ -682,26 +902,30 @@ static void makeliteral_cc(strbuf *b, termchar *c, unsigned long *state)
         assert(c->chr != 0);
 
         zstate = 0;
-        makeliteral_chr(b, c, &zstate);
+        makeliteral_chr(b, c, &zstate RLE_TCT_ARG);
     }
 
     z.chr = 0;
     zstate = 0;
-    makeliteral_chr(b, &z, &zstate);
+    makeliteral_chr(b, &z, &zstate RLE_TCT_ARG);
 }
 
+#ifndef IS_QUTTY /* declared in terminal.h, for scrollback.c */
 typedef struct compressed_scrollback_line {
     size_t len;
     /* compressed data follows after this */
 } compressed_scrollback_line;
+#endif
 
 #ifdef IS_QUTTY
-termline *decompressline_no_free(compressed_scrollback_line *line);
+termline *decompressline_no_free(compressed_scrollback_line *line,
+                                 tctable *tct);
 #else
 static termline *decompressline_no_free(compressed_scrollback_line *line);
 #endif
 
-static compressed_scrollback_line *compressline_no_free(termline *ldata)
+static compressed_scrollback_line *compressline_no_free(termline *ldata
+                                                        RLE_TCT_PARAM)
 {
     strbuf *b = strbuf_new();
 
@@ -728,6 +952,11 @@ static compressed_scrollback_line *compressline_no_free(termline *ldata)
      */
     {
         int n = ldata->lattr | (ldata->trusted ? 0x10000 : 0);
+#ifdef IS_QUTTY
+        /* ... and another for its bidi flag */
+        if (ldata->bidi)
+            n |= 0x20000;
+#endif
         while (n >= 128) {
             put_byte(b, (unsigned char)((n & 0x7F) | 0x80));
             n >>= 7;
@@ -748,10 +977,10 @@ static compressed_scrollback_line *compressline_no_free(termline *ldata)
      *
      * The format of the `literals' varies between the fragments.
      */
-    makerle(b, ldata, makeliteral_chr);
-    makerle(b, ldata, makeliteral_attr);
-    makerle(b, ldata, makeliteral_truecolour);
-    makerle(b, ldata, makeliteral_cc);
+    makerle(b, ldata, makeliteral_chr RLE_TCT_ARG);
+    makerle(b, ldata, makeliteral_attr RLE_TCT_ARG);
+    makerle(b, ldata, makeliteral_truecolour RLE_TCT_ARG);
+    makerle(b, ldata, makeliteral_cc RLE_TCT_ARG);
 
     size_t linelen = b->len - sizeof(compressed_scrollback_line);
     compressed_scrollback_line *line =
@@ -777,7 +1006,7 @@ static compressed_scrollback_line *compressline_no_free(termline *ldata)
         printf("\n");
 #endif
 
-        dcl = decompressline_no_free(line);
+        dcl = decompressline_no_free(line RLE_TCT_ARG);
         assert(ldata->cols == dcl->cols);
         assert(ldata->lattr == dcl->lattr);
         for (i = 0; i < ldata->cols; i++)
@@ -797,16 +1026,20 @@ static compressed_scrollback_line *compressline_no_free(termline *ldata)
     return line;
 }
 
-static compressed_scrollback_line *compressline_and_free(termline *ldata)
+static compressed_scrollback_line *compressline_and_free(termline *ldata
+                                                         RLE_TCT_PARAM)
 {
-    compressed_scrollback_line *cline = compressline_no_free(ldata);
+    compressed_scrollback_line *cline =
+        compressline_no_free(ldata RLE_TCT_ARG);
     freetermline(ldata);
     return cline;
 }
 
 static void readrle(BinarySource *bs, termline *ldata,
                     void (*readliteral)(BinarySource *bs, termchar *c,
-                                        termline *ldata, unsigned long *state))
+                                        termline *ldata, unsigned long *state
+                                        RLE_TCT_PARAM)
+                    RLE_TCT_PARAM)
 {
     int n = 0;
     unsigned long state = 0;
@@ -821,7 +1054,7 @@ static void readrle(BinarySource *bs, termline *ldata,
             while (count--) {
                 assert(n < ldata->cols);
                 bs->pos = pos;
-                readliteral(bs, ldata->chars + n, ldata, &state);
+                readliteral(bs, ldata->chars + n, ldata, &state RLE_TCT_ARG);
                 n++;
             }
         } else {
@@ -830,7 +1063,7 @@ static void readrle(BinarySource *bs, termline *ldata,
             int count = hdr + 1;
             while (count--) {
                 assert(n < ldata->cols);
-                readliteral(bs, ldata->chars + n, ldata, &state);
+                readliteral(bs, ldata->chars + n, ldata, &state RLE_TCT_ARG);
                 n++;
             }
         }
@@ -839,7 +1072,7 @@ static void readrle(BinarySource *bs, termline *ldata,
     assert(n == ldata->cols);
 }
 static void readliteral_chr(BinarySource *bs, termchar *c, termline *ldata,
-                            unsigned long *state)
+                            unsigned long *state RLE_TCT_PARAM)
 {
     int byte;
 
@@ -871,7 +1104,7 @@ static void readliteral_chr(BinarySource *bs, termchar *c, termline *ldata,
     *state = c->chr & ~0xFF;
 }
 static void readliteral_attr(BinarySource *bs, termchar *c, termline *ldata,
-                             unsigned long *state)
+                             unsigned long *state RLE_TCT_PARAM)
 {
     unsigned val, attr, colourbits;
 
@@ -897,30 +1130,38 @@ static void readliteral_attr(BinarySource *bs, termchar *c, termline *ldata,
     c->attr = attr;
 }
 static void readliteral_truecolour(
-    BinarySource *bs, termchar *c, termline *ldata, unsigned long *state)
+    BinarySource *bs, termchar *c, termline *ldata, unsigned long *state
+    RLE_TCT_PARAM)
 {
     int flags = get_byte(bs);
+    truecolour tc;
 
     if (flags & 1) {
-        c->truecolour.fg.enabled = true;
-        c->truecolour.fg.r = get_byte(bs);
-        c->truecolour.fg.g = get_byte(bs);
-        c->truecolour.fg.b = get_byte(bs);
+        tc.fg.enabled = true;
+        tc.fg.r = get_byte(bs);
+        tc.fg.g = get_byte(bs);
+        tc.fg.b = get_byte(bs);
     } else {
-        c->truecolour.fg = optionalrgb_none;
+        tc.fg = optionalrgb_none;
     }
 
     if (flags & 2) {
-        c->truecolour.bg.enabled = true;
-        c->truecolour.bg.r = get_byte(bs);
-        c->truecolour.bg.g = get_byte(bs);
-        c->truecolour.bg.b = get_byte(bs);
+        tc.bg.enabled = true;
+        tc.bg.r = get_byte(bs);
+        tc.bg.g = get_byte(bs);
+        tc.bg.b = get_byte(bs);
     } else {
-        c->truecolour.bg = optionalrgb_none;
+        tc.bg = optionalrgb_none;
     }
+
+#ifdef IS_QUTTY
+    c->truecolour = tct ? tctable_intern(tct, tc) : 0;
+#else
+    c->truecolour = tc;
+#endif
 }
 static void readliteral_cc(BinarySource *bs, termchar *c, termline *ldata,
-                           unsigned long *state)
+                           unsigned long *state RLE_TCT_PARAM)
 {
     termchar n;
     unsigned long zstate;
@@ -930,7 +1171,7 @@ static void readliteral_cc(BinarySource *bs, termchar *c, termline *ldata,
 
     while (1) {
         zstate = 0;
-        readliteral_chr(bs, &n, ldata, &zstate);
+        readliteral_chr(bs, &n, ldata, &zstate RLE_TCT_ARG);
         if (!n.chr)
             break;
         add_cc(ldata, x, n.chr);
@@ -938,7 +1179,8 @@ static void readliteral_cc(BinarySource *bs, termchar *c, termline *ldata,
 }
 
 #ifdef IS_QUTTY
-termline *decompressline_no_free(compressed_scrollback_line *line)
+termline *decompressline_no_free(compressed_scrollback_line *line,
+                                 tctable *tct)
 #else
 static termline *decompressline_no_free(compressed_scrollback_line *line)
 #endif
@@ -991,14 +1233,17 @@ static termline *decompressline_no_free(compressed_scrollback_line *line)
     } while (byte & 0x80);
     ldata->lattr = lattr & 0xFFFF;
     ldata->trusted = (lattr & 0x10000) != 0;
+#ifdef IS_QUTTY
+    ldata->bidi = (lattr & 0x20000) != 0;
+#endif
 
     /*
      * Now we read in each of the RLE streams in turn.
      */
-    readrle(bs, ldata, readliteral_chr);
-    readrle(bs, ldata, readliteral_attr);
-    readrle(bs, ldata, readliteral_truecolour);
-    readrle(bs, ldata, readliteral_cc);
+    readrle(bs, ldata, readliteral_chr RLE_TCT_ARG);
+    readrle(bs, ldata, readliteral_attr RLE_TCT_ARG);
+    readrle(bs, ldata, readliteral_truecolour RLE_TCT_ARG);
+    readrle(bs, ldata, readliteral_cc RLE_TCT_ARG);
 
     /* And we always expect that we ended up exactly at the end of the
      * compressed data. */
@@ -1013,12 +1258,14 @@ static inline void free_compressed_line(compressed_scrollback_line *cline)
     sfree(cline);
 }
 
+#ifndef IS_QUTTY /* the scrollback store copies lines out of the store */
 static termline *decompressline_and_free(compressed_scrollback_line *cline)
 {
     termline *ldata = decompressline_no_free(cline);
     free_compressed_line(cline);
     return ldata;
 }
+#endif
 
 #else /* NO_SCROLLBACK_COMPRESSION */
 
@@ -1068,10 +1315,89 @@ static inline void free_compressed_line(compressed_scrollback_line *line)
 
 #endif /* NO_SCROLLBACK_COMPRESSION */
 
+#ifdef IS_QUTTY
+/*
+ * The text of a line as the find bar searches it: one byte per
+ * column, with the line drawing sets translated through the current
+ * unicode tables.
+ */
+static void line_search_text(const struct unicode_data *ucsdata,
+                             termline *line, strbuf *out)
+{
+    for (int i = 0; i < line->cols; i++) {
+        unsigned long tchar = line->chars[i].chr;
+        switch (tchar & CSET_MASK) {
+          case CSET_ASCII:
+            tchar = ucsdata->unitab_line[tchar & 0xFF];
+            break;
+          case CSET_LINEDRW:
+            tchar = ucsdata->unitab_xterm[tchar & 0xFF];
+            break;
+          case CSET_SCOACS:
+            tchar = ucsdata->unitab_scoacs[tchar & 0xFF];
+            break;
+        }
+        put_byte(out, tchar);
+    }
+}
+
+/*
+ * Append the search text of a row to 'out'. Rows count from the top
+ * of the scrollback, followed by the screen.
+ */
+void term_search_text(Terminal *term, int row, strbuf *out)
+{
+    int sblen = sbstore_count(term->scrollback);
+    if (row < sblen) {
+        sbline_search_text(term->ucsdata,
+                           sbstore_index(term->scrollback, row), out);
+    } else {
+        termline *line = index234(term->screen, row - sblen);
+        if (line)
+            line_search_text(term->ucsdata, line, out);
+    }
+}
+
+/*
+ * The same for a line still in its compressed form. This only reads
+ * 'ucsdata' and 'cline', so it is safe to use off the terminal's
+ * thread, e.g. on the lines of an sbsnapshot.
+ */
+void sbline_search_text(const struct unicode_data *ucsdata,
+                        compressed_scrollback_line *cline, strbuf *out)
+{
+    termline *line = decompressline_no_free(cline, NULL);
+    line_search_text(ucsdata, line, out);
+    freetermline(line);
+}
+
+/* Push a line into the scrollback, together with its search text. */
+static void scrollback_add(Terminal *term, termline *line)
+{
+    strbuf_clear(term->sbtext);
+    line_search_text(term->ucsdata, line, term->sbtext);
+    sbstore_add(term->scrollback, compressline_no_free(line, &term->tctable),
+                term->sbtext->s, term->sbtext->len);
+}
+#endif
+
 /*
  * Resize a line to make it `cols' columns wide.
  */
+#ifdef IS_QUTTY
+static void resizeline_erase(termline *line, int cols, const termchar *erase);
+
 static void resizeline(Terminal *term, termline *line, int cols)
+{
+    resizeline_erase(line, cols, &term->basic_erase_char);
+}
+
+/* The same, for use without a Terminal: new space is filled with
+ * 'erase'. */
+static void resizeline_erase(termline *line, int cols, const termchar *erase)
+#else
+static void resizeline(Terminal *term, termline *line, int cols)
+#endif
 {
     int i, oldcols;
 
@@ -1137,7 +1463,11 @@ static void resizeline(Terminal *term, termline *line, int cols)
          * _know_ the erase char doesn't have one.)
          */
         for (i = oldcols; i < cols; i++)
+#ifdef IS_QUTTY
+            line->chars[i] = *erase;
+#else
             line->chars[i] = term->basic_erase_char;
+#endif
 
 #ifdef TERM_CC_DIAGS
         cc_check(line);
@@ -1150,7 +1480,11 @@ static void resizeline(Terminal *term, termline *line, int cols)
  */
 static int sblines(Terminal *term)
 {
+#ifdef IS_QUTTY
+    int sblines = sbstore_count(term->scrollback);
+#else
     int sblines = count234(term->scrollback);
+#endif
     if (term->erase_to_scrollback &&
         term->alt_which && term->alt_screen) {
         sblines += term->alt_sblines;
@@ -1172,7 +1506,11 @@ static void null_line_error(Terminal *term, int y, int lineno,
                   "Please contact <putty@projects.tartarus.org> "
                   "and pass on the above information.",
                   varname, lineno, y, term->cols, term->rows,
+#ifdef IS_QUTTY
+                  term->scrollback, sbstore_count(term->scrollback),
+#else
                   term->scrollback, count234(term->scrollback),
+#endif
                   term->screen, count234(term->screen),
                   term->alt_screen, count234(term->alt_screen),
                   term->alt_sblines, whichtree, treeindex, commitid);
@@ -1207,19 +1545,35 @@ static termline *lineptr(Terminal *term, int y, int lineno)
             altlines = term->alt_sblines;
         }
         if (y < -altlines) {
+#ifdef IS_QUTTY
+            /* the scrollback is not a tree; see below */
+            whichtree = NULL;
+            treeindex = y + altlines + sbstore_count(term->scrollback);
+#else
             whichtree = term->scrollback;
             treeindex = y + altlines + count234(term->scrollback);
+#endif
         } else {
             whichtree = term->alt_screen;
             treeindex = y + term->alt_sblines;
             /* treeindex = y + count234(term->alt_screen); */
         }
     }
+#ifdef IS_QUTTY
+    if (!whichtree) {
+        compressed_scrollback_line *cline =
+            sbstore_index(term->scrollback, treeindex);
+#else
     if (whichtree == term->scrollback) {
         compressed_scrollback_line *cline = index234(whichtree, treeindex);
+#endif
         if (!cline)
             null_line_error(term, y, lineno, whichtree, treeindex, "cline");
+#ifdef IS_QUTTY
+        line = decompressline_no_free(cline, &term->tctable);
+#else
         line = decompressline_no_free(cline);
+#endif
     } else {
         line = index234(whichtree, treeindex);
     }
@@ -1252,6 +1606,31 @@ static termline *lineptr(Terminal *term, int y, int lineno)
     return line;
 }
 
+#ifdef IS_QUTTY
+/*
+ * Mark rows of the display as needing do_paint to look at them. Rows
+ * here are rows of disptext, not lines of the screen.
+ */
+static void mark_dirty_rows(Terminal *term, int top, int bot)
+{
+    if (top < 0)
+        top = 0;
+    if (bot >= term->dirty_nrows)
+        bot = term->dirty_nrows - 1;
+    for (int i = top; i <= bot; i++)
+        term->dirty_rows[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+/* Returns y, for use as a wrapper in scrlineptr. */
+static inline int dirty_screen_line(Terminal *term, int y)
+{
+    int i = y - term->disptop;
+    if (i < term->dirty_nrows)
+        term->dirty_rows[i / 64] |= (uint64_t)1 << (i % 64);
+    return y;
+}
+#endif
+
 /*
  * Macro wrappers for lineptr. The distinction between lineptr and
  * scrlineptr is that lineptr can retrieve any line, from the screen
@@ -1270,7 +1649,16 @@ static termline *lineptr(Terminal *term, int y, int lineno)
  * double-evaluating its argument.
  */
 #define lineptr(x) (lineptr)(term,x,__LINE__)
+#ifdef IS_QUTTY
+/*
+ * Every caller of scrlineptr may be about to change the line, so this
+ * is where term_out, erase_lots, insch and the rest mark their rows.
+ */
+#define scrlineptr(x) (lineptr)(term,dirty_screen_line(term, \
+                                checkscr(x,__LINE__)),__LINE__)
+#else
 #define scrlineptr(x) (lineptr)(term,checkscr(x,__LINE__),__LINE__)
+#endif
 #define unlineptr(line) term_release_line(line)
 
 /* Wrapper for external use (e.g. tests), without the __LINE__ parameter */
@@ -1333,19 +1721,31 @@ static void term_update_callback(void *ctx)
     Terminal *term = (Terminal *)ctx;
     if (!term->window_update_pending)
         return;
+#ifdef IS_QUTTY
+    /*
+     * The front end coalesces updates to the display's frame rate,
+     * so there is no cooldown to observe here.
+     */
+    win_schedule_update(term->win);
+#else
     if (!term->window_update_cooldown) {
         term_update(term);
         term->window_update_cooldown = true;
         term->window_update_cooldown_end = schedule_timer(
             UPDATE_DELAY, term_timer, term);
     }
+#endif
 }
 
 static void term_schedule_update(Terminal *term)
 {
     if (!term->window_update_pending) {
         term->window_update_pending = true;
+#ifdef IS_QUTTY
+        term_update_callback(term);
+#else
         queue_toplevel_callback(term_update_callback, term);
+#endif
     }
 }
 
@@ -1627,7 +2027,12 @@ static void set_erase_char(Terminal *term)
     if (term->use_bce) {
         term->erase_char.attr = (term->curr_attr &
                                  (ATTR_FGMASK | ATTR_BGMASK));
+#ifdef IS_QUTTY
+        truecolour tc = { optionalrgb_none, term->curr_truecolour.bg };
+        term->erase_char.truecolour = TC_INTERN(term, tc);
+#else
         term->erase_char.truecolour.bg = term->curr_truecolour.bg;
+#endif
     }
 }
 
@@ -1673,6 +2078,9 @@ static void term_copy_stuff_from_conf(Terminal *term)
     term->no_remote_wintitle = conf_get_bool(term->conf, CONF_no_remote_wintitle);
     term->no_remote_clearscroll = conf_get_bool(term->conf, CONF_no_remote_clearscroll);
     term->rawcnp = conf_get_bool(term->conf, CONF_rawcnp);
+#ifdef IS_QUTTY
+    term->rtf_paste = conf_get_bool(term->conf, CONF_rtf_paste);
+#endif
     term->utf8linedraw = conf_get_bool(term->conf, CONF_utf8linedraw);
     term->rect_select = conf_get_bool(term->conf, CONF_rect_select);
     term->remote_qtitle_action = conf_get_int(term->conf, CONF_remote_qtitle_action);
@@ -1841,6 +2249,10 @@ void term_reconfig(Terminal *term, Conf *conf)
     term_schedule_cblink(term);
     term_copy_stuff_from_conf(term);
     term_update_raw_mouse_mode(term);
+#ifdef IS_QUTTY
+    /* colour modes, bidi, shaping and more all change the display */
+    term->dirty_all = true;
+#endif
 }
 
 /*
@@ -1848,7 +2260,9 @@ void term_reconfig(Terminal *term, Conf *conf)
  */
 void term_clrsb(Terminal *term)
 {
+#ifndef IS_QUTTY
     unsigned char *line;
+#endif
     int i;
 
     /*
@@ -1860,9 +2274,13 @@ void term_clrsb(Terminal *term)
     /*
      * Clear the actual scrollback.
      */
+#ifdef IS_QUTTY
+    sbstore_clear(term->scrollback);
+#else
     while ((line = delpos234(term->scrollback, 0)) != NULL) {
         sfree(line);            /* this is compressed data, not a termline */
     }
+#endif
 
     /*
      * When clearing the scrollback, we also truncate any termlines on
@@ -2071,10 +2489,19 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata, TermWin *win)
     term->termstate = TOPLEVEL;
     term->selstate = NO_SELECTION;
     term->answerback = strbuf_new();
+#ifdef IS_QUTTY
+    tctable_init(&term->tctable);
+#endif
 
     term_copy_stuff_from_conf(term);
 
     term->dispcursx = term->dispcursy = -1;
+#ifdef IS_QUTTY
+    term->dirty_rows = NULL;
+    term->dirty_nrows = 0;
+    term->dirty_all = true;
+    memset(&term->painted, 0, sizeof(term->painted));
+#endif
     deselect(term);
     term->rows = term->cols = -1;
     power_on(term, true);
@@ -2083,8 +2510,12 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata, TermWin *win)
     /* FULL-TERMCHAR */
     term->basic_erase_char.chr = CSET_ASCII | ' ';
     term->basic_erase_char.attr = ATTR_DEFAULT;
+#ifdef IS_QUTTY
+    term->basic_erase_char.truecolour = 0;
+#else
     term->basic_erase_char.truecolour.fg = optionalrgb_none;
     term->basic_erase_char.truecolour.bg = optionalrgb_none;
+#endif
     term->erase_char = term->basic_erase_char;
 
     /* TermWin implementations will typically extend these with
@@ -2110,14 +2541,21 @@ Terminal *term_init(Conf *myconf, struct unicode_data *ucsdata, TermWin *win)
 
 void term_free(Terminal *term)
 {
+#ifndef IS_QUTTY
     compressed_scrollback_line *cline;
+#endif
     termline *line;
     struct beeptime *beep;
     int i;
 
+#ifdef IS_QUTTY
+    sbstore_free(term->scrollback);
+    strbuf_free(term->sbtext);
+#else
     while ((cline = delpos234(term->scrollback, 0)) != NULL)
         free_compressed_line(cline);
     freetree234(term->scrollback);
+#endif
     while ((line = delpos234(term->screen, 0)) != NULL)
         freetermline(line);
     freetree234(term->screen);
@@ -2129,6 +2567,14 @@ void term_free(Terminal *term)
             freetermline(term->disptext[i]);
     }
     sfree(term->disptext);
+#ifdef IS_QUTTY
+    sfree(term->dirty_rows);
+    discard_scrolls(term);
+    tctable_free(&term->tctable);
+    sfree(term->last_selected_text);
+    sfree(term->last_selected_attr);
+    sfree(term->last_selected_tc);
+#endif
     while (term->beephead) {
         beep = term->beephead;
         term->beephead = beep->next;
@@ -2215,7 +2661,12 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
     term->alt_b = term->marg_b = newrows - 1;
 
     if (term->rows == -1) {
+#ifdef IS_QUTTY
+        term->scrollback = sbstore_new();
+        term->sbtext = strbuf_new();
+#else
         term->scrollback = newtree234(NULL);
+#endif
         term->screen = newtree234(NULL);
         term->tempsblines = 0;
         term->rows = 0;
@@ -2252,7 +2703,11 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
      *    amount of scrollback we actually have, we must throw some
      *    away.
      */
+#ifdef IS_QUTTY
+    sblen = sbstore_count(term->scrollback);
+#else
     sblen = count234(term->scrollback);
+#endif
     /* Do this loop to expand the screen if newrows > rows */
     assert(term->rows == count234(term->screen));
     while (term->rows < newrows) {
@@ -2260,8 +2715,14 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
             compressed_scrollback_line *cline;
             /* Insert a line from the scrollback at the top of the screen. */
             assert(sblen >= term->tempsblines);
+#ifdef IS_QUTTY
+            cline = sbstore_index(term->scrollback, --sblen);
+            line = decompressline_no_free(cline, &term->tctable);
+            sbstore_dellast(term->scrollback);
+#else
             cline = delpos234(term->scrollback, --sblen);
             line = decompressline_and_free(cline);
+#endif
             line->temporary = false;   /* reconstituted line is now real */
             term->tempsblines -= 1;
             addpos234(term->screen, line, 0);
@@ -2285,7 +2746,13 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
         } else {
             /* push top row to scrollback */
             line = delpos234(term->screen, 0);
+#ifdef IS_QUTTY
+            scrollback_add(term, line);
+            freetermline(line);
+            sblen++;
+#else
             addpos234(term->scrollback, compressline_and_free(line), sblen++);
+#endif
             term->tempsblines += 1;
             term->curs.y -= 1;
             term->savecurs.y -= 1;
@@ -2299,14 +2766,23 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
 
     /* Delete any excess lines from the scrollback. */
     while (sblen > newsavelines) {
+#ifdef IS_QUTTY
+        sbstore_delfirst(term->scrollback);
+#else
         line = delpos234(term->scrollback, 0);
         sfree(line);
+#endif
         sblen--;
     }
     if (sblen < term->tempsblines)
         term->tempsblines = sblen;
+#ifdef IS_QUTTY
+    assert(sbstore_count(term->scrollback) <= newsavelines);
+    assert(sbstore_count(term->scrollback) >= term->tempsblines);
+#else
     assert(count234(term->scrollback) <= newsavelines);
     assert(count234(term->scrollback) >= term->tempsblines);
+#endif
     term->disptop = 0;
 
     /* Make a new displayed text buffer. */
@@ -2323,6 +2799,14 @@ void term_size(Terminal *term, int newrows, int newcols, int newsavelines)
     sfree(term->disptext);
     term->disptext = newdisp;
     term->dispcursx = term->dispcursy = -1;
+#ifdef IS_QUTTY
+    discard_scrolls(term);
+    sfree(term->dirty_rows);
+    term->dirty_rows = snewn((newrows + 63) / 64, uint64_t);
+    memset(term->dirty_rows, 0, (newrows + 63) / 64 * sizeof(uint64_t));
+    term->dirty_nrows = newrows;
+    term->dirty_all = true;
+#endif
 
     /* Make a new alternate screen. */
     newalt = newtree234(NULL);
@@ -2463,6 +2947,9 @@ static void swap_screen(Terminal *term, int which,
         ttr = term->alt_screen;
         term->alt_screen = term->screen;
         term->screen = ttr;
+#ifdef IS_QUTTY
+        term->dirty_all = true;
+#endif
         term->alt_sblines = (
             term->alt_screen ?
             find_last_nonempty_line(term, term->alt_screen) + 1 : 0);
@@ -2592,6 +3079,9 @@ static void clear_line(Terminal *term, termline *line)
     for (int i = 0; i < term->cols; i++)
         copy_termchar(line, i, &term->erase_char);
     line->lattr = LATTR_NORM;
+#ifdef IS_QUTTY
+    line->bidi = false;
+#endif
 }
 
 static void check_trust_status(Terminal *term, termline *line)
@@ -2608,6 +3098,62 @@ static void check_trust_status(Terminal *term, termline *line)
     }
 }
 
+#ifdef IS_QUTTY
+/*
+ * Forget any scrolls not yet passed on to the front end. This is
+ * always safe: do_paint will then just find the affected lines
+ * changed and redraw them.
+ */
+static void discard_scrolls(Terminal *term)
+{
+    struct scrollregion *sr;
+
+    while ((sr = term->scrollhead) != NULL) {
+        term->scrollhead = sr->next;
+        sfree(sr);
+    }
+    term->scrolltail = NULL;
+    term->nscrolls = 0;
+}
+
+/*
+ * Remember a scroll of the live screen, so that do_paint can ask the
+ * front end to move the existing window contents. Consecutive scrolls
+ * of the same region (the common `tail -f' case) are merged.
+ */
+static void save_scroll(Terminal *term, int topline, int botline,
+                        int lines)
+{
+    struct scrollregion *sr = term->scrolltail;
+
+    if (sr && sr->topline == topline && sr->botline == botline) {
+        sr->lines += lines;
+        return;
+    }
+
+    /*
+     * Lots of interleaved scrolls of different regions are cheaper
+     * to just redraw than to replay one by one.
+     */
+    if (term->nscrolls >= term->rows) {
+        discard_scrolls(term);
+        return;
+    }
+
+    sr = snew(struct scrollregion);
+    sr->next = NULL;
+    sr->topline = topline;
+    sr->botline = botline;
+    sr->lines = lines;
+    if (term->scrolltail)
+        term->scrolltail->next = sr;
+    else
+        term->scrollhead = sr;
+    term->scrolltail = sr;
+    term->nscrolls++;
+}
+#endif
+
 /*
  * Scroll the screen. (`lines' is +ve for scrolling forward, -ve
  * for backward.) `sb' is true if the scrolling is permitted to
@@ -2618,12 +3164,29 @@ static void scroll(Terminal *term, int topline, int botline,
 {
     termline *line;
     int seltop, scrollwinsize;
+#ifdef IS_QUTTY
+    int shift;
+#endif
 
     if (topline != 0 || term->alt_which != 0)
         sb = false;
 
     scrollwinsize = botline - topline + 1;
 
+#ifdef IS_QUTTY
+    shift = lines;
+    if (shift > scrollwinsize)
+        shift = scrollwinsize;
+    else if (shift < -scrollwinsize)
+        shift = -scrollwinsize;
+
+    /* scrolled back, the whole view moves along with the scrollback */
+    if (term->disptop < 0)
+        term->dirty_all = true;
+    else
+        mark_dirty_rows(term, topline, botline);
+#endif
+
     if (lines < 0) {
         lines = -lines;
         if (lines > scrollwinsize)
@@ -2658,22 +3221,35 @@ static void scroll(Terminal *term, int topline, int botline,
             cc_check(line);
 #endif
             if (sb && term->savelines > 0) {
+#ifdef IS_QUTTY
+                int sblen = sbstore_count(term->scrollback);
+#else
                 int sblen = count234(term->scrollback);
+#endif
                 /*
                  * We must add this line to the scrollback. We'll
                  * remove a line from the top of the scrollback if
                  * the scrollback is full.
                  */
                 if (sblen == term->savelines) {
+#ifdef IS_QUTTY
+                    sblen--;
+                    sbstore_delfirst(term->scrollback);
+#else
                     compressed_scrollback_line *cline;
 
                     sblen--;
                     cline = delpos234(term->scrollback, 0);
                     free_compressed_line(cline);
+#endif
                 } else
                     term->tempsblines += 1;
 
+#ifdef IS_QUTTY
+                scrollback_add(term, line);
+#else
                 addpos234(term->scrollback, compressline_no_free(line), sblen);
+#endif
 
                 /* now `line' itself can be reused as the bottom line */
 
@@ -2746,6 +3322,16 @@ static void scroll(Terminal *term, int topline, int botline,
         }
     }
 
+#ifdef IS_QUTTY
+    /*
+     * Only worth passing on if the window is showing the live screen:
+     * otherwise either the view didn't move (disptop was adjusted
+     * above) or it is about to jump anyway.
+     */
+    if (shift != 0 && term->disptop == 0)
+        save_scroll(term, topline, botline, shift);
+#endif
+
     seen_disp_event(term);
 }
 
@@ -3408,7 +3994,10 @@ static void term_display_graphic_char(Terminal *term, unsigned long c)
         cline->chars[term->curs.x].chr = c;
         cline->chars[term->curs.x].attr = term->curr_attr;
         cline->chars[term->curs.x].truecolour =
-            term->curr_truecolour;
+            TC_INTERN(term, term->curr_truecolour);
+#ifdef IS_QUTTY
+        note_bidi_char(cline, c);
+#endif
 
         term->curs.x++;
 
@@ -3417,7 +4006,7 @@ static void term_display_graphic_char(Terminal *term, unsigned long c)
         cline->chars[term->curs.x].chr = UCSWIDE;
         cline->chars[term->curs.x].attr = term->curr_attr;
         cline->chars[term->curs.x].truecolour =
-            term->curr_truecolour;
+            TC_INTERN(term, term->curr_truecolour);
 
         break;
       case 1:
@@ -3429,7 +4018,10 @@ static void term_display_graphic_char(Terminal *term, unsigned long c)
         cline->chars[term->curs.x].chr = c;
         cline->chars[term->curs.x].attr = term->curr_attr;
         cline->chars[term->curs.x].truecolour =
-            term->curr_truecolour;
+            TC_INTERN(term, term->curr_truecolour);
+#ifdef IS_QUTTY
+        note_bidi_char(cline, c);
+#endif
 
         break;
       case 0:
@@ -3727,17 +4319,135 @@ unsigned long term_translate(
     return c;
 }
 
+#ifdef IS_QUTTY
 /*
- * Remove everything currently in `inbuf' and stick it up on the
- * in-memory display. There's a big state machine in here to
- * process escape sequences...
+ * Length of the run of printable ASCII (0x20 to 0x7E) that 'p'
+ * starts with. The vector loops only find the block that the run
+ * ends in; the byte loop finds where.
  */
-static void term_out(Terminal *term, bool called_from_term_data)
+static size_t printable_ascii_run(const unsigned char *p, size_t len)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    const __m256i space32 = _mm256_set1_epi8(0x20);
+    const __m256i del32 = _mm256_set1_epi8(0x7F);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        /* a signed compare puts 0x80-0xFF below the space too */
+        __m256i stop = _mm256_or_si256(_mm256_cmpgt_epi8(space32, v),
+                                       _mm256_cmpeq_epi8(v, del32));
+        if (_mm256_movemask_epi8(stop))
+            break;
+    }
+#endif
+#ifdef QUTTY_HAVE_SSE2
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i stop = _mm_or_si128(_mm_cmplt_epi8(v, space),
+                                    _mm_cmpeq_epi8(v, del));
+        if (_mm_movemask_epi8(stop))
+            break;
+    }
+#endif
+    while (i < len && p[i] >= 0x20 && p[i] < 0x7F)
+        i++;
+    return i;
+}
+
+/*
+ * Whether every printable ASCII byte comes out of term_translate() as
+ * itself in CSET_ASCII, one cell wide, when the G0/G1 set in use is
+ * plain ASCII. That is only a question for odd line codepages and
+ * fonts, but the answer can change with the configuration.
+ */
+static bool ascii_is_plain(Terminal *term)
+{
+    for (int c = 0x20; c < 0x7F; c++)
+        if (term->ucsdata->unitab_ctrl[c] != 0xFF ||
+            term_char_width(term, c | CSET_ASCII) != 1)
+            return false;
+    return true;
+}
+
+/*
+ * Put a run of printable ASCII straight into the cursor line, with
+ * the same result as passing it through term_display_graphic_char()
+ * a byte at a time, provided none of the special cases in there can
+ * come up: insert mode, a pending wrap, a selection to check, traffic
+ * to log, or charset translation. The run stops short of the last
+ * column, leaving wrapping to the byte-at-a-time path. Returns the
+ * number of bytes used, which may be none.
+ */
+static size_t term_display_ascii_run(Terminal *term,
+                                     const unsigned char *p, size_t len)
+{
+    if (term->termstate != TOPLEVEL || term->printing || term->insert ||
+        term->wrapnext || term->selstate != NO_SELECTION ||
+        term->sco_acs || term->cset_attr[term->cset] != CSET_ASCII ||
+        (in_utf(term) && term->utf8.state) ||
+        (term->logctx && (term->logtype == LGTYP_ASCII ||
+                          term->logtype == LGTYP_DEBUG)))
+        return 0;
+
+    size_t n = printable_ascii_run(p, len < term->cols ? len : term->cols);
+    if (n == 0)
+        return 0;
+
+    /*
+     * As in term_display_graphic_char: text from the other side of a
+     * trust boundary wipes the line first, so that nothing untrusted
+     * is shown next to the trust sigil.
+     */
+    termline *cline = scrlineptr(term->curs.y);
+    check_trust_status(term, cline);
+
+    int linecols = term->cols;
+    if (cline->trusted)
+        linecols -= TRUST_SIGIL_WIDTH;
+    if (term->curs.x >= linecols - 1)
+        return 0;
+    if (n > (size_t)(linecols - 1 - term->curs.x))
+        n = linecols - 1 - term->curs.x;
+
+    /* only the ends of the run can split a wide character */
+    int x = term->curs.x;
+    check_boundary(term, x, term->curs.y);
+    check_boundary(term, x + n, term->curs.y);
+
+    /* FULL-TERMCHAR */
+    tcindex tci = TC_INTERN(term, term->curr_truecolour);
+    for (size_t i = 0; i < n; i++) {
+        termchar *tc = &cline->chars[x + i];
+        if (tc->cc_next)
+            clear_cc(cline, x + i);
+        tc->chr = p[i] | CSET_ASCII;
+        tc->attr = term->curr_attr;
+        tc->truecolour = tci;
+    }
+
+    term->curs.x += n;
+    term->last_graphic_char = p[n - 1] | CSET_ASCII;
+    seen_disp_event(term);
+    return n;
+}
+#endif
+
+/*
+ * Remove everything currently in `inbuf' and stick it up on the
+ * in-memory display. There's a big state machine in here to
+ * process escape sequences...
+ */
+static void term_out(Terminal *term, bool called_from_term_data)
 {
     unsigned long c;
     int unget;
     const unsigned char *chars;
     size_t nchars_got = 0, nchars_used = 0;
+#ifdef IS_QUTTY
+    int plain_ascii = -1;              /* ascii_is_plain(), once needed */
+#endif
 
     /*
      * During drag-selects, we do not process terminal input, because
@@ -3801,6 +4511,19 @@ static void term_out(Terminal *term, bool called_from_term_data)
                 assert(chars != NULL);
                 assert(nchars_used < nchars_got);
             }
+#ifdef IS_QUTTY
+            if (chars[nchars_used] >= 0x20 && chars[nchars_used] < 0x7F &&
+                term->termstate == TOPLEVEL) {
+                if (plain_ascii < 0)
+                    plain_ascii = ascii_is_plain(term);
+                size_t n = plain_ascii ? term_display_ascii_run(
+                    term, chars + nchars_used, nchars_got - nchars_used) : 0;
+                if (n) {
+                    nchars_used += n;
+                    continue;
+                }
+            }
+#endif
             c = chars[nchars_used++];
 
             /*
@@ -4664,7 +5387,8 @@ static void term_out(Terminal *term, bool called_from_term_data)
                           case 0:       /* restore defaults */
                             term->curr_attr = term->default_attr;
                             term->curr_truecolour =
-                                term->basic_erase_char.truecolour;
+                                TC_VALUE(term,
+                                         term->basic_erase_char.truecolour);
                             break;
                           case 1:       /* enable bold */
                             compatibility(VT100AVO);
@@ -5803,6 +6527,9 @@ static void term_out(Terminal *term, bool called_from_term_data)
     term_print_flush(term);
     if (term->logflush && term->logctx)
         logflush(term->logctx);
+#ifdef IS_QUTTY
+    term_compact_tctable(term);
+#endif
 }
 
 /* Wrapper on term_out with the right prototype to be a toplevel callback */
@@ -5919,7 +6646,8 @@ static void term_bidi_cache_store(Terminal *term, int line, termchar *lbefore,
 /*
  * Prepare the bidi information for a screen line. Returns the
  * transformed list of termchars, or NULL if no transformation at
- * all took place (because bidi is disabled). If return was
+ * all took place (because bidi is disabled, or the line has nothing
+ * for it to do). If return was
  * non-NULL, auxiliary information such as the forward and reverse
  * mappings of permutation position are available in
  * term->post_bidi_cache[scr_y].*.
@@ -5931,8 +6659,15 @@ static termchar *term_bidi_line(Terminal *term, struct termline *ldata,
     int it;
 
     /* Do Arabic shaping and bidi. */
+#ifdef IS_QUTTY
+    /* A line that has never held an RTL character would come out as
+     * it went in, so only the trust sigil can make us do any work. */
+    if (((!term->no_bidi || !term->no_arabicshaping) && ldata->bidi) ||
+        (ldata->trusted && term->cols > TRUST_SIGIL_WIDTH)) {
+#else
     if (!term->no_bidi || !term->no_arabicshaping ||
         (ldata->trusted && term->cols > TRUST_SIGIL_WIDTH)) {
+#endif
 
         if (!term_bidi_cache_hit(term, scr_y, ldata->chars, term->cols,
                                  ldata->trusted)) {
@@ -6057,8 +6792,10 @@ static termchar *term_bidi_line(Terminal *term, struct termline *ldata,
 
 static void do_paint_draw(Terminal *term, termline *ldata, int x, int y,
                           wchar_t *ch, int ccount,
-                          unsigned long attr, truecolour tc)
+                          unsigned long attr, TCTYPE celltc)
 {
+    truecolour tc = TC_VALUE(term, celltc);
+
     if (ch[0] == TRUST_SIGIL_CHAR) {
         assert(ldata->trusted);
         assert(ccount == 1);
@@ -6066,7 +6803,8 @@ static void do_paint_draw(Terminal *term, termline *ldata, int x, int y,
         wchar_t tch[2];
         tch[0] = tch[1] = L' ';
         win_draw_text(term->win, x, y, tch, 2, term->basic_erase_char.attr,
-                      ldata->lattr, term->basic_erase_char.truecolour);
+                      ldata->lattr,
+                      TC_VALUE(term, term->basic_erase_char.truecolour));
         win_draw_trust_sigil(term->win, x, y);
     } else {
         if (ccount == 2 &&
@@ -6083,6 +6821,115 @@ static void do_paint_draw(Terminal *term, termline *ldata, int x, int y,
 /*
  * Given a context, update the window.
  */
+#ifdef IS_QUTTY
+/*
+ * Replay a scroll of the live screen on the displayed text, after
+ * asking the front end to do the same to the window contents. The
+ * lines that scroll into view are left invalid, so they are the
+ * only ones do_paint then has to draw.
+ */
+static void scroll_display(Terminal *term, int topline, int botline,
+                           int lines)
+{
+    termline **saved;
+    int distance, nlines, i, j, exp_top, exp_bot;
+
+    distance = lines > 0 ? lines : -lines;
+    nlines = botline - topline + 1 - distance;
+    if (distance == 0)
+        return;
+    if (nlines <= 0)
+        return;               /* nothing survives; just redraw it all */
+    if (!win_scroll(term->win, topline, botline, lines))
+        return;
+
+    saved = snewn(distance, termline *);
+    if (lines > 0) {
+        memcpy(saved, term->disptext + topline,
+               distance * sizeof(termline *));
+        memmove(term->disptext + topline,
+                term->disptext + topline + distance,
+                nlines * sizeof(termline *));
+        memcpy(term->disptext + topline + nlines, saved,
+               distance * sizeof(termline *));
+        exp_top = topline + nlines;
+        exp_bot = botline;
+
+        if (term->dispcursy >= topline + distance &&
+            term->dispcursy <= botline)
+            term->dispcursy -= distance;
+        else if (term->dispcursy >= topline && term->dispcursy <= botline)
+            term->dispcursx = term->dispcursy = -1;
+    } else {
+        memcpy(saved, term->disptext + topline + nlines,
+               distance * sizeof(termline *));
+        memmove(term->disptext + topline + distance,
+                term->disptext + topline,
+                nlines * sizeof(termline *));
+        memcpy(term->disptext + topline, saved,
+               distance * sizeof(termline *));
+        exp_top = topline;
+        exp_bot = topline + distance - 1;
+
+        if (term->dispcursy >= topline &&
+            term->dispcursy < topline + nlines)
+            term->dispcursy += distance;
+        else if (term->dispcursy >= topline && term->dispcursy <= botline)
+            term->dispcursx = term->dispcursy = -1;
+    }
+    sfree(saved);
+
+    for (i = exp_top; i <= exp_bot; i++)
+        for (j = 0; j < term->cols; j++)
+            term->disptext[i]->chars[j].attr |= ATTR_INVALID;
+    mark_dirty_rows(term, exp_top, exp_bot);
+}
+
+static void dirty_selection(Terminal *term, int selstate, pos start, pos end)
+{
+    if (selstate == DRAGGING || selstate == SELECTED)
+        mark_dirty_rows(term, start.y - term->disptop, end.y - term->disptop);
+}
+
+/*
+ * Mark what do_paint needs to look at because of changes that don't
+ * belong to any one line of the screen.
+ */
+static void dirty_paint_state(Terminal *term, int rv)
+{
+    bool tblink = term->blink_is_real && term->has_focus && term->tblinker;
+
+    if (term->painted.disptop != term->disptop ||
+        term->painted.rv != rv ||
+        term->painted.tblink != tblink ||
+        term->painted.ansi_colour != term->ansi_colour ||
+        term->painted.xterm_256_colour != term->xterm_256_colour ||
+        term->painted.true_colour != term->true_colour)
+        term->dirty_all = true;
+
+    if (term->painted.selstate != term->selstate ||
+        term->painted.seltype != term->seltype ||
+        !poseq(term->painted.selstart, term->selstart) ||
+        !poseq(term->painted.selend, term->selend)) {
+        dirty_selection(term, term->painted.selstate,
+                        term->painted.selstart, term->painted.selend);
+        dirty_selection(term, term->selstate,
+                        term->selstart, term->selend);
+    }
+
+    term->painted.disptop = term->disptop;
+    term->painted.rv = rv;
+    term->painted.tblink = tblink;
+    term->painted.ansi_colour = term->ansi_colour;
+    term->painted.xterm_256_colour = term->xterm_256_colour;
+    term->painted.true_colour = term->true_colour;
+    term->painted.selstate = term->selstate;
+    term->painted.seltype = term->seltype;
+    term->painted.selstart = term->selstart;
+    term->painted.selend = term->selend;
+}
+#endif
+
 static void do_paint(Terminal *term)
 {
     int i, j, our_curs_y, our_curs_x;
@@ -6106,6 +6953,17 @@ static void do_paint(Terminal *term)
      * curs.y, curs.x, cblinker, blink_cur, cursor_on, has_focus, wrapnext
      */
 
+#ifdef IS_QUTTY
+    {
+        struct scrollregion *sr;
+
+        for (sr = term->scrollhead; sr; sr = sr->next)
+            scroll_display(term, sr->topline, sr->botline, sr->lines);
+        discard_scrolls(term);
+    }
+    dirty_paint_state(term, rv);
+#endif
+
     /* Has the cursor position or type changed ? */
     if (term->cursor_on) {
         if (term->has_focus) {
@@ -6166,8 +7024,15 @@ static void do_paint(Terminal *term)
         dispcurs->attr |= ATTR_INVALID;
 
         term->curstype = 0;
+#ifdef IS_QUTTY
+        mark_dirty_rows(term, term->dispcursy, term->dispcursy);
+#endif
     }
     term->dispcursx = term->dispcursy = -1;
+#ifdef IS_QUTTY
+    /* the cursor row is always looked at, to find the cursor again */
+    mark_dirty_rows(term, our_curs_y, our_curs_y);
+#endif
 
     /* The normal screen data */
     for (i = 0; i < term->rows; i++) {
@@ -6181,7 +7046,13 @@ static void do_paint(Terminal *term)
         int laststart;
         bool dirtyrect;
         int *backward;
-        truecolour tc;
+        TCTYPE tc;
+
+#ifdef IS_QUTTY
+        if (!term->dirty_all &&
+            !(term->dirty_rows[i / 64] & ((uint64_t)1 << (i % 64))))
+            continue;
+#endif
 
         scrpos.y = i + term->disptop;
         ldata = lineptr(scrpos.y);
@@ -6224,7 +7095,11 @@ static void do_paint(Terminal *term)
             if (term->true_colour) {
                 tc = d->truecolour;
             } else {
+#ifdef IS_QUTTY
+                tc = 0;
+#else
                 tc.fg = tc.bg = optionalrgb_none;
+#endif
             }
 
             switch (tchar & CSET_MASK) {
@@ -6350,7 +7225,7 @@ static void do_paint(Terminal *term)
 
             break_run = ((tattr ^ attr) & term->attr_mask) != 0;
 
-            if (!truecolour_equal(newline[j].truecolour, tc))
+            if (!tc_equal(newline[j].truecolour, tc))
                 break_run = true;
 
 #ifdef USES_VTLINE_HACK
@@ -6409,8 +7284,7 @@ static void do_paint(Terminal *term)
             if (!term->ucsdata->dbcs_screenfont && !dirty_line) {
                 if (term->disptext[i]->chars[j].chr == tchar &&
                     (term->disptext[i]->chars[j].attr &~ DATTR_MASK)==tattr &&
-                    truecolour_equal(
-                        term->disptext[i]->chars[j].truecolour, tc))
+                    tc_equal(term->disptext[i]->chars[j].truecolour, tc))
                     break_run = true;
                 else if (!dirty_run && ccount == 1)
                     break_run = true;
@@ -6553,9 +7427,18 @@ static void do_paint(Terminal *term)
 
         unlineptr(ldata);
     }
+#ifdef IS_QUTTY
+    if (term->dirty_rows)
+        memset(term->dirty_rows, 0,
+               (term->dirty_nrows + 63) / 64 * sizeof(uint64_t));
+    term->dirty_all = false;
+#endif
 
     sfree(newline);
     sfree(ch);
+#ifdef IS_QUTTY
+    term_compact_tctable(term);        /* scrolled-back lines may add some */
+#endif
 }
 
 /*
@@ -6568,6 +7451,9 @@ void term_invalidate(Terminal *term)
     for (i = 0; i < term->rows; i++)
         for (j = 0; j < term->cols; j++)
             term->disptext[i]->chars[j].attr |= ATTR_INVALID;
+#ifdef IS_QUTTY
+    term->dirty_all = true;
+#endif
 
     term_schedule_update(term);
 }
@@ -6584,6 +7470,9 @@ void term_paint(Terminal *term,
     if (right >= term->cols) right = term->cols-1;
     if (bottom >= term->rows) bottom = term->rows-1;
 
+#ifdef IS_QUTTY
+    mark_dirty_rows(term, top, bottom);
+#endif
     for (i = top; i <= bottom && i < term->rows; i++) {
         if ((term->disptext[i]->lattr & LATTR_MODE) == LATTR_NORM)
             for (j = left; j <= right && j < term->cols; j++)
@@ -6661,6 +7550,17 @@ typedef struct {
 
 static void clip_addchar(clip_workbuf *b, wchar_t chr, int attr, truecolour tc)
 {
+#ifdef IS_QUTTY
+    if (!b->attrbuf) {                 /* plain text only */
+        if (b->bufpos >= b->bufsize) {
+            sgrowarray(b->textbuf, b->bufsize, b->bufpos);
+            b->textptr = b->textbuf + b->bufpos;
+        }
+        *b->textptr++ = chr;
+        b->bufpos++;
+        return;
+    }
+#endif
     if (b->bufpos >= b->bufsize) {
         sgrowarray(b->textbuf, b->bufsize, b->bufpos);
         b->textptr = b->textbuf + b->bufpos;
@@ -6675,170 +7575,461 @@ static void clip_addchar(clip_workbuf *b, wchar_t chr, int attr, truecolour tc)
     b->bufpos++;
 }
 
-static void clipme(Terminal *term, pos top, pos bottom, bool rect, bool desel,
-                   const int *clipboards, int n_clipboards)
+/*
+ * What clipme() needs to know, besides the lines themselves, to turn
+ * lines into clipboard text: the terminal's settings, or a copy of
+ * them that outlives the terminal's lines (see termclip below).
+ */
+typedef struct {
+    const struct unicode_data *ucsdata;
+    bool rawcnp;
+    int cols;
+    bool rect;
+    int old_top_x;                     /* needed for rect==1 */
+    truecolour erase_tc;               /* the colour of copied newlines */
+#ifdef IS_QUTTY
+    tctable *tct;                      /* NULL if only text is wanted */
+#endif
+} clip_source;
+
+/*
+ * Copy the part of one line between *top and bottom, and move *top
+ * on to the start of the next line.
+ */
+static void clip_addline(clip_workbuf *buf, const clip_source *src,
+                         termline *ldata, pos *top, pos bottom)
 {
-    clip_workbuf buf;
-    int old_top_x;
+    bool nl = false;
+    pos nlpos;
     int attr;
     truecolour tc;
 
-    buf.bufsize = 5120;
-    buf.bufpos = 0;
-    buf.textptr = buf.textbuf = snewn(buf.bufsize, wchar_t);
-    buf.attrptr = buf.attrbuf = snewn(buf.bufsize, int);
-    buf.tcptr = buf.tcbuf = snewn(buf.bufsize, truecolour);
-
-    old_top_x = top.x;                 /* needed for rect==1 */
-
-    while (poslt(top, bottom)) {
-        bool nl = false;
-        termline *ldata = lineptr(top.y);
-        pos nlpos;
-
-        /*
-         * nlpos will point at the maximum position on this line we
-         * should copy up to. So we start it at the end of the
-         * line...
-         */
-        nlpos.y = top.y;
-        nlpos.x = term->cols;
+    /*
+     * nlpos will point at the maximum position on this line we
+     * should copy up to. So we start it at the end of the
+     * line...
+     */
+    nlpos.y = top->y;
+    nlpos.x = src->cols;
 
-        /*
-         * ... move it backwards if there's unused space at the end
-         * of the line (and also set `nl' if this is the case,
-         * because in normal selection mode this means we need a
-         * newline at the end)...
-         */
-        if (!(ldata->lattr & LATTR_WRAPPED)) {
-            while (nlpos.x &&
-                   IS_SPACE_CHR(ldata->chars[nlpos.x - 1].chr) &&
-                   !ldata->chars[nlpos.x - 1].cc_next &&
-                   poslt(top, nlpos))
-                decpos(nlpos);
-            if (poslt(nlpos, bottom))
-                nl = true;
-        } else {
-            if (ldata->trusted) {
-                /* A wrapped line with a trust sigil on it terminates
-                 * a few characters earlier. */
-                nlpos.x = (nlpos.x < TRUST_SIGIL_WIDTH ? 0 :
-                           nlpos.x - TRUST_SIGIL_WIDTH);
-            }
-            if (ldata->lattr & LATTR_WRAPPED2) {
-                /* Ignore the last char on the line in a WRAPPED2 line. */
-                decpos(nlpos);
-            }
+    /*
+     * ... move it backwards if there's unused space at the end
+     * of the line (and also set `nl' if this is the case,
+     * because in normal selection mode this means we need a
+     * newline at the end)...
+     */
+    if (!(ldata->lattr & LATTR_WRAPPED)) {
+        while (nlpos.x &&
+               IS_SPACE_CHR(ldata->chars[nlpos.x - 1].chr) &&
+               !ldata->chars[nlpos.x - 1].cc_next &&
+               poslt(*top, nlpos))
+            decpos_fn(&nlpos, src->cols);
+        if (poslt(nlpos, bottom))
+            nl = true;
+    } else {
+        if (ldata->trusted) {
+            /* A wrapped line with a trust sigil on it terminates
+             * a few characters earlier. */
+            nlpos.x = (nlpos.x < TRUST_SIGIL_WIDTH ? 0 :
+                       nlpos.x - TRUST_SIGIL_WIDTH);
         }
-
-        /*
-         * ... and then clip it to the terminal x coordinate if
-         * we're doing rectangular selection. (In this case we
-         * still did the above, so that copying e.g. the right-hand
-         * column from a table doesn't fill with spaces on the
-         * right.)
-         */
-        if (rect) {
-            if (nlpos.x > bottom.x)
-                nlpos.x = bottom.x;
-            nl = (top.y < bottom.y);
+        if (ldata->lattr & LATTR_WRAPPED2) {
+            /* Ignore the last char on the line in a WRAPPED2 line. */
+            decpos_fn(&nlpos, src->cols);
         }
+    }
 
-        while (poslt(top, bottom) && poslt(top, nlpos)) {
-            wchar_t cbuf[16], *p;
-            int c;
-            int x = top.x;
+    /*
+     * ... and then clip it to the terminal x coordinate if
+     * we're doing rectangular selection. (In this case we
+     * still did the above, so that copying e.g. the right-hand
+     * column from a table doesn't fill with spaces on the
+     * right.)
+     */
+    if (src->rect) {
+        if (nlpos.x > bottom.x)
+            nlpos.x = bottom.x;
+        nl = (top->y < bottom.y);
+    }
 
-            if (ldata->chars[x].chr == UCSWIDE) {
-                top.x++;
-                continue;
-            }
+    while (poslt(*top, bottom) && poslt(*top, nlpos)) {
+        wchar_t cbuf[16], *p;
+        int c;
+        int x = top->x;
 
-            while (1) {
-                int uc = ldata->chars[x].chr;
-                attr = ldata->chars[x].attr;
-                tc = ldata->chars[x].truecolour;
+        if (ldata->chars[x].chr == UCSWIDE) {
+            top->x++;
+            continue;
+        }
 
-                switch (uc & CSET_MASK) {
-                  case CSET_LINEDRW:
-                    if (!term->rawcnp) {
-                        uc = term->ucsdata->unitab_xterm[uc & 0xFF];
-                        break;
-                    }
-                  case CSET_ASCII:
-                    uc = term->ucsdata->unitab_line[uc & 0xFF];
-                    break;
-                  case CSET_SCOACS:
-                    uc = term->ucsdata->unitab_scoacs[uc&0xFF];
-                    break;
-                }
-                switch (uc & CSET_MASK) {
-                  case CSET_ACP:
-                    uc = term->ucsdata->unitab_font[uc & 0xFF];
-                    break;
-                  case CSET_OEMCP:
-                    uc = term->ucsdata->unitab_oemcp[uc & 0xFF];
+        while (1) {
+            int uc = ldata->chars[x].chr;
+            attr = ldata->chars[x].attr;
+#ifdef IS_QUTTY
+            tc = src->tct ? src->tct->colours[ldata->chars[x].truecolour] :
+                src->erase_tc;
+#else
+            tc = ldata->chars[x].truecolour;
+#endif
+
+            switch (uc & CSET_MASK) {
+              case CSET_LINEDRW:
+                if (!src->rawcnp) {
+                    uc = src->ucsdata->unitab_xterm[uc & 0xFF];
                     break;
                 }
+              case CSET_ASCII:
+                uc = src->ucsdata->unitab_line[uc & 0xFF];
+                break;
+              case CSET_SCOACS:
+                uc = src->ucsdata->unitab_scoacs[uc&0xFF];
+                break;
+            }
+            switch (uc & CSET_MASK) {
+              case CSET_ACP:
+                uc = src->ucsdata->unitab_font[uc & 0xFF];
+                break;
+              case CSET_OEMCP:
+                uc = src->ucsdata->unitab_oemcp[uc & 0xFF];
+                break;
+            }
 
-                c = (uc & ~CSET_MASK);
+            c = (uc & ~CSET_MASK);
 #ifdef PLATFORM_IS_UTF16
-                if (uc > 0x10000 && uc < 0x110000) {
-                    cbuf[0] = 0xD800 | ((uc - 0x10000) >> 10);
-                    cbuf[1] = 0xDC00 | ((uc - 0x10000) & 0x3FF);
-                    cbuf[2] = 0;
-                } else
+            if (uc > 0x10000 && uc < 0x110000) {
+                cbuf[0] = 0xD800 | ((uc - 0x10000) >> 10);
+                cbuf[1] = 0xDC00 | ((uc - 0x10000) & 0x3FF);
+                cbuf[2] = 0;
+            } else
 #endif
-                {
-                    cbuf[0] = uc;
-                    cbuf[1] = 0;
-                }
-
-                if (DIRECT_FONT(uc)) {
-                    if (c >= ' ' && c != 0x7F) {
-                        char buf[2];
-                        buffer_sink bs[1];
-                        buffer_sink_init(bs, cbuf,
-                                         sizeof(cbuf) - sizeof(wchar_t));
-                        if (is_dbcs_leadbyte(term->ucsdata->font_codepage, (BYTE) c)) {
-                            buf[0] = c;
-                            buf[1] = (char) (0xFF & ldata->chars[top.x + 1].chr);
-                            put_mb_to_wc(bs, term->ucsdata->font_codepage,
-                                         buf, 2);
-                            top.x++;
-                        } else {
-                            buf[0] = c;
-                            put_mb_to_wc(bs, term->ucsdata->font_codepage,
-                                         buf, 1);
-                        }
+            {
+                cbuf[0] = uc;
+                cbuf[1] = 0;
+            }
 
-                        assert(!bs->overflowed);
-                        *(wchar_t *)bs->out = L'\0';
+            if (DIRECT_FONT(uc)) {
+                if (c >= ' ' && c != 0x7F) {
+                    char buf[2];
+                    buffer_sink bs[1];
+                    buffer_sink_init(bs, cbuf,
+                                     sizeof(cbuf) - sizeof(wchar_t));
+                    if (is_dbcs_leadbyte(src->ucsdata->font_codepage,
+                                         (BYTE) c)) {
+                        buf[0] = c;
+                        buf[1] = (char) (0xFF & ldata->chars[top->x + 1].chr);
+                        put_mb_to_wc(bs, src->ucsdata->font_codepage,
+                                     buf, 2);
+                        top->x++;
+                    } else {
+                        buf[0] = c;
+                        put_mb_to_wc(bs, src->ucsdata->font_codepage,
+                                     buf, 1);
                     }
+
+                    assert(!bs->overflowed);
+                    *(wchar_t *)bs->out = L'\0';
                 }
+            }
 
-                for (p = cbuf; *p; p++)
-                    clip_addchar(&buf, *p, attr, tc);
+            for (p = cbuf; *p; p++)
+                clip_addchar(buf, *p, attr, tc);
 
-                if (ldata->chars[x].cc_next)
-                    x += ldata->chars[x].cc_next;
-                else
-                    break;
-            }
-            top.x++;
+            if (ldata->chars[x].cc_next)
+                x += ldata->chars[x].cc_next;
+            else
+                break;
         }
-        if (nl) {
-            int i;
-            for (i = 0; i < sel_nl_sz; i++)
-                clip_addchar(&buf, sel_nl[i], 0, term->basic_erase_char.truecolour);
+        top->x++;
+    }
+    if (nl) {
+        int i;
+        for (i = 0; i < sel_nl_sz; i++)
+            clip_addchar(buf, sel_nl[i], 0, src->erase_tc);
+    }
+    top->y++;
+    top->x = src->rect ? src->old_top_x : 0;
+}
+
+#ifdef IS_QUTTY
+/*
+ * A selection of more than CLIP_STREAM_ROWS rows, going as plain text
+ * to the local clipboard and at most one other, is handed to the front
+ * end as a termclip (see clip_write_stream in TermWin) to be turned
+ * into text away from the terminal. A termclip holds a snapshot of the
+ * scrollback blocks in the selection and copies of the selected screen
+ * lines, so it doesn't mind what the terminal does in the meantime.
+ * If the local clipboard is one of the targets, the termclip keeps the
+ * text for it too, and term_clip_stream_done() puts it there.
+ */
+#define CLIP_STREAM_ROWS 4096
+
+struct termclip {
+    clip_source src;
+    struct unicode_data ucsdata;       /* src.ucsdata points here */
+    termchar erase;                    /* to widen short lines with */
+    /* Rows count from the top of the scrollback, then the screen. */
+    pos top, bottom;
+    int sblen;
+    sbsnapshot *ss;                    /* blocks overlapping the selection */
+    compressed_scrollback_line **screen;  /* rows sblen onwards */
+    int nscreen;
+    int lost;                          /* lines that couldn't be read */
+    bool local;                        /* for CLIP_LOCAL as well */
+    wchar_t *localtext;
+    size_t locallen, localsize;
+};
+
+static termclip *termclip_new(Terminal *term, pos top, pos bottom,
+                              bool rect)
+{
+    termclip *clip = snew(termclip);
+    clip->ucsdata = *term->ucsdata;
+    clip->src.ucsdata = &clip->ucsdata;
+    clip->src.rawcnp = term->rawcnp;
+    clip->src.cols = term->cols;
+    clip->src.rect = rect;
+    clip->src.old_top_x = top.x;
+    clip->src.erase_tc = TC_VALUE(term, term->basic_erase_char.truecolour);
+    clip->src.tct = NULL;
+    clip->erase = term->basic_erase_char;
+    clip->lost = 0;
+    clip->local = false;
+    clip->localtext = NULL;
+    clip->locallen = clip->localsize = 0;
+
+    clip->sblen = sbstore_count(term->scrollback);
+    clip->top = top;
+    clip->top.y += clip->sblen;
+    clip->bottom = bottom;
+    clip->bottom.y += clip->sblen;
+
+    clip->ss = sbstore_snapshot_lines(term->scrollback, clip->top.y,
+                                      clip->bottom.y);
+
+    /* bottom is exclusive, so its row only counts if it has a column */
+    int y0 = top.y < 0 ? 0 : top.y;
+    int y1 = bottom.x > 0 ? bottom.y : bottom.y - 1;
+    if (y1 >= term->rows)
+        y1 = term->rows - 1;
+    clip->nscreen = y1 >= y0 ? y1 - y0 + 1 : 0;
+    clip->screen = snewn(clip->nscreen + 1, compressed_scrollback_line *);
+    for (int i = 0; i < clip->nscreen; i++) {
+        termline *line = lineptr(y0 + i);
+        clip->screen[i] = compressline_no_free(line, &term->tctable);
+        unlineptr(line);
+    }
+    return clip;
+}
+
+/* Copy one row of a termclip, if it is in the selection. */
+static void termclip_addrow(termclip *clip, clip_workbuf *buf, int row,
+                            compressed_scrollback_line *cline)
+{
+    pos p;
+
+    if (row < clip->top.y || row > clip->bottom.y)
+        return;
+    p.y = row;
+    p.x = (row == clip->top.y || clip->src.rect) ? clip->top.x : 0;
+    if (!poslt(p, clip->bottom))
+        return;
+
+    termline *line = decompressline_no_free(cline, NULL);
+    if (line->cols < clip->src.cols)   /* as lineptr() would */
+        resizeline_erase(line, clip->src.cols, &clip->erase);
+    clip_addline(buf, &clip->src, line, &p, clip->bottom);
+    freetermline(line);
+}
+
+struct termclip_scan {
+    termclip *clip;
+    clip_workbuf *buf;
+};
+
+static void termclip_scanline(void *vctx, int index,
+                              compressed_scrollback_line *cline)
+{
+    struct termclip_scan *ctx = (struct termclip_scan *)vctx;
+    termclip_addrow(ctx->clip, ctx->buf, index, cline);
+}
+
+/*
+ * The copy is done in steps, each of which passes its text to 'emit'
+ * in one piece: one per block of scrollback in the selection, then
+ * one for the screen. Steps have to be run in order, but not on the
+ * terminal's thread.
+ */
+size_t termclip_steps(termclip *clip)
+{
+    return sbsnapshot_blocks(clip->ss) + (clip->nscreen ? 1 : 0);
+}
+
+void termclip_step(termclip *clip, size_t step,
+                   void (*emit)(void *ctx, const wchar_t *text, size_t len),
+                   void *ctx)
+{
+    clip_workbuf buf;
+
+    buf.bufsize = 5120;
+    buf.bufpos = 0;
+    buf.textptr = buf.textbuf = snewn(buf.bufsize, wchar_t);
+    buf.attrptr = buf.attrbuf = NULL;
+    buf.tcptr = buf.tcbuf = NULL;
+
+    if (step < sbsnapshot_blocks(clip->ss)) {
+        struct termclip_scan scan = { clip, &buf };
+        if (!sbsnapshot_lines(clip->ss, step, termclip_scanline, &scan)) {
+            int first, nlines;
+            sbsnapshot_range(clip->ss, step, &first, &nlines);
+            clip->lost += nlines;
+        }
+    } else {
+        int y0 = clip->top.y < clip->sblen ? clip->sblen : clip->top.y;
+        for (int i = 0; i < clip->nscreen; i++)
+            termclip_addrow(clip, &buf, y0 + i, clip->screen[i]);
+    }
+
+    if (buf.bufpos)
+        emit(ctx, buf.textbuf, buf.bufpos);
+    if (clip->local && buf.bufpos) {
+        sgrowarrayn(clip->localtext, clip->localsize, clip->locallen,
+                    buf.bufpos);
+        memcpy(clip->localtext + clip->locallen, buf.textbuf,
+               buf.bufpos * sizeof(wchar_t));
+        clip->locallen += buf.bufpos;
+    }
+    sfree(buf.textbuf);
+}
+
+/*
+ * How many selected lines of scrollback the steps so far have had to
+ * leave out, because their blocks couldn't be read back from disk.
+ */
+int termclip_lost(termclip *clip)
+{
+    return clip->lost;
+}
+
+void termclip_free(termclip *clip)
+{
+    for (int i = 0; i < clip->nscreen; i++)
+        free_compressed_line(clip->screen[i]);
+    sfree(clip->screen);
+    sbsnapshot_free(clip->ss);
+    sfree(clip->localtext);
+    sfree(clip);
+}
+
+/*
+ * The front end has run all the steps of 'clip': if it is the latest
+ * selection for the local clipboard, its text goes there. Frees clip.
+ */
+void term_clip_stream_done(Terminal *term, termclip *clip)
+{
+    if (clip->local && term->last_selected_clip == clip) {
+        /* terminated, like the text clipme() leaves there */
+        sgrowarrayn(clip->localtext, clip->localsize, clip->locallen, 1);
+        clip->localtext[clip->locallen] = 0;
+        sfree(term->last_selected_text);
+        term->last_selected_text = clip->localtext;
+        term->last_selected_len = clip->locallen;
+        term->last_selected_clip = NULL;
+        clip->localtext = NULL;
+    }
+    termclip_free(clip);
+}
+
+/*
+ * Hand a large plain-text selection to the front end to copy, if it
+ * can. Returns false if clipme() should copy it itself after all.
+ */
+static bool clip_stream(Terminal *term, pos top, pos bottom, bool rect,
+                        bool desel, const int *clipboards, int n_clipboards)
+{
+    int clipboard = CLIP_NULL;
+    bool local = false;
+
+    if (term->rtf_paste || bottom.y - top.y < CLIP_STREAM_ROWS)
+        return false;
+    for (int i = 0; i < n_clipboards; i++) {
+        if (clipboards[i] == CLIP_LOCAL) {
+            local = true;
+        } else if (clipboards[i] != CLIP_NULL) {
+            if (clipboard != CLIP_NULL)
+                return false;
+            clipboard = clipboards[i];
         }
-        top.y++;
-        top.x = rect ? old_top_x : 0;
+    }
+    if (clipboard == CLIP_NULL && !local)
+        return false;
+    /* Alternate screen lines kept as scrollback aren't in the store. */
+    if (sblines(term) != sbstore_count(term->scrollback))
+        return false;
+
+    termclip *clip = termclip_new(term, top, bottom, rect);
+    clip->local = local;
+    if (!win_clip_write_stream(term->win, clipboard, clip, desel)) {
+        termclip_free(clip);
+        return false;
+    }
+    if (local) {
+        /* until the copy is done, there's nothing to paste locally */
+        sfree(term->last_selected_text);
+        sfree(term->last_selected_attr);
+        sfree(term->last_selected_tc);
+        term->last_selected_text = snewn(1, wchar_t);
+        term->last_selected_text[0] = 0;
+        term->last_selected_attr = NULL;
+        term->last_selected_tc = NULL;
+        term->last_selected_len = 0;
+        term->last_selected_clip = clip;
+    }
+    return true;
+}
+#endif
+
+static void clipme(Terminal *term, pos top, pos bottom, bool rect, bool desel,
+                   const int *clipboards, int n_clipboards)
+{
+    clip_workbuf buf;
+    clip_source src;
+
+#ifdef IS_QUTTY
+    if (clip_stream(term, top, bottom, rect, desel, clipboards,
+                    n_clipboards))
+        return;
+#endif
 
+    src.ucsdata = term->ucsdata;
+    src.rawcnp = term->rawcnp;
+    src.cols = term->cols;
+    src.rect = rect;
+    src.old_top_x = top.x;
+    src.erase_tc = TC_VALUE(term, term->basic_erase_char.truecolour);
+
+    buf.bufsize = 5120;
+    buf.bufpos = 0;
+    buf.textptr = buf.textbuf = snewn(buf.bufsize, wchar_t);
+#ifdef IS_QUTTY
+    src.tct = term->rtf_paste ? &term->tctable : NULL;
+    if (!term->rtf_paste) {
+        /* Nothing here uses the attributes except for rich text. */
+        buf.attrptr = buf.attrbuf = NULL;
+        buf.tcptr = buf.tcbuf = NULL;
+    } else
+#endif
+    {
+        buf.attrptr = buf.attrbuf = snewn(buf.bufsize, int);
+        buf.tcptr = buf.tcbuf = snewn(buf.bufsize, truecolour);
+    }
+
+    while (poslt(top, bottom)) {
+        termline *ldata = lineptr(top.y);
+        clip_addline(&buf, &src, ldata, &top, bottom);
         unlineptr(ldata);
     }
 #if SELECTION_NUL_TERMINATED
-    clip_addchar(&buf, 0, 0, term->basic_erase_char.truecolour);
+    clip_addchar(&buf, 0, 0, src.erase_tc);
 #endif
     /* Finally, transfer all that to the clipboard(s). */
     {
@@ -6861,6 +8052,9 @@ static void clipme(Terminal *term, pos top, pos bottom, bool rect, bool desel,
             term->last_selected_attr = buf.attrbuf;
             term->last_selected_tc = buf.tcbuf;
             term->last_selected_len = buf.bufpos;
+#ifdef IS_QUTTY
+            term->last_selected_clip = NULL;
+#endif
         } else {
             sfree(buf.textbuf);
             sfree(buf.attrbuf);
@@ -7170,30 +8364,28 @@ static bool wstartswith(const wchar_t *a, size_t alen,
     return alen >= blen && !wcsncmp(a, b, blen);
 }
 
-void term_do_paste(Terminal *term, const wchar_t *data, size_t len)
+/*
+ * The longest sequence paste_filter() has to look ahead for: the
+ * clipboard's newline, or the end-of-paste sequence.
+ */
+#define PASTE_LOOKAHEAD 6
+
+/*
+ * Filter pasted text into 'out' (which may be 'data' itself), and
+ * return how much of 'data' was consumed. Unless 'final', anything
+ * within PASTE_LOOKAHEAD of the end is left for the next call, as it
+ * might be the start of a sequence that carries on there.
+ */
+static size_t paste_filter(Terminal *term, const wchar_t *data, size_t len,
+                           bool final, wchar_t *out, size_t *outlen)
 {
     const wchar_t *p;
     bool paste_controls = conf_get_bool(term->conf, CONF_paste_controls);
-
-    /*
-     * Pasting data into the terminal counts as a keyboard event (for
-     * purposes of the 'Reset scrollback on keypress' config option),
-     * unless the paste is zero-length.
-     */
-    if (len == 0)
-        return;
-    term_seen_key_event(term);
-
-    if (term->paste_buffer)
-        sfree(term->paste_buffer);
-    term->paste_pos = term->paste_len = 0;
-    term->paste_buffer = snewn(len + 12, wchar_t);
-
-    if (term->bracketed_paste && !term->no_bracketed_paste)
-        term_bracketed_paste_start(term);
+    size_t n = 0;
 
     p = data;
-    while (p < data + len) {
+    while (p < data + len &&
+           (final || (size_t)(data + len - p) >= PASTE_LOOKAHEAD)) {
         wchar_t wc = *p++;
 
         if (wc == sel_nl[0] &&
@@ -7236,9 +8428,38 @@ void term_do_paste(Terminal *term, const wchar_t *data, size_t len)
             }
         }
 
-        term->paste_buffer[term->paste_len++] = wc;
+        out[n++] = wc;
     }
 
+    *outlen = n;
+    return p - data;
+}
+
+void term_do_paste(Terminal *term, const wchar_t *data, size_t len)
+{
+    /*
+     * Pasting data into the terminal counts as a keyboard event (for
+     * purposes of the 'Reset scrollback on keypress' config option),
+     * unless the paste is zero-length.
+     */
+    if (len == 0)
+        return;
+    term_seen_key_event(term);
+
+#ifdef IS_QUTTY
+    if (term->paste_stream)
+        term_nopaste(term);
+#endif
+    if (term->paste_buffer)
+        sfree(term->paste_buffer);
+    term->paste_pos = term->paste_len = 0;
+    term->paste_buffer = snewn(len + 12, wchar_t);
+
+    if (term->bracketed_paste && !term->no_bracketed_paste)
+        term_bracketed_paste_start(term);
+
+    paste_filter(term, data, len, true, term->paste_buffer, &term->paste_len);
+
     /* Assume a small paste will be OK in one go. */
     if (term->paste_len < 256) {
         if (term->ldisc) {
@@ -7258,6 +8479,64 @@ void term_do_paste(Terminal *term, const wchar_t *data, size_t len)
     queue_toplevel_callback(term_paste_callback, term);
 }
 
+#ifdef IS_QUTTY
+/*
+ * A paste too big to hold in full is streamed instead: the front end
+ * starts it, passes the text in as many pieces as it likes, at
+ * whatever pace the backend can take, and ends it. Each piece is
+ * filtered as by term_do_paste() and sent straight away. Anything
+ * that stops a paste (a key press, term_nopaste(), another paste)
+ * ends the stream, which the front end sees as term->paste_stream
+ * going false.
+ */
+void term_paste_stream_start(Terminal *term)
+{
+    term_nopaste(term);
+    term_seen_key_event(term);
+    term->paste_stream = true;
+    term->paste_carry_len = 0;
+    if (term->bracketed_paste && !term->no_bracketed_paste)
+        term_bracketed_paste_start(term);
+}
+
+static void term_paste_stream_send(Terminal *term, const wchar_t *data,
+                                   size_t len, bool final)
+{
+    size_t n = term->paste_carry_len + len;
+    wchar_t *buf = snewn(n ? n : 1, wchar_t);
+    memcpy(buf, term->paste_carry, term->paste_carry_len * sizeof(wchar_t));
+    memcpy(buf + term->paste_carry_len, data, len * sizeof(wchar_t));
+
+    size_t outlen, used = paste_filter(term, buf, n, final, buf, &outlen);
+    term->paste_carry_len = n - used;
+    assert(term->paste_carry_len <= lenof(term->paste_carry));
+    memmove(term->paste_carry, buf + used,
+            term->paste_carry_len * sizeof(wchar_t));
+
+    if (term->ldisc && outlen) {
+        strbuf *sb = term_input_data_from_unicode(term, buf, outlen);
+        term_keyinput_internal(term, sb->s, sb->len, false);
+        strbuf_free(sb);
+    }
+    sfree(buf);
+}
+
+void term_paste_stream_data(Terminal *term, const wchar_t *data, size_t len)
+{
+    if (term->paste_stream)
+        term_paste_stream_send(term, data, len, false);
+}
+
+void term_paste_stream_end(Terminal *term)
+{
+    if (!term->paste_stream)
+        return;
+    term_paste_stream_send(term, NULL, 0, true);
+    term->paste_stream = false;
+    term_bracketed_paste_stop(term);
+}
+#endif
+
 void term_mouse(Terminal *term, Mouse_Button braw, Mouse_Button bcooked,
                 Mouse_Action a, int x, int y, bool shift, bool ctrl, bool alt)
 {
@@ -7890,6 +9169,12 @@ void term_keyinput(Terminal *term, int codepage, const void *str, int len)
 
 void term_nopaste(Terminal *term)
 {
+#ifdef IS_QUTTY
+    if (term->paste_stream) {
+        term->paste_stream = false;
+        term_bracketed_paste_stop(term);
+    }
+#endif
     if (term->paste_len == 0)
         return;
     sfree(term->paste_buffer);
@@ -7932,7 +9217,12 @@ static void term_added_data(Terminal *term, bool called_from_term_data)
 
 size_t term_data(Terminal *term, const void *data, size_t len)
 {
+#ifdef IS_QUTTY
+    /* output straight out of a received packet is parsed where it lies */
+    bufchain_add_adopting(&term->inbuf, data, len);
+#else
     bufchain_add(&term->inbuf, data, len);
+#endif
     term_added_data(term, true);
     return bufchain_size(&term->inbuf);
 }
@@ -8200,15 +9490,16 @@ termline *get_next_termline (Terminal *term, termline *tline, int cur_line)
   if (tline) {
     tline = (termline*) delpos234(term->screen, 0);
     if (cur_line >= term->rows) {
-      addpos234(term->scrollback, compressline_no_free(tline),
-                count234(term->scrollback));
+      scrollback_add(term, tline);
       term->tempsblines += 1;
     }
     resizeline(term, tline, term->cols);
     for (i = 0; i < term->cols; i++)
       copy_termchar(tline, i, &term->erase_char);
     tline->lattr = LATTR_NORM;
+    tline->bidi = false;
     addpos234(term->screen, tline, term->rows-1);
+    term->dirty_all = true;
   }
   return index234(term->screen, term->rows-1);
 }
@@ -13,6 +13,19 @@ struct beeptime {
     unsigned long ticks;
 };
 
+#ifdef IS_QUTTY
+/*
+ * A scroll of the live screen not yet shown in the window. do_paint
+ * replays these through win_scroll() so that the front end can move
+ * what it has already drawn instead of redrawing it.
+ */
+struct scrollregion {
+    struct scrollregion *next;
+    int topline, botline;       /* inclusive screen line range */
+    int lines;                  /* +ve is up, as in scroll() */
+};
+#endif
+
 #define TRUST_SIGIL_WIDTH 3
 #define TRUST_SIGIL_CHAR 0xDFFE
 
@@ -21,6 +34,27 @@ typedef struct {
 } pos;
 
 typedef struct termchar termchar;
+
+#ifdef IS_QUTTY
+/*
+ * The distinct truecolour values found in a terminal's cells, each
+ * stored once. Index 0 is always 'no truecolour at all', which is
+ * what almost every cell has. Lines in the scrollback hold the
+ * colours themselves, so only the live cells refer to the table,
+ * and it is rebuilt from them whenever it has filled up with
+ * colours that nothing uses any more.
+ */
+typedef unsigned int tcindex;
+
+typedef struct tctable {
+    truecolour *colours;
+    tcindex n, size;
+    tcindex *hash;                     /* open addressing; 0 is empty */
+    size_t hashsize;                   /* a power of 2, at least 2*size */
+    tcindex last;                      /* the most recently looked up */
+    tcindex limit;                     /* n at which to rebuild */
+} tctable;
+#endif
 typedef struct termline termline;
 
 struct termchar {
@@ -29,9 +63,22 @@ struct termchar {
      * when extra fields are added here is labelled with a comment
      * saying FULL-TERMCHAR.
      */
+#ifdef IS_QUTTY
+    /*
+     * Every cell of the screen, the display and the bidi buffers is
+     * one of these, so they're kept to 16 bytes: chr is a code point
+     * or a CSET_* byte and attr never needs more than 32 bits, and
+     * truecolour is an index into the terminal's tctable instead of
+     * the colours themselves.
+     */
+    unsigned int chr;
+    unsigned int attr;
+    tcindex truecolour;
+#else
     unsigned long chr;
     unsigned long attr;
     truecolour truecolour;
+#endif
 
     /*
      * The cc_next field is used to link multiple termchars
@@ -56,6 +103,10 @@ struct termline {
     int cc_free;                       /* offset to first cc in free list */
     struct termchar *chars;
     bool trusted;
+#ifdef IS_QUTTY
+    bool bidi;                         /* may hold a character that bidi or
+                                        * Arabic shaping would act on */
+#endif
 };
 
 struct bidi_cache_entry {
@@ -73,11 +124,101 @@ struct term_utf8_decode {
 
 struct term_userpass_state;
 
+#ifdef IS_QUTTY
+typedef struct compressed_scrollback_line {
+    size_t len;
+    /* compressed data follows after this */
+} compressed_scrollback_line;
+
+/*
+ * Scrollback lines packed into compressed arena blocks, in place of
+ * upstream's tree234 of individually allocated lines. See scrollback.c.
+ */
+typedef struct sbstore sbstore;
+
+/*
+ * Disk storage for scrollback blocks that have been spilled out of
+ * memory, provided by the front end. Data is appended to numbered
+ * segment files, and read back a block at a time.
+ */
+typedef struct sbspill sbspill;
+struct sbspill {
+    const struct sbspill_vtable *vt;
+};
+struct sbspill_vtable {
+    /* Append to a segment, creating it if need be. Returns the offset
+     * the data was written at, or -1 on failure. */
+    int64_t (*write)(sbspill *sp, unsigned segment, const void *data,
+                     size_t len);
+    /* Map part of a segment for reading, or return NULL on failure. */
+    const void *(*map)(sbspill *sp, unsigned segment, uint64_t offset,
+                       size_t len);
+    void (*unmap)(sbspill *sp, unsigned segment, const void *data);
+    /* Copy part of a segment into 'buf'. Unlike the others, this may
+     * be called from any thread, while the store goes on using them;
+     * it fails if the segment has been removed meanwhile. */
+    bool (*read)(sbspill *sp, unsigned segment, uint64_t offset, void *buf,
+                 size_t len);
+    /* Delete a segment that the store no longer refers to (and which
+     * may never have been written). */
+    void (*remove)(sbspill *sp, unsigned segment);
+    void (*free)(sbspill *sp);
+};
+
+sbstore *sbstore_new(void);
+void sbstore_free(sbstore *sb);
+void sbstore_clear(sbstore *sb);
+void sbstore_set_spill(sbstore *sb, sbspill *spill, int memlines);
+int sbstore_count(sbstore *sb);
+uint64_t sbstore_lineseq(sbstore *sb);
+void sbstore_add(sbstore *sb, compressed_scrollback_line *cline,
+                 const char *text, size_t textlen);
+compressed_scrollback_line *sbstore_index(sbstore *sb, int index);
+void sbstore_delfirst(sbstore *sb);
+void sbstore_dellast(sbstore *sb);
+int sbstore_find(sbstore *sb, const char *text, size_t len, int index,
+                 int dir);
+size_t sbstore_memory(sbstore *sb);
+
+typedef struct sbsnapshot sbsnapshot;
+sbsnapshot *sbstore_snapshot(sbstore *sb, const char *text, size_t len);
+sbsnapshot *sbstore_snapshot_lines(sbstore *sb, int first, int last);
+size_t sbsnapshot_blocks(sbsnapshot *ss);
+bool sbsnapshot_lines(sbsnapshot *ss, size_t block,
+                      void (*fn)(void *ctx, int index,
+                                 compressed_scrollback_line *cline),
+                      void *ctx);
+void sbsnapshot_range(sbsnapshot *ss, size_t block, int *first,
+                      int *nlines);
+void sbsnapshot_free(sbsnapshot *ss);
+
+void term_search_text(Terminal *term, int row, strbuf *out);
+void sbline_search_text(const struct unicode_data *ucsdata,
+                        compressed_scrollback_line *cline, strbuf *out);
+
+size_t termclip_steps(termclip *clip);
+void termclip_step(termclip *clip, size_t step,
+                   void (*emit)(void *ctx, const wchar_t *text, size_t len),
+                   void *ctx);
+int termclip_lost(termclip *clip);
+void termclip_free(termclip *clip);
+void term_clip_stream_done(Terminal *term, termclip *clip);
+
+void term_paste_stream_start(Terminal *term);
+void term_paste_stream_data(Terminal *term, const wchar_t *data, size_t len);
+void term_paste_stream_end(Terminal *term);
+#endif
+
 struct terminal_tag {
 
     int compatibility_level;
 
+#ifdef IS_QUTTY
+    sbstore *scrollback;               /* lines scrolled off top of screen */
+    strbuf *sbtext;                    /* scratch for the search index */
+#else
     tree234 *scrollback;               /* lines scrolled off top of screen */
+#endif
     tree234 *screen;                   /* lines on primary screen */
     tree234 *alt_screen;               /* lines on alternate screen */
     int disptop;                       /* distance scrolled back (0 or -ve) */
@@ -88,10 +229,32 @@ struct terminal_tag {
     termline **disptext;               /* buffer of text on real screen */
     int dispcursx, dispcursy;          /* location of cursor on real screen */
     int curstype;                      /* type of cursor on real screen */
+#ifdef IS_QUTTY
+    /*
+     * Rows of disptext that do_paint has to look at. Anything that
+     * changes a line of the screen marks its row, and anything that
+     * changes the display as a whole sets dirty_all. 'painted' is
+     * what the last do_paint drew with, so that it can tell when one
+     * of those has changed in the meantime.
+     */
+    uint64_t *dirty_rows;
+    int dirty_nrows;                   /* rows dirty_rows has room for */
+    bool dirty_all;
+    struct {
+        int disptop, rv;
+        bool tblink, ansi_colour, xterm_256_colour, true_colour;
+        int selstate, seltype;
+        pos selstart, selend;
+    } painted;
+#endif
 
 #define VBELL_TIMEOUT (TICKSPERSEC/10) /* visual bell lasts 1/10 sec */
 
     struct beeptime *beephead, *beeptail;
+#ifdef IS_QUTTY
+    struct scrollregion *scrollhead, *scrolltail;
+    int nscrolls;
+#endif
     int nbeeps;
     bool beep_overloaded;
     long lastbeep;
@@ -102,6 +265,9 @@ struct terminal_tag {
     int default_attr, curr_attr, save_attr;
     truecolour curr_truecolour, save_truecolour;
     termchar basic_erase_char, erase_char;
+#ifdef IS_QUTTY
+    tctable tctable;                   /* the colours cells refer to */
+#endif
 
     bufchain inbuf;                    /* terminal input buffer */
 
@@ -237,6 +403,11 @@ struct terminal_tag {
 
     wchar_t *paste_buffer;
     size_t paste_len, paste_pos;
+#ifdef IS_QUTTY
+    bool paste_stream;                 /* see term_paste_stream_start */
+    wchar_t paste_carry[8];            /* text held back between pieces */
+    size_t paste_carry_len;
+#endif
 
     Backend *backend;
 
@@ -343,6 +514,9 @@ struct terminal_tag {
     bool no_remote_wintitle;
     bool no_remote_clearscroll;
     bool rawcnp;
+#ifdef IS_QUTTY
+    bool rtf_paste;                    /* copy attributes, not just text */
+#endif
     bool utf8linedraw;
     bool rect_select;
     int remote_qtitle_action;
@@ -356,6 +530,11 @@ struct terminal_tag {
     int *last_selected_attr;
     truecolour *last_selected_tc;
     size_t last_selected_len;
+#ifdef IS_QUTTY
+    /* a streamed copy that will fill last_selected_* when it's done;
+     * only ever compared, as the front end owns it */
+    termclip *last_selected_clip;
+#endif
     int mouse_select_clipboards[N_CLIPBOARDS];
     int n_mouse_select_clipboards;
     int mouse_paste_clipboard;
@@ -19,8 +19,101 @@
 struct bufchain_granule {
     struct bufchain_granule *next;
     char *bufpos, *bufend, *bufmax;
+#ifdef IS_QUTTY
+    SharedBuffer *shared;      /* data lives there, not after this header */
+#endif
 };
 
+#ifdef IS_QUTTY
+/*
+ * Below this size, copying into a granule is cheaper than keeping a
+ * whole shared buffer alive for the sake of a few bytes of it.
+ */
+#define BUFFER_MIN_ADOPT  4096
+
+struct SharedBuffer {
+    size_t refs;
+    size_t size;
+    SharedBuffer *next_receiving;
+    max_align_t data[1];
+};
+
+/* buffers between sharedbuf_enter() and sharedbuf_leave(), innermost first */
+static SharedBuffer *receiving;
+
+SharedBuffer *sharedbuf_new(size_t size)
+{
+    SharedBuffer *sb = snew_plus(SharedBuffer, size);
+    sb->refs = 1;
+    sb->size = size;
+    sb->next_receiving = NULL;
+    return sb;
+}
+
+void *sharedbuf_data(SharedBuffer *sb)
+{
+    return sb->data;
+}
+
+size_t sharedbuf_size(SharedBuffer *sb)
+{
+    return sb->size;
+}
+
+bool sharedbuf_is_shared(SharedBuffer *sb)
+{
+    return sb->refs > 1;
+}
+
+SharedBuffer *sharedbuf_ref(SharedBuffer *sb)
+{
+    sb->refs++;
+    return sb;
+}
+
+void sharedbuf_unref(SharedBuffer *sb)
+{
+    assert(sb->refs > 0);
+    if (--sb->refs == 0)
+        sfree(sb);
+}
+
+void sharedbuf_enter(SharedBuffer *sb)
+{
+    sb->next_receiving = receiving;
+    receiving = sb;
+}
+
+void sharedbuf_leave(SharedBuffer *sb)
+{
+    assert(receiving == sb);
+    receiving = sb->next_receiving;
+    sb->next_receiving = NULL;
+}
+
+SharedBuffer *sharedbuf_owning(const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    for (SharedBuffer *sb = receiving; sb; sb = sb->next_receiving) {
+        const char *start = (const char *)sb->data;
+        if (p >= start && p <= start + sb->size &&
+            len <= (size_t)(start + sb->size - p))
+            return sb;
+    }
+    return NULL;
+}
+#endif
+
+static void bufchain_granule_free(struct bufchain_granule *b)
+{
+#ifdef IS_QUTTY
+    if (b->shared)
+        sharedbuf_unref(b->shared);
+#endif
+    smemclr(b, sizeof(*b));
+    sfree(b);
+}
+
 static void uninitialised_queue_idempotent_callback(IdempotentCallback *ic)
 {
     unreachable("bufchain callback used while uninitialised");
@@ -40,8 +133,7 @@ void bufchain_clear(bufchain *ch)
     while (ch->head) {
         b = ch->head;
         ch->head = ch->head->next;
-        smemclr(b, sizeof(*b));
-        sfree(b);
+        bufchain_granule_free(b);
     }
     ch->tail = NULL;
     ch->buffersize = 0;
@@ -85,6 +177,9 @@ void bufchain_add(bufchain *ch, const void *data, size_t len)
                 (char *)newbuf + sizeof(struct bufchain_granule);
             newbuf->bufmax = (char *)newbuf + grainlen;
             newbuf->next = NULL;
+#ifdef IS_QUTTY
+            newbuf->shared = NULL;
+#endif
             if (ch->tail)
                 ch->tail->next = newbuf;
             else
@@ -97,6 +192,51 @@ void bufchain_add(bufchain *ch, const void *data, size_t len)
         ch->queue_idempotent_callback(ch->ic);
 }
 
+#ifdef IS_QUTTY
+/*
+ * Append data that lives in a shared buffer by reference: the new
+ * granule points into the buffer and holds a reference to it until
+ * the data has been consumed, so nothing is copied.
+ */
+void bufchain_add_shared(bufchain *ch, SharedBuffer *sb,
+                         const void *data, size_t len)
+{
+    if (len < BUFFER_MIN_ADOPT) {
+        bufchain_add(ch, data, len);
+        return;
+    }
+
+    struct bufchain_granule *newbuf = snew(struct bufchain_granule);
+    newbuf->bufpos = (char *)data;
+    /* bufmax == bufend, so bufchain_add never writes into it */
+    newbuf->bufend = newbuf->bufmax = newbuf->bufpos + len;
+    newbuf->shared = sharedbuf_ref(sb);
+    newbuf->next = NULL;
+    if (ch->tail)
+        ch->tail->next = newbuf;
+    else
+        ch->head = newbuf;
+    ch->tail = newbuf;
+    ch->buffersize += len;
+
+    if (ch->ic)
+        ch->queue_idempotent_callback(ch->ic);
+}
+
+/*
+ * Like bufchain_add, but data inside a shared buffer that is currently
+ * being received from is adopted rather than copied.
+ */
+void bufchain_add_adopting(bufchain *ch, const void *data, size_t len)
+{
+    SharedBuffer *sb = sharedbuf_owning(data, len);
+    if (sb)
+        bufchain_add_shared(ch, sb, data, len);
+    else
+        bufchain_add(ch, data, len);
+}
+#endif
+
 void bufchain_consume(bufchain *ch, size_t len)
 {
     struct bufchain_granule *tmp;
@@ -111,8 +251,7 @@ void bufchain_consume(bufchain *ch, size_t len)
             ch->head = tmp->next;
             if (!ch->head)
                 ch->tail = NULL;
-            smemclr(tmp, sizeof(*tmp));
-            sfree(tmp);
+            bufchain_granule_free(tmp);
         } else
             ch->head->bufpos += remlen;
         ch->buffersize -= remlen;
@@ -136,7 +136,7 @@ int TmuxWindowPane::resp_hdlr_dump_history(string &response, bool is_alt) {
   Terminal *term = _termWnd->term;
 
   // make sure we start with clean slate
-  if (!is_alt) assert(count234(term->scrollback) == 0);
+  if (!is_alt) assert(sbstore_count(term->scrollback) == 0);
   assert(count234(term->screen) == term->rows);
   assert(count234(term->alt_screen) == term->rows);
 